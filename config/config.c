@@ -168,6 +168,25 @@ char *context = "context";
  */
 char *mh_seq = ".mh_sequences";
 
+/*
+ * Name of the file in each folder to which small changes to the public
+ * sequences are appended.  If NULL or "\0", the default, the sequence
+ * file is always rewritten.
+ */
+char *mh_seq_journal = NULL;
+
+/*
+ * Name of the file in each folder that indexes parsed message headers
+ * for scan.  If NULL or "\0", the default, no index is kept.
+ */
+char *mh_index = NULL;
+
+/*
+ * Name of the file in each folder that records which messages it
+ * holds, for flist.  If NULL or "\0", the default, none is kept.
+ */
+char *mh_summary = NULL;
+
 /* 
  * nmh globals
  */
@@ -76,6 +76,14 @@ typedef union {
 /* FENDNULL fends off NULL by giving an empty string instead. */
 #define FENDNULL(s) ((s) ? (s) : "")
 
+/* MTIME_NSEC gives the nanoseconds of struct stat st's modification
+ * time, or -1 where the system doesn't record them. */
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+# define MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#else
+# define MTIME_NSEC(st) (-1L)
+#endif
+
 /* If not specified in a file and PAGER is NULL or empty. */
 #define DEFAULT_PAGER "more"
 
@@ -309,12 +317,21 @@ struct msgs {
      * This is an array of bvector_t which we allocate dynamically.
      * Each bvector_t is a set of bits flags for a particular message.
      * These bit flags represent general attributes such as
-     * EXISTS, SELECTED, etc. as well as track if message is
-     * in a particular sequence.
+     * EXISTS, SELECTED, etc.  An all-zero entry has none of
+     * them, so the array is allocated zeroed; see folder_realloc().
      */
     size_t num_msgstats;
     struct bvector *msgstats;	/* msg status */
 
+    /*
+     * The messages in each sequence, indexed like msgattrs.  Each
+     * is held as runs of message numbers, so that a sequence costs
+     * space for its ranges rather than a bit in every message.
+     * Use in_sequence() and friends, or sbr/seq_msgs.c.
+     */
+    size_t num_msgseqs;
+    rvector_t *msgseqs;
+
     /*
      * A FILE handle containing an open filehandle for the sequence file
      * for this folder.  If non-NULL, use it when the sequence file is
@@ -326,6 +343,13 @@ struct msgs {
      * The name of the public sequence file; required by lkfclose()
      */
     char *seqname;
+
+    /*
+     * The public sequences as they were read, kept if the sequence
+     * journal is enabled so that seq_save() can write just what has
+     * changed; see sbr/seq_file.c.
+     */
+    struct seq_file *pubseqs;
 };
 
 /*
@@ -340,10 +364,14 @@ struct msgs {
  * macros for message and sequence manipulation
  */
 #define msgstat(mp,n) ((mp)->msgstats + (n) - mp->lowoff)
-#define clear_msg_flags(mp,msgnum)   bvector_clear_all (msgstat(mp, msgnum))
-#define copy_msg_flags(mp,i,j)       bvector_copy (msgstat(mp,i), msgstat(mp,j))
-#define get_msg_flags(mp,ptr,msgnum) bvector_copy (ptr, msgstat(mp, msgnum))
-#define set_msg_flags(mp,ptr,msgnum) bvector_copy (msgstat(mp, msgnum), ptr)
+#define clear_msg_flags(mp,msgnum) \
+        (bvector_clear_all (msgstat(mp, msgnum)), seq_clear_msg (mp, msgnum))
+#define copy_msg_flags(mp,i,j) \
+        (bvector_copy (msgstat(mp,i), msgstat(mp,j)), seq_copy_msg (mp, i, j))
+#define get_msg_flags(mp,ptr,msgnum) \
+        (bvector_copy (ptr, msgstat(mp, msgnum)), seq_get_msg (mp, ptr, msgnum))
+#define set_msg_flags(mp,ptr,msgnum) \
+        (bvector_copy (msgstat(mp, msgnum), ptr), seq_set_msg (mp, ptr, msgnum))
 
 #define does_exist(mp,msgnum)     bvector_at (msgstat(mp, msgnum), EXISTS)
 #define unset_exists(mp,msgnum)   bvector_clear (msgstat(mp, msgnum), EXISTS)
@@ -366,11 +394,11 @@ struct msgs {
         bvector_set (msgstat(mp, msgnum), SELECT_UNSEEN)
 
 #define in_sequence(mp,seqnum,msgnum) \
-        bvector_at (msgstat(mp, msgnum), FFATTRSLOT + seqnum)
+        rvector_at (seq_msgs (mp, seqnum), msgnum)
 #define clear_sequence(mp,seqnum,msgnum) \
-        bvector_clear (msgstat(mp, msgnum), FFATTRSLOT + seqnum)
+        rvector_clear (seq_msgs (mp, seqnum), msgnum)
 #define add_sequence(mp,seqnum,msgnum) \
-        bvector_set (msgstat(mp, msgnum), FFATTRSLOT + seqnum)
+        rvector_set (seq_msgs (mp, seqnum), msgnum)
 
 #define is_seq_private(mp,seqnum) \
         bvector_at (mp->attrstats, FFATTRSLOT + seqnum)
@@ -503,8 +531,11 @@ extern char *incproc;
 extern char *lproc;
 extern char *mailproc;
 extern char *mh_defaults;
+extern char *mh_index;
 extern char *mh_profile;
 extern char *mh_seq;
+extern char *mh_seq_journal;
+extern char *mh_summary;
 extern char *mhlformat;
 extern char *mhlforward;
 extern char *mhlproc;
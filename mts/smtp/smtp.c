@@ -38,6 +38,14 @@
 #define	SM_DOT	600	/* see above */
 #define	SM_QUIT	 30
 
+/* The most commands sent ahead of their replies to a server that takes
+ * them pipelined.  The replies to this many must fit in the socket
+ * buffers, or both ends could block writing. */
+#define	SM_WINDOW 100
+
+/* Bytes of message text sent with each BDAT. */
+#define	SM_CHUNK (8 * BUFSIZ)
+
 static int sm_addrs = 0;
 static int sm_child = NOTOK;
 static int sm_debug = 0;
@@ -45,6 +53,50 @@ static bool sm_nl = true;
 static int sm_verbose = 0;
 static netsec_context *nsc = NULL;
 
+static int sm_rcpts = 0;	/* RCPT TOs sent, awaiting replies       */
+static bool sm_data;		/* DATA sent behind them, awaiting reply */
+static bool sm_indata;		/* DATA accepted, text not yet ended     */
+static bool sm_chunking;	/* sending the text with BDAT            */
+static int sm_bdats = 0;	/* BDATs sent, awaiting replies          */
+static size_t sm_chunklen;
+static char sm_chunk[SM_CHUNK];
+
+/*
+ * send runs one post without a file, which keeps the connection to the
+ * server open for the posts of each of its drafts, so that only the
+ * first pays for connecting, TLS and SASL.  Each of those attaches to
+ * it by passing one end of a new socket pair, with its stdout and
+ * stderr, over the session socket.  Its sm_() calls are then made by
+ * the session post, over the one connection, and sm_end() leaves that
+ * open with RSET rather than QUIT.
+ */
+static int sm_sessfd = NOTOK;	/* socket to attach to the session with  */
+static int sm_sd = NOTOK;	/* socket the sm_() calls are relayed on */
+
+/* The most a relayed call sends with it. */
+#define	SM_MAXREQ (8 * BUFSIZ)
+
+enum sm_op {
+    SM_OPINIT, SM_OPWINIT, SM_OPPIPELINE, SM_OPQADR, SM_OPQDATA,
+    SM_OPRADR, SM_OPWAEND, SM_OPWTXT, SM_OPWTEND, SM_OPEND
+};
+
+#define	SM_NARGS 6
+
+/* Followed by len bytes of text, or of NUL terminated strings. */
+struct sm_request {
+    int op;
+    int arg[SM_NARGS];
+    int len;
+};
+
+/* Followed by length bytes of sm_reply.text. */
+struct sm_response {
+    int result;
+    int code;
+    int length;
+};
+
 static char *sm_noreply = "No reply text given";
 static char *sm_moreply = "; ";
 static struct smtp sm_reply;
@@ -67,6 +119,20 @@ static int sm_ierror (const char *fmt, ...) CHECK_PRINTF(1, 2);
 static int sm_nerror (char *);
 static int smtalk (int time, char *fmt, ...) CHECK_PRINTF(2, 3);
 static int sm_wstream (char *, int);
+static int sm_wchunk (char *, int);
+static int sm_bdat (bool);
+static int sm_bdatend (void);
+static int sm_rcpt (int);
+static void sm_drain (void);
+static void sm_attach (void);
+static int sm_accept (int, int *, int *);
+static void sm_serveone (int, const char *, int, int, int, int);
+static int sm_call (int, const int *, const char *, int);
+static int sm_relay (int, const int *, const char *, int);
+static char *sm_pack (const char **, int, int *, int *);
+static void sm_unpack (char *, int, int, char **, int);
+static int sm_xread (int, void *, size_t);
+static int sm_xwrite (int, const void *, size_t);
 static int smhear (void);
 static char *EHLOset (char *) PURE;
 static int sm_sasl_callback(enum sasl_message_type, unsigned const char *,
@@ -78,9 +144,33 @@ sm_init (char *client, char *server, char *port, int watch, int verbose,
          int debug, int sasl, const char *saslmech, const char *user,
          const char *oauth_svc, int tls)
 {
-    if (sm_mts == MTS_SMTP)
+    if (sm_mts == MTS_SMTP) {
+	if (sm_sessfd != NOTOK)
+	    sm_attach ();
+	if (sm_sd != NOTOK) {
+	    const char *strs[] = { client, server, port, saslmech, user,
+				   oauth_svc };
+	    int arg[SM_NARGS], len, result;
+	    char *data = sm_pack (strs, DIM(strs), &arg[0], &len);
+
+	    arg[1] = watch;
+	    arg[2] = verbose;
+	    arg[3] = debug;
+	    arg[4] = sasl;
+	    arg[5] = tls;
+	    result = sm_call (SM_OPINIT, arg, data, len);
+	    free (data);
+	    if (result != NOTOK)
+		return result;
+
+	    /* The session's for other switches, or it's gone. */
+	    close (sm_sd);
+	    sm_sd = NOTOK;
+	}
+
 	return smtp_init (client, server, port, watch, verbose,
 			  debug, sasl, saslmech, user, oauth_svc, tls);
+    }
 
     return sendmail_init (client, watch, verbose, debug, sasl,
                           saslmech, user);
@@ -428,6 +518,15 @@ sm_winit (char *from, int smtputf8, int eightbit)
 {
     const char *mail_parameters = "";
 
+    if (sm_sd != NOTOK) {
+	int arg[SM_NARGS] = { smtputf8, eightbit };
+
+	return sm_relay (SM_OPWINIT, arg, from, strlen (from) + 1);
+    }
+
+    sm_chunking = EHLOset ("CHUNKING") != NULL;
+    sm_chunklen = 0;
+
     if (smtputf8) {
         /* Just for information, if an attempt is made to send to an 8-bit
            address without specifying SMTPUTF8, Gmail responds with
@@ -472,12 +571,97 @@ sm_winit (char *from, int smtputf8, int eightbit)
 }
 
 
+/*
+ * Return how many RCPT TOs may be sent with sm_qadr() before their
+ * replies are read with sm_radr():  more than one if the server takes
+ * pipelined commands.
+ */
+int
+sm_pipeline (void)
+{
+    if (sm_sd != NOTOK)
+	return sm_relay (SM_OPPIPELINE, NULL, NULL, 0);
+
+    return EHLOset ("PIPELINING") ? SM_WINDOW : 1;
+}
+
+
+/* Send RCPT TO, without waiting for the reply. */
 int
-sm_wadr (char *mbox, char *host, char *path)
+sm_qadr (char *mbox, char *host, char *path)
 {
-    switch (smtalk (SM_RCPT, host && *host ? "RCPT TO:<%s%s@%s>"
-					   : "RCPT TO:<%s%s>",
-			     FENDNULL(path), mbox, host)) {
+    char *errstr;
+
+    if (sm_sd != NOTOK) {
+	const char *strs[] = { mbox, host, path };
+	int arg[SM_NARGS], len, result;
+	char *data = sm_pack (strs, DIM(strs), &arg[0], &len);
+
+	result = sm_relay (SM_OPQADR, arg, data, len);
+	free (data);
+	return result;
+    }
+
+    if (netsec_printf (nsc, &errstr, host && *host ? "RCPT TO:<%s%s@%s>\r\n"
+						   : "RCPT TO:<%s%s>\r\n",
+		       FENDNULL(path), mbox, host) != OK)
+	return sm_nerror (errstr);
+
+    sm_rcpts++;
+    return RP_OK;
+}
+
+
+/*
+ * If the server takes pipelined commands, send DATA behind the RCPT
+ * TOs, so that sm_waend() just has to read its reply.  There's no DATA
+ * if the text is to be sent with BDAT.
+ */
+int
+sm_qdata (void)
+{
+    char *errstr;
+
+    if (sm_sd != NOTOK)
+	return sm_relay (SM_OPQDATA, NULL, NULL, 0);
+
+    if (sm_chunking  ||  ! EHLOset ("PIPELINING"))
+	return RP_OK;
+
+    if (netsec_printf (nsc, &errstr, "DATA\r\n") != OK)
+	return sm_nerror (errstr);
+
+    sm_data = true;
+    return RP_OK;
+}
+
+
+/* Read the reply to the oldest RCPT TO that hasn't had one. */
+int
+sm_radr (void)
+{
+    char *errstr;
+
+    if (sm_sd != NOTOK)
+	return sm_relay (SM_OPRADR, NULL, NULL, 0);
+
+    if (sm_rcpts == 0)
+	return sm_ierror ("no RCPT TO awaiting a reply");
+
+    if (netsec_flush (nsc, &errstr) != OK)
+	return sm_nerror (errstr);
+
+    netsec_set_timeout (nsc, SM_RCPT);
+    sm_rcpts--;
+
+    return sm_rcpt (smhear ());
+}
+
+
+static int
+sm_rcpt (int code)
+{
+    switch (code) {
 	case 250: 
 	case 251: 
 	    sm_addrs++;
@@ -508,9 +692,29 @@ sm_wadr (char *mbox, char *host, char *path)
 int
 sm_waend (void)
 {
-    switch (smtalk (SM_DATA, "DATA")) {
+    int code;
+    char *errstr;
+
+    if (sm_sd != NOTOK)
+	return sm_relay (SM_OPWAEND, NULL, NULL, 0);
+
+    if (sm_chunking)
+	return RP_OK;
+
+    if (sm_data) {
+	if (netsec_flush (nsc, &errstr) != OK)
+	    return sm_nerror (errstr);
+	netsec_set_timeout (nsc, SM_DATA);
+	sm_data = false;
+	code = smhear ();
+    } else {
+	code = smtalk (SM_DATA, "DATA");
+    }
+
+    switch (code) {
 	case 354: 
 	    sm_nl = true;
+	    sm_indata = true;
 	    return RP_OK;
 
 	case 451: 
@@ -532,12 +736,20 @@ sm_waend (void)
 int
 sm_wtxt (char *buffer, int len)
 {
-    int result, snoopstate;
+    int result, snoopstate, n;
+
+    if (sm_sd != NOTOK) {
+	for (result = RP_OK; len > 0 && result == RP_OK; buffer += n, len -= n)
+	    result = sm_relay (SM_OPWTXT, NULL, buffer,
+			       n = min (len, SM_MAXREQ));
+	return result;
+    }
 
     if ((snoopstate = netsec_get_snoop(nsc)))
 	netsec_set_snoop(nsc, 0);
 
-    result = sm_wstream (buffer, len);
+    result = sm_chunking ? sm_wchunk (buffer, len)
+			 : sm_wstream (buffer, len);
 
     netsec_set_snoop(nsc, snoopstate);
     return result == NOTOK ? RP_BHST : RP_OK;
@@ -547,12 +759,15 @@ sm_wtxt (char *buffer, int len)
 int
 sm_wtend (void)
 {
-    int snoopstate;
+    int snoopstate, code;
+
+    if (sm_sd != NOTOK)
+	return sm_relay (SM_OPWTEND, NULL, NULL, 0);
 
     if ((snoopstate = netsec_get_snoop(nsc)))
 	netsec_set_snoop(nsc, 0);
 
-    if (sm_wstream(NULL, 0) == NOTOK)
+    if ((sm_chunking ? sm_wchunk (NULL, 0) : sm_wstream (NULL, 0)) == NOTOK)
 	return RP_BHST;
 
     /*
@@ -571,7 +786,14 @@ sm_wtend (void)
 	netsec_set_snoop(nsc, snoopstate);
     }
 
-    switch (smtalk (SM_DOT + 3 * sm_addrs, ".")) {
+    if (sm_chunking) {
+	code = sm_bdatend ();
+    } else {
+	code = smtalk (SM_DOT + 3 * sm_addrs, ".");
+	sm_indata = false;
+    }
+
+    switch (code) {
 	case 250: 
 	case 251: 
 	    return RP_OK;
@@ -594,6 +816,16 @@ sm_end (int type)
     int status;
     struct smtp sm_note;
 
+    if (sm_sd != NOTOK) {
+	int arg[SM_NARGS] = { type };
+
+	sm_note = sm_reply;
+	status = sm_relay (SM_OPEND, arg, NULL, 0);
+	if (type == NOTOK)
+	    sm_reply = sm_note;
+	return status;
+    }
+
     if (sm_mts == MTS_SENDMAIL_SMTP) {
 	switch (sm_child) {
 	    case NOTOK: 
@@ -608,9 +840,12 @@ sm_end (int type)
     if (nsc == NULL)
 	return RP_OK;
 
+    sm_drain ();
+
     switch (type) {
 	case OK: 
-	    smtalk (SM_QUIT, "QUIT");
+	    if (!sm_indata)
+		smtalk (SM_QUIT, "QUIT");
 	    break;
 
 	case NOTOK: 
@@ -619,11 +854,14 @@ sm_end (int type)
 	    memcpy (sm_note.text, sm_reply.text, sm_reply.length + 1);
 	    /* FALLTHRU */
 	case DONE: 
-	    if (smtalk (SM_RSET, "RSET") == 250 && type == DONE)
+	    /* The server takes anything sent after DATA as text, so then
+	     * just close the connection, which abandons the message. */
+	    if (!sm_indata && smtalk (SM_RSET, "RSET") == 250 && type == DONE)
 		return RP_OK;
-	    if (sm_mts == MTS_SMTP)
-		smtalk (SM_QUIT, "QUIT");
-	    else {
+	    if (sm_mts == MTS_SMTP) {
+		if (!sm_indata)
+		    smtalk (SM_QUIT, "QUIT");
+	    } else {
 		/* The SIGPIPE block replaces old calls to discard ().
 		   We're not sure what the discard () calls were for,
 		   maybe to prevent deadlock on old systems.  In any
@@ -650,6 +888,7 @@ sm_end (int type)
 	netsec_shutdown(nsc);
 	nsc = NULL;
     }
+    sm_indata = false;
 
     if (sm_mts == MTS_SMTP) {
 	status = 0;
@@ -664,6 +903,440 @@ sm_end (int type)
 }
 
 
+/*
+ * Read the replies still owed for commands sent without waiting, so
+ * that the next one read is for the next command.  sm_reply is left as
+ * it was, to report.
+ */
+static void
+sm_drain (void)
+{
+    struct smtp note;
+    char *errstr;
+
+    if (sm_rcpts == 0  &&  !sm_data  &&  sm_bdats == 0)
+	return;
+
+    note = sm_reply;
+    if (netsec_flush (nsc, &errstr) != OK) {
+	free (errstr);
+	sm_rcpts = sm_bdats = 0;
+	sm_data = false;
+    }
+
+    netsec_set_timeout (nsc, SM_RCPT);
+    for (; sm_rcpts > 0; sm_rcpts--)
+	smhear ();
+    if (sm_data) {
+	netsec_set_timeout (nsc, SM_DATA);
+	if (smhear () == 354)
+	    sm_indata = true;
+	sm_data = false;
+    }
+    netsec_set_timeout (nsc, SM_DATA);
+    for (; sm_bdats > 0; sm_bdats--)
+	smhear ();
+
+    sm_reply = note;
+}
+
+
+/*
+ * Use the session send started, at fd, for the sm_() calls, if its post
+ * has the same switches for the server.  NOTOK detaches from it, so
+ * that they're made over a connection of our own.
+ */
+void
+sm_session (int fd)
+{
+    if (fd == NOTOK) {
+	if (sm_sessfd != NOTOK)
+	    close (sm_sessfd);
+	if (sm_sd != NOTOK) {
+	    close (sm_sd);
+	    sm_sd = NOTOK;
+	}
+    }
+    sm_sessfd = fd;
+}
+
+
+/*
+ * Keep the connection to the server for the posts that attach to the
+ * session at fd, until it's closed.  The switches are those for the
+ * server that each of them must have to share the connection.
+ */
+int
+sm_serve (int fd, char *client, char *server, char *port, int sasl,
+	  const char *saslmech, const char *user, const char *oauth_svc,
+	  int tls)
+{
+    const char *strs[] = { client, server, port, saslmech, user, oauth_svc };
+    int sd, out, err, saveout, saveerr, mask, len;
+    char *own;
+
+    if (sm_mts != MTS_SMTP) {
+	close (fd);
+	return RP_OK;
+    }
+
+    SIGNAL (SIGPIPE, SIG_IGN);
+    own = sm_pack (strs, DIM(strs), &mask, &len);
+
+    while ((sd = sm_accept (fd, &out, &err)) != NOTOK) {
+	/* What it would have written goes where it would have. */
+	fflush (stdout);
+	saveout = dup (fileno (stdout));
+	saveerr = dup (fileno (stderr));
+	dup2 (out, fileno (stdout));
+	dup2 (err, fileno (stderr));
+	close (out);
+	close (err);
+
+	sm_serveone (sd, own, mask, len, sasl, tls);
+	close (sd);
+
+	fflush (stdout);
+	dup2 (saveout, fileno (stdout));
+	dup2 (saveerr, fileno (stderr));
+	close (saveout);
+	close (saveerr);
+    }
+
+    free (own);
+    close (fd);
+
+    return sm_end (OK);
+}
+
+
+/* Pass the session a socket to relay the sm_() calls on. */
+static void
+sm_attach (void)
+{
+    int sv[2], fds[3];
+    char c = '\0';
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof fds)];
+    } control;
+
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == NOTOK) {
+	close (sm_sessfd);
+	sm_sessfd = NOTOK;
+	return;
+    }
+
+    fds[0] = sv[1];
+    fds[1] = fileno (stdout);
+    fds[2] = fileno (stderr);
+
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    memset (&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy (CMSG_DATA(cmsg), fds, sizeof fds);
+
+    SIGNAL (SIGPIPE, SIG_IGN);
+
+    if (sendmsg (sm_sessfd, &msg, 0) == 1) {
+	sm_sd = sv[0];
+    } else {
+	close (sv[0]);
+    }
+    close (sv[1]);
+    close (sm_sessfd);
+    sm_sessfd = NOTOK;
+}
+
+
+/*
+ * Return the socket of the next post to attach to the session, with
+ * its stdout and stderr, or NOTOK once the session's closed.
+ */
+static int
+sm_accept (int fd, int *out, int *err)
+{
+    int fds[3];
+    char c;
+    ssize_t n;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof fds)];
+    } control;
+
+    for (;;) {
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	memset (&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof control.buf;
+
+	if ((n = recvmsg (fd, &msg, 0)) == NOTOK && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return NOTOK;
+
+	if ((cmsg = CMSG_FIRSTHDR(&msg))  &&
+	    cmsg->cmsg_level == SOL_SOCKET  &&
+	    cmsg->cmsg_type == SCM_RIGHTS  &&
+	    cmsg->cmsg_len == CMSG_LEN(sizeof fds)) {
+	    memcpy (fds, CMSG_DATA(cmsg), sizeof fds);
+	    *out = fds[1];
+	    *err = fds[2];
+	    return fds[0];
+	}
+    }
+}
+
+
+/*
+ * Make the sm_() calls relayed on sd, until it's closed.  If the post
+ * goes without ending what it started, RSET, or give up the connection
+ * if the text was being sent.
+ */
+static void
+sm_serveone (int sd, const char *own, int mask, int len, int sasl, int tls)
+{
+    struct sm_request rq;
+    struct sm_response rs;
+    char *data, *strs[SM_NARGS];
+    bool busy = false;
+    int result;
+
+    while (sm_xread (sd, &rq, sizeof rq) == OK) {
+	if (rq.len < 0  ||  rq.len > SM_MAXREQ)
+	    break;
+	data = mh_xmalloc (rq.len + 1);
+	if (sm_xread (sd, data, rq.len) == NOTOK) {
+	    free (data);
+	    break;
+	}
+	data[rq.len] = '\0';
+
+	switch (rq.op) {
+	case SM_OPINIT:
+	    if (rq.arg[0] != mask  ||  rq.len != len  ||
+		memcmp (data, own, len)  ||
+		rq.arg[4] != sasl  ||  rq.arg[5] != tls) {
+		result = NOTOK;
+		break;
+	    }
+	    sm_unpack (data, rq.len, rq.arg[0], strs, DIM(strs));
+	    result = sm_init (strs[0], strs[1], strs[2], rq.arg[1], rq.arg[2],
+			      rq.arg[3], rq.arg[4], strs[3], strs[4], strs[5],
+			      rq.arg[5]);
+	    if (nsc)
+		netsec_set_snoop (nsc, rq.arg[3]);
+	    busy = true;
+	    break;
+
+	case SM_OPWINIT:
+	    result = sm_winit (data, rq.arg[0], rq.arg[1]);
+	    break;
+
+	case SM_OPPIPELINE:
+	    result = sm_pipeline ();
+	    break;
+
+	case SM_OPQADR:
+	    sm_unpack (data, rq.len, rq.arg[0], strs, 3);
+	    result = sm_qadr (strs[0], strs[1], strs[2]);
+	    break;
+
+	case SM_OPQDATA:
+	    result = sm_qdata ();
+	    break;
+
+	case SM_OPRADR:
+	    result = sm_radr ();
+	    break;
+
+	case SM_OPWAEND:
+	    result = sm_waend ();
+	    break;
+
+	case SM_OPWTXT:
+	    result = sm_wtxt (data, rq.len);
+	    break;
+
+	case SM_OPWTEND:
+	    result = sm_wtend ();
+	    break;
+
+	case SM_OPEND:
+	    /* Keep the connection for the next post. */
+	    result = sm_end (DONE);
+	    busy = false;
+	    break;
+
+	default:
+	    result = sm_ierror ("unknown session request %d", rq.op);
+	    break;
+	}
+	free (data);
+
+	fflush (stdout);
+	rs.result = result;
+	rs.code = sm_reply.code;
+	rs.length = sm_reply.length;
+	if (sm_xwrite (sd, &rs, sizeof rs) == NOTOK  ||
+	    sm_xwrite (sd, sm_reply.text, rs.length) == NOTOK)
+	    break;
+    }
+
+    if (busy)
+	sm_end (DONE);
+}
+
+
+/*
+ * Have the session make an sm_() call, and take its reply as ours.
+ * Return NOTOK if the session's gone.
+ */
+static int
+sm_call (int op, const int *arg, const char *data, int len)
+{
+    struct sm_request rq;
+    struct sm_response rs;
+
+    memset (&rq, 0, sizeof rq);
+    rq.op = op;
+    if (arg)
+	memcpy (rq.arg, arg, sizeof rq.arg);
+    rq.len = len;
+
+    /* Keep what we've written ahead of what the session writes. */
+    fflush (stdout);
+
+    if (sm_xwrite (sm_sd, &rq, sizeof rq) == NOTOK  ||
+	(len > 0  &&  sm_xwrite (sm_sd, data, len) == NOTOK)  ||
+	sm_xread (sm_sd, &rs, sizeof rs) == NOTOK  ||
+	rs.length < 0  ||  rs.length >= (int) sizeof sm_reply.text  ||
+	sm_xread (sm_sd, sm_reply.text, rs.length) == NOTOK)
+	return NOTOK;
+
+    sm_reply.code = rs.code;
+    sm_reply.length = rs.length;
+    sm_reply.text[rs.length] = '\0';
+
+    return rs.result;
+}
+
+
+static int
+sm_relay (int op, const int *arg, const char *data, int len)
+{
+    int result;
+
+    if ((result = sm_call (op, arg, data, len)) == NOTOK)
+	return sm_ierror ("lost the session with the SMTP server");
+
+    return result;
+}
+
+
+/*
+ * Return the strings, each NUL terminated, with a bit set in *mask for
+ * each that isn't NULL, and their length in *len.
+ */
+static char *
+sm_pack (const char **strs, int n, int *mask, int *len)
+{
+    char *data, *dp;
+    size_t size = 1;
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (strs[i])
+	    size += strlen (strs[i]) + 1;
+
+    dp = data = mh_xmalloc (size);
+    *mask = 0;
+    for (i = 0; i < n; i++) {
+	if (strs[i]) {
+	    *mask |= 1 << i;
+	    dp = stpcpy (dp, strs[i]) + 1;
+	}
+    }
+    *len = dp - data;
+
+    return data;
+}
+
+
+static void
+sm_unpack (char *data, int len, int mask, char **strs, int n)
+{
+    char *dp = data, *ep = data + len;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if ((mask & (1 << i))  &&  dp < ep) {
+	    strs[i] = dp;
+	    dp += strlen (dp) + 1;
+	} else {
+	    strs[i] = NULL;
+	}
+    }
+}
+
+
+static int
+sm_xread (int fd, void *buf, size_t len)
+{
+    char *bp = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = read (fd, bp, len)) <= 0) {
+	    if (n == NOTOK  &&  errno == EINTR)
+		continue;
+	    return NOTOK;
+	}
+	bp += n;
+	len -= n;
+    }
+
+    return OK;
+}
+
+
+static int
+sm_xwrite (int fd, const void *buf, size_t len)
+{
+    const char *bp = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write (fd, bp, len)) == NOTOK) {
+	    if (errno == EINTR)
+		continue;
+	    return NOTOK;
+	}
+	bp += n;
+	len -= n;
+    }
+
+    return OK;
+}
+
+
 static int
 sm_ierror (const char *fmt, ...)
 {
@@ -721,10 +1394,17 @@ smtalk (int time, char *fmt, ...)
 }
 
 
+/*
+ * Write the message text, with each LF made CRLF and a dot added to
+ * each line that starts with one.  Each run of text up to a LF is
+ * written at once.  sm_nl stays set across calls when the text ends at
+ * the end of a line.  With no buffer, end the text with a CRLF if it
+ * doesn't have one.
+ */
 static int
 sm_wstream (char *buffer, int len)
 {
-    char *bp, *errstr;
+    char *bp, *ep, *np, *errstr;
     static char lc = '\0';
     int rc;
 
@@ -743,39 +1423,149 @@ sm_wstream (char *buffer, int len)
 	return rc;
     }
 
-    for (bp = buffer; bp && len > 0; bp++, len--) {
-	switch (*bp) {
-	    case '\n': 
-		sm_nl = true;
-		if (netsec_write(nsc, "\r", 1, &errstr) != OK) {
-		    sm_nerror(errstr);
-		    return NOTOK;
-		}
-		break;
+    if (buffer == NULL || len <= 0)
+	return OK;
+
+    for (bp = buffer, ep = buffer + len; bp < ep; bp = np) {
+	if (sm_nl && *bp == '.' &&
+	    netsec_write(nsc, ".", 1, &errstr) != OK)
+	    goto write_error;
 
-	    case '.': 
-		if (sm_nl)
-		    if (netsec_write(nsc, ".", 1, &errstr) != OK) {
-		    sm_nerror(errstr);
+	if ((np = memchr (bp, '\n', ep - bp)) == NULL)
+	    np = ep;
+	if (netsec_write(nsc, bp, np - bp, &errstr) != OK)
+	    goto write_error;
+
+	if (np < ep) {
+	    if (netsec_write(nsc, "\r\n", 2, &errstr) != OK)
+		goto write_error;
+	    np++;
+	    sm_nl = true;
+	} else {
+	    sm_nl = false;
+	}
+    }
+
+    lc = ep[-1];
+    return OK;
+
+write_error:
+    sm_nerror(errstr);
+    return NOTOK;
+}
+
+
+/*
+ * Add the message text to the chunk to send with BDAT, with each LF
+ * made CRLF, and send the chunk when it's full.  BDAT gives the length
+ * of the text instead of ending it with a dot, so nothing's stuffed.
+ * With no buffer, end the text with a CRLF if it doesn't have one, and
+ * send the last chunk.
+ */
+static int
+sm_wchunk (char *buffer, int len)
+{
+    static char lc = '\0';
+    char *bp, *ep, *np;
+
+    if (buffer == NULL) {
+	if (sm_chunklen + 2 > sizeof sm_chunk  &&  sm_bdat (false) == NOTOK)
+	    return NOTOK;
+	if (lc != '\n') {
+	    sm_chunk[sm_chunklen++] = '\r';
+	    sm_chunk[sm_chunklen++] = '\n';
+	}
+	lc = '\0';
+	return sm_bdat (true);
+    }
+
+    for (bp = buffer, ep = buffer + len; bp < ep; bp = np) {
+	if ((np = memchr (bp, '\n', ep - bp)) == NULL)
+	    np = ep;
+
+	while (bp < np) {
+	    size_t n = min ((size_t) (np - bp), sizeof sm_chunk - sm_chunklen);
+
+	    if (n == 0) {
+		if (sm_bdat (false) == NOTOK)
 		    return NOTOK;
-		}
-		/* FALLTHRU */
+		continue;
+	    }
+	    memcpy (sm_chunk + sm_chunklen, bp, n);
+	    sm_chunklen += n;
+	    bp += n;
+	}
 
-	    default: 
-		sm_nl = false;
+	if (np < ep) {
+	    if (sm_chunklen + 2 > sizeof sm_chunk  &&  sm_bdat (false) == NOTOK)
+		return NOTOK;
+	    sm_chunk[sm_chunklen++] = '\r';
+	    sm_chunk[sm_chunklen++] = '\n';
+	    np++;
 	}
-	if (netsec_write(nsc, bp, 1, &errstr) != OK) {
-	    sm_nerror(errstr);
+    }
+
+    if (len > 0)
+	lc = ep[-1];
+    return OK;
+}
+
+
+/*
+ * Send the chunk with BDAT.  Unless the server takes pipelined commands,
+ * the reply to each but the last has to be read before going on.
+ */
+static int
+sm_bdat (bool last)
+{
+    char *errstr;
+
+    if (netsec_printf (nsc, &errstr, "BDAT %lu%s\r\n",
+		       (unsigned long) sm_chunklen, last ? " LAST" : "") != OK  ||
+	netsec_write (nsc, sm_chunk, sm_chunklen, &errstr) != OK) {
+	sm_nerror (errstr);
+	return NOTOK;
+    }
+    sm_chunklen = 0;
+    sm_bdats++;
+
+    if (!last  &&  ! EHLOset ("PIPELINING")) {
+	if (netsec_flush (nsc, &errstr) != OK) {
+	    sm_nerror (errstr);
 	    return NOTOK;
 	}
+	netsec_set_timeout (nsc, SM_DATA);
+	sm_bdats--;
+	if (smhear () != 250)
+	    return NOTOK;
     }
 
-    if (bp > buffer)
-	lc = *--bp;
     return OK;
 }
 
 
+/* Read the replies to the BDATs, returning the first that isn't 250. */
+static int
+sm_bdatend (void)
+{
+    int code;
+    char *errstr;
+
+    if (netsec_flush (nsc, &errstr) != OK)
+	return sm_nerror (errstr);
+
+    while (sm_bdats > 0) {
+	netsec_set_timeout (nsc, sm_bdats > 1 ? SM_DATA
+					      : SM_DOT + 3 * sm_addrs);
+	sm_bdats--;
+	if ((code = smhear ()) != 250)
+	    return code;
+    }
+
+    return 250;
+}
+
+
 static int
 smhear (void)
 {
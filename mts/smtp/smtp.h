@@ -22,11 +22,17 @@ struct smtp {
 int sm_init (char *, char *, char *, int, int, int, int, const char *,
              const char *, const char *, int);
 int sm_winit (char *, int, int);
-int sm_wadr (char *, char *, char *);
+int sm_pipeline (void);
+int sm_qadr (char *, char *, char *);
+int sm_qdata (void);
+int sm_radr (void);
 int sm_waend (void);
 int sm_wtxt (char *, int);
 int sm_wtend (void);
 int sm_end (int);
+void sm_session (int);
+int sm_serve (int, char *, char *, char *, int, const char *, const char *,
+              const char *, int);
 char *rp_string (int);
 
 /* The remainder of this file is derived from "mmdf.h" */
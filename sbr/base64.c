@@ -7,7 +7,9 @@
 
 #include "h/mh.h"
 #include "error.h"
+#include "base64.h"
 #include "h/mime.h"
+#include "h/utils.h"
 #include <inttypes.h>
 
 static const char nib2b64[0x40+1] =
@@ -249,84 +251,171 @@ int
 decodeBase64 (const char *encoded, unsigned char **decoded, size_t *len,
 	      int skip_crs)
 {
-    const char *cp = encoded;
-    int bitno, skip;
-    uint32_t bits;
-    /* Size the decoded string very conservatively. */
-    charstring_t decoded_c = charstring_create (strlen (encoded));
-
-    bitno = 18;
-    bits = 0L;
-    skip = 0;
-
-    bool self_delimiting = false;
-    for (; *cp; ++cp) {
+    struct base64_decoder d;
+    size_t n = strlen (encoded);
+    unsigned char *out = mh_xmalloc (BASE64DECODESIZE(n) + 1);
+
+    decodeBase64init (&d, skip_crs);
+    if (decodeBase64chunk (&d, encoded, n, out, len) != OK  ||
+        decodeBase64end (&d) != OK) {
+        free (out);
+        *decoded = NULL;
+
+        return NOTOK;
+    }
+
+    out[*len] = '\0';
+    *decoded = out;
+
+    return OK;
+}
+
+
+void
+decodeBase64init (struct base64_decoder *d, bool skip_crs)
+{
+    d->bits = 0;
+    d->bitno = 18;
+    d->skip = 0;
+    d->self_delimiting = false;
+    d->skip_crs = skip_crs;
+    d->ntail = 0;
+}
+
+
+/* The value of a base64 byte, or 0xff if it isn't one. */
+#define b64value(c) \
+    (((unsigned char) (c) & 0x80) ? 0xff : b642nib[(unsigned char) (c)])
+
+/* Store the bytes of a decoded group of four, less any padded out. */
+static unsigned char *
+put_group (struct base64_decoder *d, uint32_t bits, int skip,
+           unsigned char *op)
+{
+    unsigned char b = (bits >> 16) & 0xff;
+
+    if (! d->skip_crs  ||  b != '\r') {
+        *op++ = b;
+    }
+    if (skip < 2) {
+        b = (bits >> 8) & 0xff;
+        if (! d->skip_crs  ||  b != '\r') {
+            *op++ = b;
+        }
+        if (skip < 1) {
+            b = bits & 0xff;
+            if (! d->skip_crs  ||  b != '\r') {
+                *op++ = b;
+            }
+        }
+    }
+
+    return op;
+}
+
+/*
+ * Decode len bytes of base64 from in, following any that came before,
+ * into out, which must have room for BASE64DECODESIZE(len) bytes.  The
+ * number of bytes decoded is stored in outlen.  Returns NOTOK, after
+ * reporting it, if in has an invalid byte.
+ */
+int
+decodeBase64chunk (struct base64_decoder *d, const char *in, size_t len,
+                   unsigned char *out, size_t *outlen)
+{
+    const char *cp = in, *ep = in + len;
+    unsigned char *op = out;
+    size_t keep;
+
+    while (cp < ep) {
+        /* Most of the text is whole groups of four between line breaks,
+         * and they can be decoded without the byte at a time state. */
+        if (d->bitno == 18  &&  d->skip == 0) {
+            while (ep - cp >= 4) {
+                unsigned int a = b64value (cp[0]), b = b64value (cp[1]),
+                    c = b64value (cp[2]), e = b64value (cp[3]);
+                uint32_t bits;
+
+                if ((a | b | c | e) > 0x3f) {
+                    break;
+                }
+                bits = a << 18 | b << 12 | c << 6 | e;
+                if (d->skip_crs) {
+                    op = put_group (d, bits, 0, op);
+                } else {
+                    op[0] = (bits >> 16) & 0xff;
+                    op[1] = (bits >> 8) & 0xff;
+                    op[2] = bits & 0xff;
+                    op += 3;
+                }
+                cp += 4;
+            }
+            if (cp == ep) {
+                break;
+            }
+        }
+
         switch (*cp) {
-            unsigned char value;
+            unsigned int value;
 
             default:
                 if (isspace ((unsigned char) *cp)) {
                     break;
                 }
-                if (skip  ||  (((unsigned char) *cp) & 0x80)  ||
-                    (value = b642nib[((unsigned char) *cp) & 0x7f]) > 0x3f) {
-                    inform("invalid base64 byte %#x: %.42s",
-                        *(unsigned char *)cp, cp);
-                    charstring_free (decoded_c);
-                    *decoded = NULL;
+                if (d->skip  ||  (value = b64value (*cp)) > 0x3f) {
+                    inform("invalid base64 byte %#x: %.*s",
+                        *(unsigned char *)cp, (int) min(ep - cp, 42), cp);
 
                     return NOTOK;
                 }
 
-                bits |= value << bitno;
+                d->bits |= value << d->bitno;
 test_end:
-                if ((bitno -= 6) < 0) {
-                    char b = (char) ((bits >> 16) & 0xff);
-
-                    if (! skip_crs  ||  b != '\r') {
-                        charstring_push_back (decoded_c, b);
-                    }
-                    if (skip < 2) {
-                        b = (bits >> 8) & 0xff;
-                        if (! skip_crs  ||  b != '\r') {
-                            charstring_push_back (decoded_c, b);
-                        }
-                        if (skip < 1) {
-                            b = bits & 0xff;
-                            if (! skip_crs  ||  b != '\r') {
-                                charstring_push_back (decoded_c, b);
-                            }
-                        }
-                    }
-
-                    bitno = 18;
-                    bits = 0L;
-                    skip = 0;
+                if ((d->bitno -= 6) < 0) {
+                    op = put_group (d, d->bits, d->skip, op);
+                    d->bitno = 18;
+                    d->bits = 0;
+                    d->skip = 0;
                 }
                 break;
 
             case '=':
-                if (++skip <= 3)
+                if (++d->skip <= 3)
                     goto test_end;
-                self_delimiting = true;
+                d->self_delimiting = true;
                 break;
         }
+        ++cp;
     }
 
-    if (! self_delimiting  &&  bitno != 18) {
+    /* Keep the end of the text to show if it turns out to be cut short. */
+    keep = min(d->ntail, sizeof d->tail - min(len, sizeof d->tail));
+    memmove (d->tail, d->tail + d->ntail - keep, keep);
+    len = min(len, sizeof d->tail - keep);
+    memcpy (d->tail + keep, ep - len, len);
+    d->ntail = keep + len;
+
+    *outlen = op - out;
+
+    return OK;
+}
+
+
+/*
+ * Finish decoding.  Returns NOTOK, after reporting it, if the text
+ * ended partway through a group.
+ */
+int
+decodeBase64end (struct base64_decoder *d)
+{
+    if (! d->self_delimiting  &&  d->bitno != 18) {
         /* Show some context for the error. */
-        cp -= min(cp - encoded, 20);
-        inform("premature ending (bitno %d) near %s", bitno, cp);
-        charstring_free (decoded_c);
-        *decoded = NULL;
+        inform("premature ending (bitno %d) near %.*s", d->bitno,
+               (int) d->ntail, d->tail);
 
         return NOTOK;
     }
 
-    *decoded = (unsigned char *) charstring_buffer_copy (decoded_c);
-    *len = charstring_bytes (decoded_c);
-    charstring_free (decoded_c);
-
     return OK;
 }
 
@@ -9,6 +9,30 @@ int writeBase64aux(FILE *, FILE *, int);
 int writeBase64(const unsigned char *, size_t, unsigned char *);
 int writeBase64raw(const unsigned char *, size_t, unsigned char *);
 int decodeBase64(const char *, unsigned char **, size_t *, int);
+
+/*
+ * State for decoding base64 a piece at a time, so that a large part
+ * needn't be held in memory.  Feed each piece of the encoded text to
+ * decodeBase64chunk(), then call decodeBase64end().
+ */
+struct base64_decoder {
+    unsigned int bits;		/* the group being decoded           */
+    int bitno;
+    int skip;			/* number of '=' pads in the group   */
+    bool self_delimiting;
+    bool skip_crs;		/* drop decoded CRs, for text        */
+    size_t ntail;
+    char tail[20];		/* the last encoded bytes, to report */
+};
+
+void decodeBase64init(struct base64_decoder *, bool) NONNULL(1);
+int decodeBase64chunk(struct base64_decoder *, const char *, size_t,
+    unsigned char *, size_t *) NONNULL(1, 2, 4, 5);
+int decodeBase64end(struct base64_decoder *) NONNULL(1);
+
+/* Room for what decodeBase64chunk() decodes from x bytes. */
+#define BASE64DECODESIZE(x) ((x) + 3)
+
 void hexify(const unsigned char *, size_t, char **);
 
 /* Includes trailing NUL. */
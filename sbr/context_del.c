@@ -7,6 +7,7 @@
 
 #include "h/mh.h"
 #include "context_del.h"
+#include "context_index.h"
 #include "error.h"
 #include "h/utils.h"
 
@@ -18,24 +19,20 @@
 int
 context_del (char *key)
 {
-    struct node *np, *pp;
+    struct node *np, **link;
 
-    key = FENDNULL(key);
-    for (np = m_defs, pp = NULL; np; pp = np, np = np->n_next) {
-	if (!strcasecmp(FENDNULL(np->n_name), key)) {
-	    if (!np->n_context)
-		inform("bug: context_del(key=\"%s\"), continuing...", np->n_name);
-	    if (pp)
-		pp->n_next = np->n_next;
-	    else
-		m_defs = np->n_next;
-	    free (np->n_name);
-            free(np->n_field);
-	    free(np);
-	    ctxflags |= CTXMOD;
-	    return 0;
-	}
-    }
+    if (!(link = context_index_find (FENDNULL(key))))
+	return 1;
 
-    return 1;
+    np = *link;
+    if (!np->n_context)
+	inform("bug: context_del(key=\"%s\"), continuing...", np->n_name);
+    *link = np->n_next;
+    context_index_del (link, np);
+    free (np->n_name);
+    free(np->n_field);
+    free(np);
+    ctxflags |= CTXMOD;
+
+    return 0;
 }
@@ -8,19 +8,17 @@
 #include "h/mh.h"
 #include "concat.h"
 #include "context_find.h"
+#include "context_index.h"
 
 
 char *
 context_find (const char *str)
 {
-    struct node *np;
+    struct node **link;
 
-    str = FENDNULL(str);
-    for (np = m_defs; np; np = np->n_next)
-	if (!strcasecmp(FENDNULL(np->n_name), str))
-	    return np->n_field;
+    link = context_index_find (FENDNULL(str));
 
-    return NULL;
+    return link ? (*link)->n_field : NULL;
 }
 
 
@@ -35,23 +33,22 @@ context_find_by_type (const char *string, const char *type,
                       const char *subtype)
 {
     char *value = NULL;
+    char *cp;
 
-    if (subtype) {
-        char *cp;
+    /* Build the longer name once, and cut it short for the second try. */
+    cp = concat (invo_name, "-", string, "-", type, subtype ? "/" : NULL,
+                 subtype, NULL);
 
-        cp = concat (invo_name, "-", string, "-", type, "/", subtype, NULL);
+    if (subtype) {
         if ((value = context_find (cp)) != NULL && *value == '\0') value = NULL;
-        free (cp);
+        cp[strlen (cp) - strlen (subtype) - 1] = '\0';
     }
 
     if (value == NULL) {
-        char *cp;
-
-        cp = concat (invo_name, "-", string, "-", type, NULL);
         if ((value = context_find (cp)) != NULL && *value == '\0') value = NULL;
-        free (cp);
     }
 
+    free (cp);
     return value;
 }
 
@@ -65,6 +62,10 @@ context_find_prefix (const char *prefix)
 {
     struct node *np;
     size_t len;
+    int found;
+
+    if ((found = context_index_prefix (prefix)) != -1)
+        return found;
 
     len = strlen(prefix);
     for (np = m_defs; np; np = np->n_next) {
@@ -4,6 +4,6 @@
  * COPYRIGHT file in the root directory of the nmh distribution for
  * complete copyright information. */
 
-char *context_find(const char *) PURE;
+char *context_find(const char *);
 char *context_find_by_type(const char *, const char *, const char *);
-int context_find_prefix(const char *) PURE;
+int context_find_prefix(const char *);
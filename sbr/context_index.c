@@ -0,0 +1,343 @@
+/* context_index.c -- index of the context/profile list by name
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information.
+ */
+
+#include "h/mh.h"
+#include "context_index.h"
+#include "h/utils.h"
+#include <stdint.h>
+
+/*
+ * m_defs holds the profile and then the context, in the order they
+ * were read, and the first entry with a name is the one that counts.
+ * A private sequence is an entry in the context for each sequence of
+ * each folder, so the list can be tens of thousands long, and walking
+ * it made each lookup and change cost time in proportion to that.  So
+ * names are hashed, ignoring case, to the link to their first entry,
+ * and the end of the list is kept for adding to.
+ *
+ * The index is built the first time it's needed, which is usually
+ * just after context_read().  context_replace() and context_del() keep
+ * it up to date;  anything else that changes m_defs must call
+ * context_index_reset(), unless all it does is give it a new head.
+ */
+
+struct name_entry {
+    const char *name;		/* n_name of the first entry          */
+    struct node **link;		/* the link to that entry             */
+    unsigned int count;		/* number of entries with the name    */
+    struct name_entry *next;
+};
+
+/* Names up to and including their first hyphen, such as "atr-". */
+struct prefix_entry {
+    char *prefix;
+    size_t len;
+    unsigned int count;
+    struct prefix_entry *next;
+};
+
+#define NAME_BUCKETS	256	/* initial size, doubled as needed    */
+#define PREFIX_BUCKETS	64	/* there are few distinct prefixes    */
+
+static bool built;
+static struct node *head;	/* m_defs when the index was built    */
+static struct node **tail;
+static struct name_entry **names;
+static size_t nnames, nbuckets;
+static struct prefix_entry *prefixes[PREFIX_BUCKETS];
+
+static void build (void);
+static void index_entry (struct node **);
+static struct name_entry **name_slot (const char *);
+static void grow (void);
+static void prefix_add (const char *);
+static void prefix_del (const char *);
+static struct prefix_entry **prefix_slot (const char *, size_t);
+static size_t prefix_len (const char *) PURE;
+static unsigned int hash (const char *, size_t) PURE;
+
+
+struct node **
+context_index_find (const char *name)
+{
+    struct name_entry *e;
+
+    if (!built || head != m_defs)
+	build ();
+
+    e = *name_slot (name);
+    return e ? e->link : NULL;
+}
+
+
+int
+context_index_prefix (const char *prefix)
+{
+    size_t len = prefix_len (prefix);
+
+    if (len == 0 || prefix[len] != '\0')
+	return -1;
+
+    if (!built || head != m_defs)
+	build ();
+
+    return *prefix_slot (prefix, len) != NULL;
+}
+
+
+struct node **
+context_index_tail (void)
+{
+    if (!built || head != m_defs)
+	build ();
+
+    return tail;
+}
+
+
+void
+context_index_add (struct node **link)
+{
+    /* An index that's out of date will be built with the entry. */
+    if (!built || head != m_defs)
+	return;
+
+    index_entry (link);
+    tail = &(*link)->n_next;
+}
+
+
+void
+context_index_del (struct node **link, struct node *np)
+{
+    struct name_entry **slot, *e;
+    struct node **lp;
+
+    if (!built)
+	return;
+    if (head == np)
+	head = m_defs;
+    else if (head != m_defs)
+	return;
+
+    slot = name_slot (FENDNULL(np->n_name));
+    e = *slot;
+    if (e->link == link) {
+	if (--e->count == 0) {
+	    *slot = e->next;
+	    free (e);
+	    nnames--;
+	} else {
+	    /* A later entry with the name counts now. */
+	    for (lp = link; strcasecmp (FENDNULL((*lp)->n_name), e->name);
+		 lp = &(*lp)->n_next)
+		continue;
+	    e->link = lp;
+	    e->name = FENDNULL((*lp)->n_name);
+	}
+    } else {
+	e->count--;
+    }
+
+    /* The entry after np is now reached through link. */
+    if (*link  &&  (e = *name_slot (FENDNULL((*link)->n_name)))  &&
+	e->link == &np->n_next)
+	e->link = link;
+    if (tail == &np->n_next)
+	tail = link;
+
+    prefix_del (FENDNULL(np->n_name));
+}
+
+
+void
+context_index_reset (void)
+{
+    struct name_entry *e, *enext;
+    struct prefix_entry *p, *pnext;
+    size_t i;
+
+    for (i = 0; i < nbuckets; i++) {
+	for (e = names[i]; e; e = enext) {
+	    enext = e->next;
+	    free (e);
+	}
+    }
+    free (names);
+    names = NULL;
+    nnames = nbuckets = 0;
+
+    for (i = 0; i < PREFIX_BUCKETS; i++) {
+	for (p = prefixes[i]; p; p = pnext) {
+	    pnext = p->next;
+	    free (p->prefix);
+	    free (p);
+	}
+	prefixes[i] = NULL;
+    }
+
+    built = false;
+}
+
+
+static void
+build (void)
+{
+    struct node **link;
+
+    context_index_reset ();
+    nbuckets = NAME_BUCKETS;
+    names = mh_xcalloc (nbuckets, sizeof *names);
+
+    for (link = &m_defs; *link; link = &(*link)->n_next)
+	index_entry (link);
+
+    head = m_defs;
+    tail = link;
+    built = true;
+}
+
+
+static void
+index_entry (struct node **link)
+{
+    const char *name = FENDNULL((*link)->n_name);
+    struct name_entry **slot, *e;
+
+    if ((e = *(slot = name_slot (name)))) {
+	e->count++;
+    } else {
+	NEW(e);
+	e->name = name;
+	e->link = link;
+	e->count = 1;
+	e->next = NULL;
+	*slot = e;
+	if (++nnames > nbuckets)
+	    grow ();
+    }
+
+    prefix_add (name);
+}
+
+
+/* Return the slot that holds, or would hold, the entry for name. */
+static struct name_entry **
+name_slot (const char *name)
+{
+    struct name_entry **slot;
+
+    for (slot = &names[hash (name, SIZE_MAX) & (nbuckets - 1)];
+	 *slot && strcasecmp ((*slot)->name, name);
+	 slot = &(*slot)->next)
+	continue;
+
+    return slot;
+}
+
+
+static void
+grow (void)
+{
+    struct name_entry **old = names, *e, *next;
+    size_t i, oldsize = nbuckets;
+
+    nbuckets *= 2;
+    names = mh_xcalloc (nbuckets, sizeof *names);
+    for (i = 0; i < oldsize; i++) {
+	for (e = old[i]; e; e = next) {
+	    struct name_entry **slot =
+		&names[hash (e->name, SIZE_MAX) & (nbuckets - 1)];
+
+	    next = e->next;
+	    e->next = *slot;
+	    *slot = e;
+	}
+    }
+    free (old);
+}
+
+
+static void
+prefix_add (const char *name)
+{
+    size_t len = prefix_len (name);
+    struct prefix_entry **slot, *p;
+
+    if (len == 0)
+	return;
+
+    if ((p = *(slot = prefix_slot (name, len)))) {
+	p->count++;
+	return;
+    }
+
+    NEW(p);
+    p->prefix = mh_xmalloc (len + 1);
+    memcpy (p->prefix, name, len);
+    p->prefix[len] = '\0';
+    p->len = len;
+    p->count = 1;
+    p->next = NULL;
+    *slot = p;
+}
+
+
+static void
+prefix_del (const char *name)
+{
+    size_t len = prefix_len (name);
+    struct prefix_entry **slot, *p;
+
+    if (len == 0  ||  (p = *(slot = prefix_slot (name, len))) == NULL)
+	return;
+
+    if (--p->count == 0) {
+	*slot = p->next;
+	free (p->prefix);
+	free (p);
+    }
+}
+
+
+static struct prefix_entry **
+prefix_slot (const char *name, size_t len)
+{
+    struct prefix_entry **slot;
+
+    for (slot = &prefixes[hash (name, len) % PREFIX_BUCKETS];
+	 *slot && ((*slot)->len != len ||
+		   strncasecmp ((*slot)->prefix, name, len));
+	 slot = &(*slot)->next)
+	continue;
+
+    return slot;
+}
+
+
+/* Return the length of name up to and including its first hyphen, or
+ * 0 if it has none. */
+static size_t
+prefix_len (const char *name)
+{
+    const char *cp = strchr (name, '-');
+
+    return cp ? (size_t) (cp - name) + 1 : 0;
+}
+
+
+/* FNV-1a, of at most len characters, folded to lower case. */
+static unsigned int
+hash (const char *s, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for (; len > 0  &&  *s; s++, len--)
+	h = (h ^ (unsigned char) tolower ((unsigned char) *s)) * 16777619u;
+
+    return h;
+}
@@ -0,0 +1,35 @@
+/* context_index.h -- index of the context/profile list by name
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information. */
+
+/*
+ * Return the link to the first entry in m_defs named name, ignoring
+ * case, or NULL if there is none.  The link is m_defs itself or the
+ * n_next of the entry before.
+ */
+struct node **context_index_find(const char *) NONNULL(1);
+
+/*
+ * Return 1 if an entry's name starts with prefix, ignoring case, and 0
+ * if not.  Only prefixes that end at the first hyphen of a name, such
+ * as "sendfrom-", are indexed;  for others, return -1.
+ */
+int context_index_prefix(const char *) NONNULL(1);
+
+/* Return the link at the end of m_defs, where a new entry goes. */
+struct node **context_index_tail(void);
+
+/* Index the entry just added at link, at the end of m_defs. */
+void context_index_add(struct node **) NONNULL(1);
+
+/* Forget entry np, which has just been unlinked from link. */
+void context_index_del(struct node **, struct node *) NONNULL(1, 2);
+
+/*
+ * Forget the whole index, after m_defs is changed other than with
+ * context_replace() or context_del().  It's built again when next
+ * needed.  A new head of m_defs is noticed without this.
+ */
+void context_index_reset(void);
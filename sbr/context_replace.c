@@ -8,6 +8,7 @@
 #include "h/mh.h"
 #include "getcpy.h"
 #include "context_replace.h"
+#include "context_index.h"
 #include "error.h"
 #include "h/utils.h"
 
@@ -15,51 +16,36 @@
 void
 context_replace (char *key, char *value)
 {
-    struct node *np;
+    struct node *np, **link;
 
     key = FENDNULL(key);
 
-    /*
-     * If list is empty, allocate head of profile/context list.
-     */
-    if (!m_defs) {
-	NEW(np);
-        m_defs = np;
-	np->n_name = mh_xstrdup(key);
-	np->n_field = getcpy (value);
-	np->n_context = 1;
-	np->n_next = NULL;
-	ctxflags |= CTXMOD;
-	return;
-    }
-
     /*
      * Search list of context/profile entries for
      * this key, and replace its value if found.
      */
-    for (np = m_defs;; np = np->n_next) {
-	if (!strcasecmp(FENDNULL(np->n_name), key)) {
-	    if (strcmp (value, np->n_field)) {
-		if (!np->n_context)
-		    inform("bug: context_replace(key=\"%s\",value=\"%s\"), continuing...", key, value);
-                free(np->n_field);
-		np->n_field = mh_xstrdup(value);
-		ctxflags |= CTXMOD;
-	    }
-	    return;
+    if ((link = context_index_find (key))) {
+	np = *link;
+	if (strcmp (value, np->n_field)) {
+	    if (!np->n_context)
+		inform("bug: context_replace(key=\"%s\",value=\"%s\"), continuing...", key, value);
+	    free(np->n_field);
+	    np->n_field = mh_xstrdup(value);
+	    ctxflags |= CTXMOD;
 	}
-	if (!np->n_next)
-	    break;
+	return;
     }
 
     /*
      * Else add this new entry at the end
      */
-    NEW(np->n_next);
-    np = np->n_next;
+    link = context_index_tail ();
+    NEW(np);
+    *link = np;
     np->n_name = mh_xstrdup(key);
     np->n_field = getcpy (value);
     np->n_context = 1;
     np->n_next = NULL;
+    context_index_add (link);
     ctxflags |= CTXMOD;
 }
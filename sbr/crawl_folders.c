@@ -10,6 +10,12 @@
 #include "error.h"
 #include "crawl_folders.h"
 #include "h/utils.h"
+#include "h/signals.h"
+#include <fcntl.h>
+
+#ifndef PIPE_BUF
+# define PIPE_BUF _POSIX_PIPE_BUF
+#endif
 
 struct crawl_context {
     int max;			/* how many folders we currently can hold in
@@ -18,18 +24,47 @@ struct crawl_context {
     char **folders;		/* the array of folders */
     int start;
     int foldp;
+    int jobs;			/* processes to read subfolders with */
+    struct crawl_worker *workers;	/* started once there's work */
+    int nextworker;
+};
+
+/*
+ * The subfolders of a folder, read ahead by a worker:  n names, or
+ * n == -1 if the folder couldn't be read.  Until done, it waits in
+ * the queue of the worker it was given to.
+ */
+struct crawl_kids {
+    int n;
+    char **names;
+    char *name;			/* the folder's */
+    bool done;
+    struct crawl_worker *worker;
+    struct crawl_kids *next;
+};
+
+/*
+ * A process reading the subfolders of the folders it's sent, in turn.
+ * The folders of its queue from head up to unsent have been sent to
+ * it, taking pending bytes of the pipe.
+ */
+struct crawl_worker {
+    pid_t pid;
+    FILE *to;			/* sends the worker folder names */
+    FILE *from;			/* reads the worker's results */
+    struct crawl_kids *head, *tail, *unsent;
+    size_t pending;
+    bool dead;
 };
 
 /*
- * Add the folder name into the
- * list in a sorted fashion.
+ * Add the folder name to the end of the list.
+ * add_children sorts them when it's done.
  */
 
 static void
 add_folder (char *fold, struct crawl_context *crawl)
 {
-    int i, j;
-
     /* if necessary, reallocate the space for folder names */
     if (crawl->foldp >= crawl->max) {
 	crawl->max += CRAWL_NUMFOLDERS;
@@ -37,30 +72,35 @@ add_folder (char *fold, struct crawl_context *crawl)
 				      crawl->max * sizeof(char *));
     }
 
-    for (i = crawl->start; i < crawl->foldp; i++)
-	if (strcmp (fold, crawl->folders[i]) < 0) {
-	    for (j = crawl->foldp - 1; j >= i; j--)
-		crawl->folders[j + 1] = crawl->folders[j];
-	    crawl->foldp++;
-	    crawl->folders[i] = fold;
-	    return;
-	}
-
     crawl->folders[crawl->foldp++] = fold;
 }
 
-static void
-add_children (char *name, struct crawl_context *crawl)
+static int
+compare_folders (const void *a, const void *b)
+{
+    return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Add the subfolders of the directory open on `fd', whose name is
+ * `name', to the list.  Entries are looked up relative to fd, so
+ * the kernel doesn't walk the whole path again for each one.
+ * Return NOTOK if the directory can't be read.
+ */
+
+static int
+add_children (int fd, char *name, struct crawl_context *crawl)
 {
     char *prefix, *child;
     struct stat st;
     struct dirent *dp;
     DIR * dd;
-    int child_is_folder;
+    int child_is_folder, dfd;
 
-    if (!(dd = opendir (name))) {
-	admonish (name, "unable to read directory ");
-	return;
+    if ((dfd = dup (fd)) == -1  ||  !(dd = fdopendir (dfd))) {
+	if (dfd != -1)
+	    close (dfd);
+	return NOTOK;
     }
 
     if (strcmp (name, ".") == 0) {
@@ -76,70 +116,390 @@ add_children (char *name, struct crawl_context *crawl)
 #if defined(HAVE_STRUCT_DIRENT_D_TYPE)
 	if (dp->d_type == DT_DIR) {
 	    child_is_folder = 1;
-	} else if (dp->d_type != DT_LNK && dp->d_type != DT_UNKNOWN) {
+	} else if (dp->d_type == DT_LNK) {
+	    child_is_folder = fstatat (fd, dp->d_name, &st, 0) != -1 &&
+		S_ISDIR(st.st_mode);
+	    if (!child_is_folder)
+		continue;
+	} else if (dp->d_type != DT_UNKNOWN) {
 	    continue;
 	}
 #endif
 	if (!strcmp (dp->d_name, ".") || !strcmp (dp->d_name, "..")) {
 	    continue;
 	}
-	child = concat(prefix, dp->d_name, NULL);
-	/* If we have no d_type or d_type is DT_LNK or DT_UNKNOWN, stat the
+	/* If we have no d_type or d_type is DT_UNKNOWN, stat the
 	 * child to see what it is. */
 	if (child_is_folder == -1) {
-	    child_is_folder = (stat (child, &st) != -1 && S_ISDIR(st.st_mode));
-	}
-	if (child_is_folder) {
-	    /* add_folder saves child in the list, don't free it */
-	    add_folder (child, crawl);
-	} else {
-	    free (child);
+	    if (fstatat (fd, dp->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+		continue;
+	    }
+	    if (S_ISLNK(st.st_mode)) {
+		if (fstatat (fd, dp->d_name, &st, 0) == -1 ||
+			!S_ISDIR(st.st_mode))
+		    continue;
+	    } else if (!S_ISDIR(st.st_mode)) {
+		continue;
+	    }
 	}
+	/* add_folder saves child in the list, don't free it */
+	child = concat(prefix, dp->d_name, NULL);
+	add_folder (child, crawl);
     }
 
     closedir (dd);
     free(prefix);
+
+    /* Sort the children once, rather than as each is added. */
+    qsort (crawl->folders + crawl->start, crawl->foldp - crawl->start,
+	   sizeof *crawl->folders, compare_folders);
+
+    return OK;
+}
+
+/*
+ * Run in a worker:  read the subfolders of each folder whose name
+ * comes from in, as its length and text, and send them to out as
+ * their number, or -1 if it can't be read, then the length and text
+ * of each name.  Errors are left to the parent to report, in order.
+ */
+
+static void
+read_work (FILE *in, FILE *out)
+{
+    struct crawl_context sub;
+    int j, fd;
+    size_t len;
+    char *fold;
+
+    if (in == NULL  ||  out == NULL)
+	_exit (1);
+
+    while (fscanf (in, "%zu", &len) == 1  &&  getc (in) == '\n') {
+	fold = mh_xmalloc (len + 1);
+	if (fread (fold, 1, len, in) != len)
+	    _exit (1);
+	fold[len] = '\0';
+
+	memset (&sub, 0, sizeof sub);
+	if ((fd = open (fold, O_RDONLY | O_DIRECTORY)) == -1  ||
+	    add_children (fd, fold, &sub) == NOTOK) {
+	    fputs ("-1\n", out);
+	} else {
+	    fprintf (out, "%d\n", sub.foldp);
+	    for (j = 0; j < sub.foldp; j++) {
+		fprintf (out, "%zu\n%s", strlen (sub.folders[j]),
+			 sub.folders[j]);
+		free (sub.folders[j]);
+	    }
+	}
+	if (fd != -1)
+	    close (fd);
+	free (sub.folders);
+	free (fold);
+
+	/* The parent may be waiting for this one. */
+	if (fflush (out) == EOF)
+	    _exit (1);
+    }
+}
+
+/*
+ * Read what a worker sent for one folder into kids.  Return NOTOK if
+ * the worker has died.
+ */
+
+static int
+read_kids (FILE *fp, struct crawl_kids *kids)
+{
+    int i, n;
+    size_t len;
+    char *name;
+
+    if (fscanf (fp, "%d", &n) != 1  ||  getc (fp) != '\n')
+	return NOTOK;
+    if (n < 0)
+	return OK;
+
+    kids->names = mh_xcalloc (n, sizeof *kids->names);
+    for (i = 0; i < n; i++) {
+	if (fscanf (fp, "%zu", &len) != 1  ||  getc (fp) != '\n')
+	    break;
+	name = mh_xmalloc (len + 1);
+	if (fread (name, 1, len, fp) != len) {
+	    free (name);
+	    break;
+	}
+	name[len] = '\0';
+	kids->names[i] = name;
+    }
+    if (i < n) {
+	while (i > 0)
+	    free (kids->names[--i]);
+	free (kids->names);
+	kids->names = NULL;
+	return NOTOK;
+    }
+    kids->n = n;
+
+    return OK;
 }
 
+/*
+ * Start crawl->jobs workers, once, to serve the rest of the crawl.
+ */
+
 static void
-crawl_folders_body (struct crawl_context *crawl,
-		    char *dir, crawl_callback_t *callback, void *baton)
+start_workers (struct crawl_context *crawl)
+{
+    struct crawl_worker *workers;
+    int i, j;
+
+    workers = mh_xcalloc (crawl->jobs, sizeof *workers);
+
+    /* Anything buffered would be output by a worker as well. */
+    fflush (stdout);
+    fflush (stderr);
+
+    for (i = 0; i < crawl->jobs; i++) {
+	int rq[2], rs[2];
+
+	if (pipe (rq) == NOTOK  ||  pipe (rs) == NOTOK)
+	    adios ("pipe", "unable to");
+
+	switch (workers[i].pid = fork ()) {
+	case NOTOK:
+	    adios ("fork", "unable to");
+	    break;
+
+	case OK:
+	    for (j = 0; j < i; j++) {
+		fclose (workers[j].to);
+		fclose (workers[j].from);
+	    }
+	    close (rq[1]);
+	    close (rs[0]);
+	    read_work (fdopen (rq[0], "r"), fdopen (rs[1], "w"));
+	    _exit (0);
+
+	default:
+	    close (rq[0]);
+	    close (rs[1]);
+	    if ((workers[i].to = fdopen (rq[1], "w")) == NULL  ||
+		(workers[i].from = fdopen (rs[0], "r")) == NULL)
+		adios ("pipe", "unable to fdopen");
+	    break;
+	}
+    }
+
+    crawl->workers = workers;
+}
+
+/*
+ * The bytes a folder's name takes in a worker's pipe, at most.
+ */
+
+static size_t
+request_size (struct crawl_kids *kids)
+{
+    return strlen (kids->name) + 21;
+}
+
+/*
+ * Send the worker what it can take of its queue.  What's been sent
+ * is kept to what the pipe can hold, so that the worker can always
+ * read it, even while it waits for its results to be read.
+ */
+
+static void
+send_requests (struct crawl_worker *w)
+{
+    SIGNAL_HANDLER pstat;
+    struct crawl_kids *k;
+
+    if (w->dead  ||  w->unsent == NULL)
+	return;
+
+    /* If the worker has gone, reading its results will say so. */
+    pstat = SIGNAL(SIGPIPE, SIG_IGN);
+    while ((k = w->unsent)  &&
+	   (k == w->head  ||  w->pending + request_size (k) <= PIPE_BUF)) {
+	fprintf (w->to, "%zu\n%s", strlen (k->name), k->name);
+	w->pending += request_size (k);
+	w->unsent = k->next;
+    }
+    if (fflush (w->to) == EOF)
+	w->dead = true;
+    SIGNAL(SIGPIPE, pstat);
+}
+
+/*
+ * Queue the folder name for one of the workers to read its subfolders
+ * into kids.  They're dealt out to the workers in turn.
+ */
+
+static void
+request_kids (struct crawl_context *crawl, struct crawl_kids *kids,
+	      char *name)
+{
+    struct crawl_worker *w;
+
+    w = &crawl->workers[crawl->nextworker++ % crawl->jobs];
+    memset (kids, 0, sizeof *kids);
+    kids->n = -1;
+    kids->name = name;
+    kids->worker = w;
+
+    if (w->tail)
+	w->tail->next = kids;
+    else
+	w->head = kids;
+    w->tail = kids;
+    if (w->unsent == NULL)
+	w->unsent = kids;
+}
+
+/*
+ * Wait for kids to be read.  The worker answers in the order of its
+ * queue, so those ahead of kids in it are read first.  If the worker
+ * has died, what it didn't send is left for the caller to read itself.
+ */
+
+static void
+await_kids (struct crawl_kids *kids)
+{
+    struct crawl_worker *w = kids->worker;
+    struct crawl_kids *k;
+
+    while (!kids->done) {
+	k = w->head;
+	if (k == w->unsent)
+	    send_requests (w);
+	if (w->dead  ||  read_kids (w->from, k) == NOTOK)
+	    w->dead = true;
+	else
+	    w->pending -= request_size (k);
+	k->done = true;
+
+	if (w->unsent == k)
+	    w->unsent = k->next;
+	if ((w->head = k->next) == NULL)
+	    w->tail = NULL;
+	send_requests (w);
+    }
+}
+
+/*
+ * Stop the workers, whose queues are empty.
+ */
+
+static void
+stop_workers (struct crawl_context *crawl)
 {
     int i;
+
+    for (i = 0; i < crawl->jobs; i++) {
+	fclose (crawl->workers[i].to);
+	fclose (crawl->workers[i].from);
+	(void) pidwait (crawl->workers[i].pid, NOTOK);
+    }
+    free (crawl->workers);
+}
+
+/*
+ * Crawl the folder dir, a child of the folder open on parent.  kids,
+ * if not NULL, is its subfolders as a worker read them ahead.
+ */
+
+static void
+crawl_folders_body (struct crawl_context *crawl, int parent, char *dir,
+		    struct crawl_kids *kids, crawl_callback_t *callback,
+		    void *baton)
+{
+    int i, fd;
     int os = crawl->start;
     int of = crawl->foldp;
+    char *base;
+    struct crawl_kids *ahead = NULL;
+
+    /* Subfolders are opened relative to their parent's descriptor. */
+    base = parent == AT_FDCWD ? NULL : strrchr (dir, '/');
+    base = base ? base + 1 : dir;
+    if ((fd = openat (parent, base, O_RDONLY | O_DIRECTORY)) == -1) {
+	admonish (dir, "unable to read directory ");
+	return;
+    }
 
     crawl->start = crawl->foldp;
 
-    add_children (dir, crawl);
+    if (kids  &&  kids->n >= 0) {
+	for (i = 0; i < kids->n; i++)
+	    add_folder (kids->names[i], crawl);
+    } else if (add_children (fd, dir, crawl) == NOTOK) {
+	admonish (dir, "unable to read directory ");
+    }
+
+    /*
+     * Have workers read the subfolders of these while they're listed
+     * here, which may be slow on a network file system.  The callbacks
+     * still run in this process, in order.
+     */
+    if (crawl->jobs > 1  &&  crawl->foldp > crawl->start  &&
+	(crawl->workers  ||  crawl->foldp - crawl->start > 1)) {
+	if (!crawl->workers)
+	    start_workers (crawl);
+	ahead = mh_xcalloc (crawl->foldp - crawl->start, sizeof *ahead);
+	for (i = crawl->start; i < crawl->foldp; i++)
+	    request_kids (crawl, &ahead[i - crawl->start], crawl->folders[i]);
+	for (i = 0; i < crawl->jobs; i++)
+	    send_requests (&crawl->workers[i]);
+    }
 
     for (i = crawl->start; i < crawl->foldp; i++) {
 	char *fold = crawl->folders[i];
+	struct crawl_kids *next = ahead ? &ahead[i - crawl->start] : NULL;
 	int crawl_children = 1;
 
 	if (callback != NULL) {
 	    crawl_children = callback (fold, baton);
 	}
 
+	/* It's in a worker's queue until read, wanted or not. */
+	if (next)
+	    await_kids (next);
+
 	if (crawl_children) {
-	    crawl_folders_body (crawl, fold, callback, baton);
+	    crawl_folders_body (crawl, fd, fold, next, callback, baton);
+	} else if (next) {
+	    /* Nobody will use these. */
+	    while (next->n > 0)
+		free (next->names[--next->n]);
 	}
+	if (next)
+	    free (next->names);
     }
+    free (ahead);
 
+    close (fd);
     crawl->start = os;
     crawl->foldp = of;
 }
 
 void
-crawl_folders (char *dir, crawl_callback_t *callback, void *baton)
+crawl_folders (char *dir, crawl_callback_t *callback, void *baton, int jobs)
 {
     struct crawl_context *crawl;
     NEW(crawl);
     crawl->max = CRAWL_NUMFOLDERS;
     crawl->start = crawl->foldp = 0;
+    crawl->jobs = jobs;
+    crawl->workers = NULL;
+    crawl->nextworker = 0;
     crawl->folders = mh_xmalloc (crawl->max * sizeof(*crawl->folders));
 
-    crawl_folders_body (crawl, dir, callback, baton);
+    crawl_folders_body (crawl, AT_FDCWD, dir, NULL, callback, baton);
+    if (crawl->workers)
+	stop_workers (crawl);
 
     /* Note that we "leak" the folder names, on the assumption that the caller
      * is using them. */
@@ -13,5 +13,7 @@ typedef bool (crawl_callback_t)(char *, void *);
 /* Crawl the folder hierarchy rooted at the relative path `dir'.  For each
  * folder, pass `callback' the folder name (as a path relative to the current
  * directory) and `baton'; the callback may direct crawl_folders not to crawl
- * its children; see above. */
-void crawl_folders(char *, crawl_callback_t *, void *);
+ * its children; see above.  If `jobs' is more than 1, that many processes
+ * read ahead the subfolders of the folders found, but the callbacks are
+ * still made in this process, in the same order. */
+void crawl_folders(char *, crawl_callback_t *, void *, int);
@@ -4,6 +4,12 @@
  *	pointer if it isn't needed.  Look in the context for an error message if
  *	something goes wrong; there is a built-in message in case one isn't specified.
  *	Only produce the error message once.
+ *
+ *	If there's a hook-server profile entry, that program is started the
+ *	first time a hook is needed, and is instead sent a line for each one
+ *	on its standard input:  "add", "del" or "ref", then the file names,
+ *	separated by tabs.  The lines are buffered.  Its exit status, which is
+ *	collected when we exit, says whether they were all handled.
  */
 
 #include "h/mh.h"
@@ -12,6 +18,24 @@
 #include "pidstatus.h"
 #include "arglist.h"
 #include "error.h"
+#include "h/signals.h"
+#include <fcntl.h>
+
+static bool	did_message;            /* set if we've already output a message */
+
+static int	server_fd = -1;		/* pipe to the hook-server */
+static pid_t	server_pid;		/* ID of the hook-server */
+static pid_t	server_owner;		/* ID of the process that started it */
+static bool	server_failed;		/* set if it couldn't be started or fed */
+static char	server_buf[NMH_BUFSIZ];	/* records not yet written to it */
+static size_t	server_len;
+
+static void hook_failed(char *, int);
+static int server_record(char *, char *, char *, char *);
+static int server_start(char *);
+static int server_flush(void);
+static void server_finish(void);
+
 
 int
 ext_hook(char *hook_name, char *message_file_name_1, char *message_file_name_2)
@@ -23,7 +47,9 @@ ext_hook(char *hook_name, char *message_file_name_1, char *message_file_name_2)
     int		vecp;			/* Vector index */
     char	*program;		/* Name of program to execute */
 
-    static bool	did_message;            /* set if we've already output a message */
+    if ((hook = context_find("hook-server")) && *hook)
+	return server_record(hook, hook_name, message_file_name_1,
+			     message_file_name_2);
 
     if ((hook = context_find(hook_name)) == NULL)
 	return OK;
@@ -52,6 +78,15 @@ ext_hook(char *hook_name, char *message_file_name_1, char *message_file_name_2)
     if (status == OK)
 	return OK;
 
+    hook_failed(hook, status);
+
+    return NOTOK;
+}
+
+
+static void
+hook_failed(char *hook, int status)
+{
     if (!did_message) {
         char *msghook;
         if ((msghook = context_find("msg-hook")) != NULL)
@@ -59,10 +94,165 @@ ext_hook(char *hook_name, char *message_file_name_1, char *message_file_name_2)
         else {
             char errbuf[BUFSIZ];
             snprintf(errbuf, sizeof(errbuf), "external hook \"%s\"", hook);
-            pidstatus(status, stderr, errbuf);
+            if (status == OK)
+                inform("%s stopped reading its input", errbuf);
+            else
+                pidstatus(status, stderr, errbuf);
         }
         did_message = true;
     }
+}
 
-    return NOTOK;
+
+/*
+ * Queue the record for one hook, "add-hook" becoming "add" and so on,
+ * for the hook-server.
+ */
+static int
+server_record(char *server, char *hook_name, char *name1, char *name2)
+{
+    char *names[2];
+    size_t len;
+    int i;
+
+    if (server_failed)
+	return NOTOK;
+    if (server_fd == -1 && server_start(server) == NOTOK)
+	return NOTOK;
+
+    names[0] = name1;
+    names[1] = name2;
+
+    /* Tabs and newlines would be taken for separators. */
+    for (i = 0; i < 2 && names[i]; i++)
+	if (strpbrk(names[i], "\t\n")) {
+	    inform("can't pass %s to hook-server, continuing...", names[i]);
+	    return NOTOK;
+	}
+
+    len = strcspn(hook_name, "-");
+    for (i = 0; i < 2 && names[i]; i++)
+	len += strlen(names[i]) + 1;
+    if (server_len + len + 1 > sizeof server_buf && server_flush() == NOTOK)
+	return NOTOK;
+    if (len + 1 > sizeof server_buf) {
+	inform("can't pass %s to hook-server, continuing...", name1);
+	return NOTOK;
+    }
+
+    len = strcspn(hook_name, "-");
+    memcpy(server_buf + server_len, hook_name, len);
+    server_len += len;
+    for (i = 0; i < 2 && names[i]; i++) {
+	server_buf[server_len++] = '\t';
+	len = strlen(names[i]);
+	memcpy(server_buf + server_len, names[i], len);
+	server_len += len;
+    }
+    server_buf[server_len++] = '\n';
+
+    return OK;
+}
+
+
+static int
+server_start(char *server)
+{
+    int pipefd[2];
+    char **vec;
+    int vecp;
+    char *program;
+
+    if (pipe(pipefd) == -1) {
+	advise("pipe", "unable to create");
+	server_failed = true;
+	inform("external database may be out-of-date.");
+	return NOTOK;
+    }
+
+    switch (server_pid = fork()) {
+    case -1:
+	close(pipefd[0]);
+	close(pipefd[1]);
+	server_failed = true;
+	inform("external database may be out-of-date.");
+	return NOTOK;
+
+    case 0:
+	close(pipefd[1]);
+	if (pipefd[0] != 0) {
+	    dup2(pipefd[0], 0);
+	    close(pipefd[0]);
+	}
+	vec = argsplit(server, &program, &vecp);
+	execvp(program, vec);
+	advise(program, "Unable to execute");
+	_exit(1);
+	/* NOTREACHED */
+
+    default:
+	break;
+    }
+
+    /* Don't let later children hold the pipe open. */
+    close(pipefd[0]);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+    server_fd = pipefd[1];
+    server_owner = getpid();
+
+    if (atexit(server_finish)) {
+	admonish("atexit", "unable to register atexit function");
+    }
+
+    return OK;
+}
+
+
+static int
+server_flush(void)
+{
+    SIGNAL_HANDLER pstat;
+    size_t off;
+    ssize_t n;
+
+    /* If the server has gone, we'll find out from its exit status. */
+    pstat = SIGNAL(SIGPIPE, SIG_IGN);
+    for (off = 0; off < server_len; off += n) {
+	if ((n = write(server_fd, server_buf + off, server_len - off)) == -1) {
+	    if (errno == EINTR) {
+		n = 0;
+		continue;
+	    }
+	    server_failed = true;
+	    break;
+	}
+    }
+    SIGNAL(SIGPIPE, pstat);
+
+    server_len = 0;
+    return server_failed ? NOTOK : OK;
+}
+
+
+/*
+ * Send what's left, close the pipe, and wait for the hook-server
+ * to say whether it handled everything.
+ */
+static void
+server_finish(void)
+{
+    int status;
+
+    /* A child that we forked and that calls exit() isn't its parent. */
+    if (server_fd == -1 || getpid() != server_owner)
+	return;
+
+    if (!server_failed)
+	server_flush();
+    close(server_fd);
+    server_fd = -1;
+
+    status = pidwait(server_pid, -1);
+    if (status != OK || server_failed)
+	hook_failed(context_find("hook-server"), status);
 }
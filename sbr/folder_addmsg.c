@@ -13,6 +13,7 @@
 #include "folder_realloc.h"
 #include "folder_addmsg.h"
 #include "error.h"
+#include "seq_msgs.h"
 #include <fcntl.h>
 
 /*
@@ -51,12 +52,12 @@ folder_addmsg (struct msgs **mpp, char *msgfile, int selected,
 
 	/*
 	 * See if we need more space.  If we need space at the
-	 * end, then we allocate space for an addition 100 messages.
+	 * end, then folder_realloc() grows it geometrically.
 	 * If we need space at the beginning of the range, then just
 	 * extend message status range to cover this message number.
          */
 	if (msgnum > mp->hghoff) {
-	    if (!(mp = folder_realloc (mp, mp->lowoff, msgnum + 100))) {
+	    if (!(mp = folder_realloc (mp, mp->lowoff, msgnum))) {
 		inform("unable to allocate folder storage");
 		return -1;
             }
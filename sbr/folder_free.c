@@ -9,6 +9,7 @@
 #include "folder_free.h"
 #include "h/utils.h"
 #include "lock_file.h"
+#include "seq_file.h"
 
 
 void
@@ -32,12 +33,17 @@ folder_free (struct msgs *mp)
     }
     free (mp->msgstats);
 
+    for (i = 0; i < mp->num_msgseqs; i++)
+	rvector_free (mp->msgseqs[i]);
+    free (mp->msgseqs);
+
     /* Close/free the sequence file if it is open */
 
     if (mp->seqhandle)
 	lkfclosedata (mp->seqhandle, mp->seqname);
 
     free(mp->seqname);
+    seq_file_free (mp->pubseqs);
 
     bvector_free (mp->attrstats);
     free (mp);			/* free main folder structure */
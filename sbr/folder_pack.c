@@ -13,6 +13,7 @@
 #include "folder_realloc.h"
 #include "folder_pack.h"
 #include "error.h"
+#include "seq_msgs.h"
 
 /*
  * Pack the message in a folder.
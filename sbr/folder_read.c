@@ -12,10 +12,21 @@
 #include "error.h"
 #include "h/utils.h"
 #include "m_maildir.h"
+#include <fcntl.h>
+#include <time.h>
+#include <inttypes.h>
 
 /* We allocate the `mi' array 1024 elements at a time */
 #define	NUMMSGS  1024
 
+#define SUMMARY_MAGIC "nmh-summary 1"
+
+static struct msgs *folder_load (char *, int, bool);
+static int *read_dir (struct msgs *, DIR *);
+static int *read_summary (struct msgs *, struct stat *);
+static void write_summary (struct msgs *, struct stat *);
+static void lock_summary (FILE *, short);
+
 /*
  * 1) Create the folder/message structure
  * 2) Read the directory (folder) and temporarily
@@ -28,12 +39,24 @@
 struct msgs *
 folder_read (char *name, int lockflag)
 {
-    int msgnum, len, *mi;
+    return folder_load (name, lockflag, false);
+}
+
+struct msgs *
+folder_read_summary (char *name)
+{
+    return folder_load (name, 0, mh_summary && *mh_summary);
+}
+
+
+static struct msgs *
+folder_load (char *name, int lockflag, bool summary)
+{
+    int msgnum, *mi = NULL;
+    bool cached;
     struct msgs *mp;
-    struct dirent *dp;
+    struct stat st;
     DIR *dd;
-    struct bvector *v;
-    size_t i;
 
     name = m_mailpath (name);
     if (!(dd = opendir (name))) {
@@ -54,10 +77,93 @@ folder_read (char *name, int lockflag)
     mp->nummsg = 0;
     mp->seqhandle = NULL;
     mp->seqname = NULL;
+    mp->pubseqs = NULL;
 
     if (access (name, W_OK) == -1)
 	set_readonly (mp);
 
+    /*
+     * Record the numbers of the messages in this folder
+     * in a temporary place, from its summary if that's
+     * still good, else from the directory.
+     */
+    if (summary && fstat (dirfd (dd), &st) == -1)
+	summary = false;
+    cached = summary && (mi = read_summary (mp, &st));
+    if (!cached)
+	mi = read_dir (mp, dd);
+
+    closedir (dd);
+    mp->lowoff = max (mp->lowmsg, 1);
+
+    /* Go ahead and allocate space for 100 additional messages. */
+    mp->hghoff = mp->hghmsg + 100;
+
+    /* for testing, allocate minimal necessary space */
+    /* mp->hghoff = max (mp->hghmsg, 1); */
+
+    /*
+     * If for some reason hghoff < lowoff (like we got an integer overflow)
+     * the complain about this now.
+     */
+
+    if (mp->hghoff < mp->lowoff) {
+	die("Internal failure: high message limit < low message "
+	      "limit; possible overflow?");
+    }
+
+    /*
+     * Allocate space for status of each message.  Zeroed entries
+     * are empty, so the numbers between widely spread messages
+     * needn't be touched, and cost no more than address space.
+     */
+    mp->num_msgstats = MSGSTATNUM (mp->lowoff, mp->hghoff);
+    mp->msgstats = mh_xcalloc (mp->num_msgstats, sizeof *mp->msgstats);
+
+    mp->msgattrs = svector_create (0);
+    mp->num_msgseqs = 0;
+    mp->msgseqs = NULL;
+
+    /*
+     * Scan through the array of messages we've seen and
+     * setup the initial flags for those messages in the
+     * newly allocated mp->msgstats area.
+     */
+    for (msgnum = 0; msgnum < mp->nummsg; msgnum++)
+	set_exists (mp, mi[msgnum]);
+
+    free (mi);		/* We don't need this anymore    */
+
+    if (summary && !cached)
+	write_summary (mp, &st);
+
+    /*
+     * Read and initialize the sequence information.
+     */
+    if (seq_read (mp, lockflag, summary) == NOTOK) {
+        char seqfile[PATH_MAX];
+
+        /* Failed to lock sequence file. */
+        snprintf (seqfile, sizeof(seqfile), "%s/%s", mp->foldpath, mh_seq);
+        advise (seqfile, "failed to lock");
+
+        return NULL;
+    }
+
+    return mp;
+}
+
+
+/*
+ * Read the directory, and return the numbers of the messages in it.
+ */
+
+static int *
+read_dir (struct msgs *mp, DIR *dd)
+{
+    int msgnum, len, *mi;
+    struct dirent *dp;
+
     /*
      * Allocate a temporary place to record the
      * name of the messages in this folder.
@@ -116,58 +222,175 @@ folder_read (char *name, int lockflag)
 	}
     }
 
-    closedir (dd);
-    mp->lowoff = max (mp->lowmsg, 1);
+    return mi;
+}
 
-    /* Go ahead and allocate space for 100 additional messages. */
-    mp->hghoff = mp->hghmsg + 100;
 
-    /* for testing, allocate minimal necessary space */
-    /* mp->hghoff = max (mp->hghmsg, 1); */
+/*
+ * The summary file, named by the "mh-summary" profile entry, records
+ * what read_dir() found, as of the directory's modification time:
+ *
+ *	nmh-summary 1
+ *	<mtime> <nummsg> <other files> [<nsec>]
+ *	<message ranges, as in a sequence>
+ *
+ * nsec, the nanoseconds of the mtime, is only written where the system
+ * records them;  a summary without it is checked to the second.
+ *
+ * Return the numbers of the messages in the folder from its summary,
+ * or NULL if there's no summary for the directory as it now is.
+ */
 
-    /*
-     * If for some reason hghoff < lowoff (like we got an integer overflow)
-     * the complain about this now.
-     */
+static int *
+read_summary (struct msgs *mp, struct stat *st)
+{
+    char path[PATH_MAX], buf[BUFSIZ];
+    intmax_t mtime;
+    long nsec;
+    int nummsg, others, fields, lo, hi, c, n, *mi;
+    bool bad;
+    FILE *fp;
 
-    if (mp->hghoff < mp->lowoff) {
-	die("Internal failure: high message limit < low message "
-	      "limit; possible overflow?");
+    snprintf (path, sizeof path, "%s/%s", mp->foldpath, mh_summary);
+    if (!(fp = fopen (path, "r")))
+	return NULL;
+    lock_summary (fp, F_RDLCK);
+
+    if (!fgets (buf, sizeof buf, fp)  ||
+	strcmp (buf, SUMMARY_MAGIC "\n") != 0  ||
+	!fgets (buf, sizeof buf, fp)  ||
+	(fields = sscanf (buf, "%jd %d %d %ld", &mtime, &nummsg, &others,
+			  &nsec)) < 3  ||
+	mtime != (intmax_t) st->st_mtime  ||
+	(fields == 4  &&  nsec != MTIME_NSEC (*st))  ||  nummsg < 0) {
+	fclose (fp);
+	return NULL;
     }
 
-    /*
-     * Allocate space for status of each message.
-     */
-    mp->num_msgstats = MSGSTATNUM (mp->lowoff, mp->hghoff);
-    mp->msgstats = mh_xmalloc (MSGSTATSIZE(mp));
-    for (i = 0, v = mp->msgstats; i < mp->num_msgstats; ++i, ++v) {
-        bvector_init(v);
+    mi = mh_xmalloc ((size_t) (nummsg + 1) * sizeof *mi);
+    bad = false;
+    for (n = 0, hi = 0; !bad && fscanf (fp, "%d", &lo) == 1; ) {
+	/* The ranges must ascend, and hold nummsg messages. */
+	if ((bad = lo <= hi))
+	    break;
+	if ((c = getc (fp)) == '-') {
+	    bad = fscanf (fp, "%d", &hi) != 1  ||  hi < lo;
+	} else {
+	    ungetc (c, fp);
+	    hi = lo;
+	}
+	if (bad  ||  (bad = hi - lo >= nummsg - n))
+	    break;
+	while (lo <= hi)
+	    mi[n++] = lo++;
     }
 
-    mp->msgattrs = svector_create (0);
+    if (bad  ||  n != nummsg  ||  !feof (fp)) {
+	fclose (fp);
+	free (mi);
+	return NULL;
+    }
+    fclose (fp);
 
-    /*
-     * Scan through the array of messages we've seen and
-     * setup the initial flags for those messages in the
-     * newly allocated mp->msgstats area.
-     */
-    for (msgnum = 0; msgnum < mp->nummsg; msgnum++)
-	set_exists (mp, mi[msgnum]);
+    mp->nummsg = nummsg;
+    if (nummsg > 0) {
+	mp->lowmsg = mi[0];
+	mp->hghmsg = mi[nummsg - 1];
+    }
+    if (others)
+	set_other_files (mp);
 
-    free (mi);		/* We don't need this anymore    */
+    return mi;
+}
 
-    /*
-     * Read and initialize the sequence information.
-     */
-    if (seq_read (mp, lockflag) == NOTOK) {
-        char seqfile[PATH_MAX];
 
-        /* Failed to lock sequence file. */
-        snprintf (seqfile, sizeof(seqfile), "%s/%s", mp->foldpath, mh_seq);
-        advise (seqfile, "failed to lock");
+/*
+ * Record the messages just read from the directory whose status is
+ * in st in the folder's summary.  A change to the directory within
+ * the tick of the clock it was last changed in might not change its
+ * modification time again, so the summary is left empty unless its
+ * own modification time, stamped by the same file system's clock,
+ * shows that tick has passed.
+ *
+ * The summary is rewritten in place, so that writing it doesn't
+ * itself change the directory.  If it doesn't exist, it's created
+ * empty, to be filled in next time.  It's only a cache, so failure
+ * is silently ignored.
+ */
 
-        return NULL;
+static void
+write_summary (struct msgs *mp, struct stat *st)
+{
+    char path[PATH_MAX];
+    const char *sep;
+    struct stat sst;
+    int msgnum, lo, fd;
+    FILE *fp;
+
+    snprintf (path, sizeof path, "%s/%s", mp->foldpath, mh_summary);
+    if (!(fp = fopen (path, "r+"))) {
+	if (errno == ENOENT  &&
+	    (fd = open (path, O_WRONLY | O_CREAT | O_EXCL, 0666)) != -1)
+	    close (fd);
+	return;
     }
+    lock_summary (fp, F_WRLCK);
 
-    return mp;
+    if (ftruncate (fileno (fp), 0) == -1) {
+	fclose (fp);
+	return;
+    }
+
+    fprintf (fp, "%s\n%jd %d %d", SUMMARY_MAGIC, (intmax_t) st->st_mtime,
+	     mp->nummsg, other_files (mp) ? 1 : 0);
+    if (MTIME_NSEC (*st) >= 0)
+	fprintf (fp, " %ld", (long) MTIME_NSEC (*st));
+    putc ('\n', fp);
+    sep = "";
+    for (msgnum = mp->lowmsg; msgnum <= mp->hghmsg; msgnum++) {
+	if (!does_exist (mp, msgnum))
+	    continue;
+	for (lo = msgnum; msgnum < mp->hghmsg && does_exist (mp, msgnum + 1); )
+	    msgnum++;
+	if (lo == msgnum)
+	    fprintf (fp, "%s%d", sep, lo);
+	else
+	    fprintf (fp, "%s%d-%d", sep, lo, msgnum);
+	sep = " ";
+    }
+    putc ('\n', fp);
+
+    if (fflush (fp) == EOF  ||  fstat (fileno (fp), &sst) == -1  ||
+	st->st_mtime > sst.st_mtime  ||
+	(st->st_mtime == sst.st_mtime  &&
+	 MTIME_NSEC (*st) >= MTIME_NSEC (sst))) {
+	/* Failing that, spoil the magic so that it's not read. */
+	if (ftruncate (fileno (fp), 0) == -1) {
+	    rewind (fp);
+	    putc ('\n', fp);
+	}
+    }
+
+    fclose (fp);
+}
+
+
+/*
+ * Lock the summary with fcntl(), whatever the datalocking profile entry
+ * says, because creating and removing a dot lock file would change the
+ * folder's directory, and so its modification time, every time.  The
+ * lock goes with fclose().  If it can't be had, the summary is used
+ * anyway:  a reader that sees one half written won't accept it.
+ */
+
+static void
+lock_summary (FILE *fp, short type)
+{
+    struct flock fl;
+
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    (void) fcntl (fileno (fp), F_SETLKW, &fl);
 }
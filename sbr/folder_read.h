@@ -15,3 +15,12 @@
  *		  See comments for seq_read() for more information.
  */
 struct msgs *folder_read(char *name, int lockflag);
+
+/*
+ * Like folder_read(name, 0), but if the user has enabled folder
+ * summaries with the "mh-summary" profile entry, take the list of
+ * messages from the folder's summary while the directory is unchanged
+ * since it was written, rather than reading the directory.  Only for
+ * programs that report on folders, such as flist.
+ */
+struct msgs *folder_read_summary(char *name);
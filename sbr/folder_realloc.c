@@ -14,6 +14,12 @@
  * Reallocate some of the space in the folder
  * structure (currently just message status array).
  *
+ * When the space has to grow past hghoff, it at least doubles, so
+ * that adding messages one at a time costs amortized constant time.
+ * The new entries are zeroed, which makes them empty, so space that's
+ * reserved but never used isn't touched, and only the entries from
+ * lowmsg to hghmsg are copied.
+ *
  * Return pointer to new folder structure.
  * If error, return NULL.
  */
@@ -21,9 +27,9 @@
 struct msgs *
 folder_realloc (struct msgs *mp, int lo, int hi)
 {
-    struct bvector *tmpstats, *t;
-    size_t i;
-    int msgnum;
+    struct bvector *tmpstats;
+    size_t num;
+    int msgnum, keeplo, keephi;
 
     /* sanity checks */
     if (lo < 1)
@@ -41,20 +47,38 @@ folder_realloc (struct msgs *mp, int lo, int hi)
     if (lo == mp->lowoff && hi == mp->hghoff)
 	return mp;
 
-    /* first allocate the new message status space */
-    mp->num_msgstats = MSGSTATNUM (lo, hi);
-    tmpstats = mh_xmalloc (MSGSTATSIZE(mp));
-    for (i = 0, t = tmpstats; i < mp->num_msgstats; ++i, ++t) {
-        bvector_init(t);
+    /* grow geometrically at the top */
+    if (hi > mp->hghoff) {
+	num = MSGSTATNUM (mp->lowoff, mp->hghoff);
+	if (num <= (size_t) (INT_MAX - mp->hghoff))
+	    hi = max (hi, mp->hghoff + (int) num);
     }
 
-    /* then copy messages status array with shift */
+    /* the part of the old space that's in use; the rest is empty */
     if (mp->nummsg > 0) {
-        for (msgnum = mp->lowmsg; msgnum <= mp->hghmsg; msgnum++)
-            bvector_copy (tmpstats + msgnum - lo, msgstat (mp, msgnum));
+	keeplo = mp->lowmsg;
+	keephi = mp->hghmsg;
+    } else {
+	keeplo = mp->lowoff;
+	keephi = keeplo - 1;
     }
+
+    /* first allocate the new message status space */
+    num = MSGSTATNUM (lo, hi);
+    tmpstats = mh_xcalloc (num, sizeof *tmpstats);
+
+    /* then move the message status array with shift */
+    if (keeplo <= keephi)
+	memcpy (tmpstats + keeplo - lo, msgstat (mp, keeplo),
+		MSGSTATNUM (keeplo, keephi) * sizeof *tmpstats);
+    for (msgnum = mp->lowoff; msgnum < keeplo; msgnum++)
+	bvector_fini (msgstat (mp, msgnum));
+    for (msgnum = keephi + 1; msgnum <= mp->hghoff; msgnum++)
+	bvector_fini (msgstat (mp, msgnum));
+
     free(mp->msgstats);
     mp->msgstats = tmpstats;
+    mp->num_msgstats = num;
     mp->lowoff = lo;
     mp->hghoff = hi;
 
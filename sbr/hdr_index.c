@@ -0,0 +1,384 @@
+/* hdr_index.c -- per-folder index of parsed header components
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information.
+ */
+
+#include "h/mh.h"
+#include "hdr_index.h"
+#include "m_mktemp.h"
+#include "h/utils.h"
+#include <inttypes.h>
+
+/*
+ * The index file lives in the folder, named by the "mh-index" profile
+ * entry.  It's a text header followed by length-counted records, so
+ * that component text may contain any byte:
+ *
+ *	nmh-index 1
+ *	<ncomps> <comp> ...
+ *	<msgnum> <inode> <mtime> <size> <nfields> [<nsec>]
+ *	<name> <length>
+ *	<text>
+ *	...
+ *
+ * Each text is followed by a newline that isn't counted in its length.
+ * nsec, the nanoseconds of the mtime, is only written where the system
+ * records them;  a record without it is checked to the second.
+ */
+
+#define HDR_INDEX_MAGIC "nmh-index 1"
+
+static bool read_entries (struct hdr_index *, FILE *);
+static void discard_entries (struct hdr_index *);
+static struct hdr_index_entry **entry_slot (struct hdr_index *, int);
+
+
+struct hdr_index *
+hdr_index_read (struct msgs *mp)
+{
+    struct hdr_index *hi;
+    char path[PATH_MAX];
+    FILE *fp;
+
+    if (mh_index == NULL || *mh_index == '\0')
+	return NULL;
+
+    snprintf (path, sizeof path, "%s/%s", mp->foldpath, mh_index);
+
+    NEW0(hi);
+    hi->path = mh_xstrdup(path);
+    hi->comps = svector_create (8);
+    hi->lowoff = mp->lowoff;
+    hi->hghoff = mp->hghoff;
+    hi->entries = mh_xcalloc (hi->hghoff - hi->lowoff + 1, sizeof *hi->entries);
+
+    if ((fp = fopen (hi->path, "r"))) {
+	if (! read_entries (hi, fp)) {
+	    /* A damaged index is rebuilt rather than trusted. */
+	    discard_entries (hi);
+	    hi->modified = true;
+	}
+	fclose (fp);
+    }
+
+    return hi;
+}
+
+
+static bool
+read_entries (struct hdr_index *hi, FILE *fp)
+{
+    char buf[BUFSIZ], name[NAMESZ];
+    int ncomps, i;
+
+    if (! fgets (buf, sizeof buf, fp)  ||
+	strncmp (buf, HDR_INDEX_MAGIC "\n", sizeof buf) != 0)
+	return false;
+
+    if (fscanf (fp, "%d", &ncomps) != 1  ||  ncomps < 0)
+	return false;
+    for (i = 0; i < ncomps; i++) {
+	if (fscanf (fp, " %998s", name) != 1)
+	    return false;
+	svector_push_back (hi->comps, mh_xstrdup(name));
+    }
+    if (getc (fp) != '\n')
+	return false;
+
+    for (;;) {
+	struct hdr_index_entry *ep, **slot;
+
+	switch (hdr_index_entry_read (fp, &ep)) {
+	case DONE:
+	    return true;
+	case NOTOK:
+	    return false;
+	}
+
+	/* Keep only entries for messages the folder can currently hold. */
+	if ((slot = entry_slot (hi, ep->msgnum))) {
+	    hdr_index_entry_free (*slot);
+	    *slot = ep;
+	} else {
+	    hdr_index_entry_free (ep);
+	    hi->modified = true;
+	}
+    }
+}
+
+
+int
+hdr_index_entry_read (FILE *fp, struct hdr_index_entry **epp)
+{
+    struct hdr_index_entry *ep;
+    struct stat st;
+    char name[NAMESZ];
+    char line[BUFSIZ];
+    intmax_t ino, mtime, size;
+    long nsec;
+    int msgnum;
+    size_t nfields, n;
+
+    if (fgets (line, sizeof line, fp) == NULL)
+	return ferror (fp) ? NOTOK : DONE;
+    switch (sscanf (line, "%d %" SCNdMAX " %" SCNdMAX " %" SCNdMAX " %zu %ld",
+		    &msgnum, &ino, &mtime, &size, &nfields, &nsec)) {
+    case 5:
+	nsec = -1;
+	break;
+    case 6:
+	break;
+    default:
+	return NOTOK;
+    }
+
+    ZERO(&st);
+    st.st_ino = ino;
+    st.st_mtime = mtime;
+    st.st_size = size;
+    ep = hdr_index_entry_create (msgnum, &st);
+    ep->mtime_nsec = nsec;
+
+    for (n = 0; n < nfields; n++) {
+	size_t len;
+	char *text;
+
+	if (fscanf (fp, " %998s %zu", name, &len) != 2  ||
+	    getc (fp) != '\n'  ||  len >= NMH_BUFSIZ) {
+	    hdr_index_entry_free (ep);
+	    return NOTOK;
+	}
+	text = mh_xmalloc (len + 1);
+	if (fread (text, 1, len, fp) != len  ||  getc (fp) != '\n') {
+	    free (text);
+	    hdr_index_entry_free (ep);
+	    return NOTOK;
+	}
+	text[len] = '\0';
+	hdr_index_entry_add (ep, name, text);
+	free (text);
+    }
+
+    *epp = ep;
+
+    return OK;
+}
+
+
+void
+hdr_index_entry_write (struct hdr_index_entry *ep, FILE *fp)
+{
+    size_t i;
+
+    fprintf (fp, "%d %" PRIdMAX " %" PRIdMAX " %" PRIdMAX " %zu",
+	     ep->msgnum, (intmax_t) ep->ino, (intmax_t) ep->mtime,
+	     (intmax_t) ep->size, ep->nfields);
+    if (ep->mtime_nsec >= 0)
+	fprintf (fp, " %ld", ep->mtime_nsec);
+    putc ('\n', fp);
+    for (i = 0; i < ep->nfields; i++)
+	fprintf (fp, "%s %zu\n%s\n", ep->fields[i].name,
+		 strlen (ep->fields[i].text), ep->fields[i].text);
+}
+
+
+void
+hdr_index_require (struct hdr_index *hi, char **comps, size_t ncomps)
+{
+    bool missing = false;
+    size_t i;
+
+    for (i = 0; i < ncomps; i++) {
+	if (! svector_find (hi->comps, comps[i])) {
+	    svector_push_back (hi->comps, mh_xstrdup(comps[i]));
+	    missing = true;
+	}
+    }
+
+    if (missing) {
+	discard_entries (hi);
+	hi->modified = true;
+    }
+}
+
+
+struct hdr_index_entry *
+hdr_index_lookup (struct hdr_index *hi, int msgnum, struct stat *st)
+{
+    struct hdr_index_entry **slot, *ep;
+
+    if (! (slot = entry_slot (hi, msgnum))  ||  ! (ep = *slot))
+	return NULL;
+
+    if (ep->ino == st->st_ino  &&  ep->mtime == st->st_mtime  &&
+	ep->size == st->st_size  &&
+	(ep->mtime_nsec < 0  ||  ep->mtime_nsec == MTIME_NSEC (*st)))
+	return ep;
+
+    hdr_index_entry_free (ep);
+    *slot = NULL;
+    hi->modified = true;
+
+    return NULL;
+}
+
+
+struct hdr_index_entry *
+hdr_index_entry_create (int msgnum, struct stat *st)
+{
+    struct hdr_index_entry *ep;
+
+    NEW0(ep);
+    ep->msgnum = msgnum;
+    ep->ino = st->st_ino;
+    ep->mtime = st->st_mtime;
+    ep->mtime_nsec = MTIME_NSEC (*st);
+    ep->size = st->st_size;
+
+    return ep;
+}
+
+
+void
+hdr_index_entry_add (struct hdr_index_entry *ep, const char *name,
+		     const char *text)
+{
+    ep->fields = mh_xrealloc (ep->fields,
+			      (ep->nfields + 1) * sizeof *ep->fields);
+    ep->fields[ep->nfields].name = mh_xstrdup(name);
+    ep->fields[ep->nfields].text = mh_xstrdup(text);
+    ep->nfields++;
+}
+
+
+void
+hdr_index_entry_free (struct hdr_index_entry *ep)
+{
+    size_t i;
+
+    if (ep == NULL)
+	return;
+
+    for (i = 0; i < ep->nfields; i++) {
+	free (ep->fields[i].name);
+	free (ep->fields[i].text);
+    }
+    free (ep->fields);
+    free (ep);
+}
+
+
+void
+hdr_index_store (struct hdr_index *hi, struct hdr_index_entry *ep)
+{
+    struct hdr_index_entry **slot;
+
+    if (! (slot = entry_slot (hi, ep->msgnum))) {
+	hdr_index_entry_free (ep);
+	return;
+    }
+
+    hdr_index_entry_free (*slot);
+    *slot = ep;
+    hi->modified = true;
+}
+
+
+struct hdr_index_entry *
+hdr_index_remove (struct hdr_index *hi, int msgnum)
+{
+    struct hdr_index_entry **slot, *ep;
+
+    if (! (slot = entry_slot (hi, msgnum))  ||  ! (ep = *slot))
+	return NULL;
+
+    *slot = NULL;
+    hi->modified = true;
+
+    return ep;
+}
+
+
+void
+hdr_index_save (struct hdr_index *hi, struct msgs *mp)
+{
+    char *tmpfile;
+    size_t i;
+    int msgnum;
+    bool failed;
+    FILE *fp;
+
+    if (! hi->modified)
+	return;
+
+    if ((tmpfile = m_mktemp2 (hi->path, invo_name, NULL, &fp)) == NULL)
+	return;
+
+    fputs (HDR_INDEX_MAGIC "\n", fp);
+    fprintf (fp, "%zu", svector_size (hi->comps));
+    for (i = 0; i < svector_size (hi->comps); i++)
+	fprintf (fp, " %s", svector_at (hi->comps, i));
+    putc ('\n', fp);
+
+    for (msgnum = mp->lowmsg; msgnum <= mp->hghmsg; msgnum++) {
+	struct hdr_index_entry **slot, *ep;
+
+	if (! does_exist (mp, msgnum)  ||
+	    ! (slot = entry_slot (hi, msgnum))  ||  ! (ep = *slot))
+	    continue;
+
+	hdr_index_entry_write (ep, fp);
+    }
+
+    failed = fflush (fp) == EOF  ||  ferror (fp);
+    if (fclose (fp) == EOF)
+	failed = true;
+    if (! failed  &&  rename (tmpfile, hi->path) != NOTOK)
+	hi->modified = false;
+
+    /* Removes the temporary file if it wasn't renamed, and in either
+     * case stops it being removed at exit. */
+    (void) m_unlink (tmpfile);
+}
+
+
+void
+hdr_index_free (struct hdr_index *hi)
+{
+    size_t i;
+
+    if (hi == NULL)
+	return;
+
+    discard_entries (hi);
+    free (hi->entries);
+    for (i = 0; i < svector_size (hi->comps); i++)
+	free (svector_at (hi->comps, i));
+    svector_free (hi->comps);
+    free (hi->path);
+    free (hi);
+}
+
+
+static void
+discard_entries (struct hdr_index *hi)
+{
+    int i;
+
+    for (i = 0; i <= hi->hghoff - hi->lowoff; i++) {
+	hdr_index_entry_free (hi->entries[i]);
+	hi->entries[i] = NULL;
+    }
+}
+
+
+static struct hdr_index_entry **
+entry_slot (struct hdr_index *hi, int msgnum)
+{
+    if (msgnum < hi->lowoff  ||  msgnum > hi->hghoff)
+	return NULL;
+
+    return &hi->entries[msgnum - hi->lowoff];
+}
@@ -0,0 +1,107 @@
+/* hdr_index.h -- per-folder index of parsed header components
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information. */
+
+/*
+ * One header field of an indexed message.  The text is what the
+ * scan engine would have collected for the component, so it is
+ * bounded by the size of its component buffers.
+ */
+struct hdr_index_field {
+    char *name;
+    char *text;
+};
+
+/* The name of the pseudo-field holding the start of the body, which
+ * can't clash with a header field name. */
+#define HDR_INDEX_BODY ":body"
+
+/*
+ * The cached information for one message.  An entry is only valid
+ * while the message file's inode, modification time, and size match.
+ * mtime_nsec is -1 if the nanoseconds of the time aren't known.
+ */
+struct hdr_index_entry {
+    int msgnum;
+    ino_t ino;
+    time_t mtime;
+    long mtime_nsec;
+    off_t size;
+    size_t nfields;
+    struct hdr_index_field *fields;
+};
+
+/*
+ * The index of one folder.  comps lists the components whose text is
+ * held for every entry;  a component in comps with no field in an
+ * entry is absent from that message.
+ */
+struct hdr_index {
+    char *path;			/* pathname of the index file      */
+    svector_t comps;		/* components held by the index    */
+    int lowoff;			/* message numbers that entries[]  */
+    int hghoff;			/* can hold                        */
+    struct hdr_index_entry **entries;
+    bool modified;		/* must be written by save         */
+};
+
+/*
+ * Read the index of the folder, if the user has enabled one with the
+ * "mh-index" profile entry.  Returns NULL if indexing is disabled.
+ * A missing or unreadable index file gives an empty index.
+ */
+struct hdr_index *hdr_index_read(struct msgs *);
+
+/*
+ * Make sure the index holds all of the named components.  If it does
+ * not, every entry is discarded and the index will hold the union of
+ * its old components and the new ones.
+ */
+void hdr_index_require(struct hdr_index *, char **, size_t);
+
+/*
+ * Return the entry for msgnum if it is still valid for the file
+ * whose status is in st, else NULL.  A stale entry is discarded.
+ */
+struct hdr_index_entry *hdr_index_lookup(struct hdr_index *, int,
+    struct stat *);
+
+/* Create a new, empty, entry for msgnum with the status in st. */
+struct hdr_index_entry *hdr_index_entry_create(int, struct stat *);
+
+/* Add a copy of a component's name and text to an entry. */
+void hdr_index_entry_add(struct hdr_index_entry *, const char *,
+    const char *);
+
+/*
+ * Read one entry in the index file's format from fp.  Returns OK,
+ * with the entry in *epp, DONE at end of file, or NOTOK if what's
+ * read isn't an entry.
+ */
+int hdr_index_entry_read(FILE *, struct hdr_index_entry **);
+
+/* Write an entry to fp in the index file's format. */
+void hdr_index_entry_write(struct hdr_index_entry *, FILE *);
+
+/* Free an entry that hasn't been stored in an index. */
+void hdr_index_entry_free(struct hdr_index_entry *);
+
+/* Store an entry in the index, replacing any old one for its message. */
+void hdr_index_store(struct hdr_index *, struct hdr_index_entry *);
+
+/*
+ * Remove the entry for msgnum from the index, and return it, or NULL
+ * if there isn't one.  The caller owns the entry.
+ */
+struct hdr_index_entry *hdr_index_remove(struct hdr_index *, int);
+
+/*
+ * Write the index back if it has been modified, keeping entries only
+ * for messages that exist in the folder.  The index is just a cache,
+ * so failure to write it is silently ignored.
+ */
+void hdr_index_save(struct hdr_index *, struct msgs *);
+
+void hdr_index_free(struct hdr_index *);
@@ -48,9 +48,16 @@ struct lockinfo {
 };
 
 /*
- * Number of tries to retry locking
+ * Number of seconds to wait for a lock
  */
-#define LOCK_RETRIES 60
+#define LOCK_WAIT 60
+
+/*
+ * Shortest and longest pause, in nanoseconds, between
+ * attempts to create a dot lock file.
+ */
+#define DOT_PAUSE_MIN 10000000L
+#define DOT_PAUSE_MAX 1000000000L
 
 /*
  * Amount of time to wait before
@@ -81,16 +88,35 @@ static enum locktype datalocktype, spoollocktype;
 /* top of list containing all open locks */
 static struct lock *l_top = NULL;
 
+/* state saved while blocked waiting for a kernel lock */
+struct lockwait {
+    SIGNAL_HANDLER lw_handler;
+    unsigned int lw_left;
+    time_t lw_start;
+    volatile sig_atomic_t lw_expired;
+};
+
+static struct lockwait *waiting = NULL;
+
+static void init_datalocktype (void);
 static int lkopen(const char *, int, mode_t, enum locktype, int *);
 static int str2accbits(const char *);
 
+static int lkopen_wait (const char *, int, mode_t, int *,
+			int (*)(int, int, bool));
 static int lkopen_fcntl (const char *, int, mode_t, int *);
+static int lock_fcntl (int, int, bool);
 #ifdef HAVE_LOCKF
 static int lkopen_lockf (const char *, int, mode_t, int *);
+static int lock_lockf (int, int, bool);
 #endif /* HAVE_LOCKF */
 #ifdef HAVE_FLOCK
 static int lkopen_flock (const char *, int, mode_t, int *);
+static int lock_flock (int, int, bool);
 #endif /* HAVE_FLOCK */
+static void waitON (struct lockwait *);
+static void waitOFF (struct lockwait *);
+static void waitalrm (int);
 
 static enum locktype init_locktype(const char *) PURE;
 
@@ -99,6 +125,7 @@ static void lkclose_dot (int, const char *);
 static void lockname (const char *, struct lockinfo *, int);
 static void timerON (char *, int);
 static void timerOFF (int);
+static bool timerFIND (int);
 static void alrmser (int);
 
 #if !defined(HAVE_LIBLOCKFILE)
@@ -112,6 +139,14 @@ static int lockit (struct lockinfo *);
 
 int
 lkopendata(const char *file, int access, mode_t mode, int *failed_to_lock)
+{
+    init_datalocktype ();
+
+    return lkopen(file, access, mode, datalocktype, failed_to_lock);
+}
+
+static void
+init_datalocktype (void)
 {
     static bool deja_vu;
 
@@ -126,8 +161,6 @@ lkopendata(const char *file, int access, mode_t mode, int *failed_to_lock)
 	    datalocktype = FCNTL_LOCKING;
 	}
     }
-
-    return lkopen(file, access, mode, datalocktype, failed_to_lock);
 }
 
 
@@ -201,6 +234,71 @@ lkfopenspool(const char *file, const char *mode)
 }
 
 
+/*
+ * Open a data file for reading without changing the directory it's in.
+ * A dot lock is a file created and removed beside the data file, which
+ * changes the directory's mtime; so with dot locking, and no LOCKDIR,
+ * the file isn't locked unless someone else holds its lock, in which
+ * case we wait for them by locking it after all.  An unlocked read must
+ * then be checked with lkfpeekchanged().  Kernel locks don't touch the
+ * directory, so with those this is just lkfopendata(file, "r", ...).
+ */
+
+FILE *
+lkfpeekdata(const char *file, struct stat *st, int *failed_to_lock)
+{
+#ifndef LOCKDIR
+    struct lockinfo lkinfo;
+    struct stat lst;
+    FILE *fp;
+
+    init_datalocktype ();
+    if (datalocktype == DOT_LOCKING) {
+	lockname (file, &lkinfo, 0);
+	if (stat (lkinfo.curlock, &lst) == -1 && errno == ENOENT) {
+	    if ((fp = fopen (file, "r")) == NULL)
+		return NULL;
+	    if (fstat (fileno (fp), st) == -1) {
+		fclose (fp);
+		return NULL;
+	    }
+	    return fp;
+	}
+    }
+#else
+    NMH_UNUSED (st);
+#endif
+
+    return lkfopendata(file, "r", failed_to_lock);
+}
+
+/*
+ * Returns true if the file read from fp, opened by lkfpeekdata(),
+ * might have been written meanwhile: someone now holds its lock, or
+ * it's no longer the file, of the size and mtime, that was opened.
+ * The read should then be done again, locked.
+ */
+
+bool
+lkfpeekchanged(FILE *fp, const char *file, const struct stat *st)
+{
+    struct lockinfo lkinfo;
+    struct stat lst, now;
+
+    if (datalocktype != DOT_LOCKING || timerFIND (fileno (fp)))
+	return false;
+
+    lockname (file, &lkinfo, 0);
+    if (stat (lkinfo.curlock, &lst) != -1 || errno != ENOENT)
+	return true;
+
+    return stat (file, &now) == -1 || now.st_ino != st->st_ino
+	|| now.st_size != st->st_size || now.st_mtime != st->st_mtime
+	|| MTIME_NSEC (now) != MTIME_NSEC (*st)
+	|| now.st_ctime != st->st_ctime;
+}
+
+
 /*
  * Corresponding close functions.
  *
@@ -333,6 +431,10 @@ lkclose_dot (int fd, const char *file)
 {
     struct lockinfo lkinfo;
 
+    /* Leave alone a lock that isn't ours, as after lkfpeekdata(). */
+    if (!timerFIND (fd))
+	return;
+
     lockname (file, &lkinfo, 0);	/* get name of lock file */
 #if !defined(HAVE_LIBLOCKFILE)
     (void) m_unlink (lkinfo.curlock);	/* remove lock file      */
@@ -343,6 +445,62 @@ lkclose_dot (int fd, const char *file)
 }
 
 
+/*
+ * Open a file and lock it with lockfn, which makes a non-blocking
+ * attempt if its last argument is false, else a blocking one.  The
+ * common, uncontended case costs a single system call.  Otherwise we
+ * block in the kernel until the holder releases the lock, rather than
+ * polling, and give up after LOCK_WAIT seconds.
+ */
+
+static int
+lkopen_wait(const char *file, int access, mode_t mode, int *failed_to_lock,
+	    int (*lockfn)(int, int, bool))
+{
+    int fd, saved_errno;
+    struct lockwait lw;
+    struct stat st1, st2;
+
+    if ((fd = open(file, access, mode)) == -1)
+	return -1;
+
+    if ((*lockfn)(fd, access, false) != -1)
+	return fd;
+
+    waitON(&lw);
+    for (;;) {
+	if ((*lockfn)(fd, access, true) != -1) {
+	    /*
+	     * The holder may have replaced the file while we were
+	     * waiting, in which case we have locked the old one.
+	     */
+	    if (fstat(fd, &st1) != -1 && stat(file, &st2) != -1 &&
+		st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino) {
+		waitOFF(&lw);
+		return fd;
+	    }
+	    close(fd);
+	    if ((fd = open(file, access, mode)) == -1) {
+		saved_errno = errno;
+		waitOFF(&lw);
+		errno = saved_errno;
+		return -1;
+	    }
+	    continue;
+	}
+	if (errno != EINTR || lw.lw_expired)
+	    break;
+    }
+
+    saved_errno = lw.lw_expired ? EAGAIN : errno;
+    waitOFF(&lw);
+    close(fd);
+    *failed_to_lock = 1;
+    errno = saved_errno;
+    return -1;
+}
+
+
 /*
  * Open and lock a file, using fcntl locking
  */
@@ -350,34 +508,44 @@ lkclose_dot (int fd, const char *file)
 static int
 lkopen_fcntl(const char *file, int access, mode_t mode, int *failed_to_lock)
 {
-    int fd, i, saved_errno;
+    return lkopen_wait(file, access, mode, failed_to_lock, lock_fcntl);
+}
+
+/*
+ * Where the system has them, use open file description locks.  They
+ * belong to the descriptor rather than to the process, so closing
+ * some other descriptor for the same file doesn't silently drop the
+ * lock, and they conflict with ordinary fcntl locks held by other
+ * programs.  Fall back to the latter if the kernel doesn't know them.
+ */
+
+static int
+lock_fcntl(int fd, int access, bool wait)
+{
     struct flock flk;
+#ifdef F_OFD_SETLKW
+    static bool no_ofd;
+#endif
 
     /*
      * The assumption here is that if you open the file for writing, you
      * need an exclusive lock.
      */
-
-    for (i = 0; i < LOCK_RETRIES; i++) {
-	if ((fd = open(file, access, mode)) == -1)
+    ZERO(&flk);
+    flk.l_type = (access & O_ACCMODE) == O_RDONLY ? F_RDLCK : F_WRLCK;
+    flk.l_whence = SEEK_SET;
+
+#ifdef F_OFD_SETLKW
+    if (!no_ofd) {
+	if (fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &flk) != -1)
+	    return 0;
+	if (errno != EINVAL)
 	    return -1;
-
-	flk.l_start = 0;
-	flk.l_len = 0;
-	flk.l_type = (access & O_ACCMODE) == O_RDONLY ? F_RDLCK : F_WRLCK;
-	flk.l_whence = SEEK_SET;
-
-	if (fcntl(fd, F_SETLK, &flk) != -1)
-	    return fd;
-
-	saved_errno = errno;
-	close(fd);
-	sleep(1);
+	no_ofd = true;
     }
+#endif /* F_OFD_SETLKW */
 
-    *failed_to_lock = 1;
-    errno = saved_errno;
-    return -1;
+    return fcntl(fd, wait ? F_SETLKW : F_SETLK, &flk);
 }
 
 
@@ -389,34 +557,25 @@ lkopen_fcntl(const char *file, int access, mode_t mode, int *failed_to_lock)
 static int
 lkopen_flock(const char *file, int access, mode_t mode, int *failed_to_lock)
 {
-    int fd, i, saved_errno, locktype;
+    return lkopen_wait(file, access, mode, failed_to_lock, lock_flock);
+}
+
+static int
+lock_flock(int fd, int access, bool wait)
+{
+    int locktype;
 
     /*
      * The assumption here is that if you open the file for writing, you
      * need an exclusive lock.
      */
+    locktype = (access & O_ACCMODE) == O_RDONLY ? LOCK_SH : LOCK_EX;
 
-    locktype = (((access & O_ACCMODE) == O_RDONLY) ? LOCK_SH : LOCK_EX) |
-							LOCK_NB;
-
-    for (i = 0; i < LOCK_RETRIES; i++) {
-	if ((fd = open(file, access, mode)) == -1)
-	    return -1;
-
-	if (flock(fd, locktype) != -1)
-	    return fd;
-
-	saved_errno = errno;
-	close(fd);
-	sleep(1);
-    }
-
-    *failed_to_lock = 1;
-    errno = saved_errno;
-    return -1;
+    return flock(fd, wait ? locktype : locktype | LOCK_NB);
 }
 #endif /* HAVE_FLOCK */
 
+#ifdef HAVE_LOCKF
 /*
  * Open and lock a file, using lockf locking
  */
@@ -424,7 +583,7 @@ lkopen_flock(const char *file, int access, mode_t mode, int *failed_to_lock)
 static int
 lkopen_lockf(const char *file, int access, mode_t mode, int *failed_to_lock)
 {
-    int fd, i, saved_errno, saved_access;
+    int fd, saved_access;
 
     /*
      * Two notes:
@@ -445,28 +604,74 @@ lkopen_lockf(const char *file, int access, mode_t mode, int *failed_to_lock)
 	access |= O_RDWR;
     }
 
-    for (i = 0; i < LOCK_RETRIES; i++) {
-	if ((fd = open(file, access, mode)) == -1)
-	    return -1;
+    if ((fd = lkopen_wait(file, access, mode, failed_to_lock,
+			  lock_lockf)) == -1)
+	return -1;
 
-	if (lockf(fd, F_TLOCK, 0) != -1) {
-	    /*
-	     * Seek to end if requested
-	     */
-	    if (saved_access & O_APPEND) {
-		lseek(fd, 0, SEEK_END);
-	    }
-	    return fd;
-	}
+    /*
+     * Seek to end if requested
+     */
+    if (saved_access & O_APPEND) {
+	lseek(fd, 0, SEEK_END);
+    }
+    return fd;
+}
 
-	saved_errno = errno;
-	close(fd);
-	sleep(1);
+static int
+lock_lockf(int fd, int access, bool wait)
+{
+    NMH_UNUSED(access);
+
+    return lockf(fd, wait ? F_LOCK : F_TLOCK, 0);
+}
+#endif /* HAVE_LOCKF */
+
+
+/*
+ * Bound a blocking lock request by LOCK_WAIT seconds.  SIGALRM is
+ * also used to refresh dot lock files, and by some callers for their
+ * own timeouts, so waitON() saves any pending alarm and its handler,
+ * and waitOFF() puts them back.
+ */
+
+static void
+waitON(struct lockwait *lw)
+{
+    lw->lw_expired = 0;
+    lw->lw_left = alarm(0);
+    lw->lw_start = time(NULL);
+    waiting = lw;
+    lw->lw_handler = SIGNAL(SIGALRM, waitalrm);
+    alarm(LOCK_WAIT);
+}
+
+static void
+waitOFF(struct lockwait *lw)
+{
+    time_t elapsed;
+
+    alarm(0);
+    SIGNAL(SIGALRM, lw->lw_handler);
+    waiting = NULL;
+
+    if (lw->lw_left) {
+	elapsed = time(NULL) - lw->lw_start;
+	alarm(lw->lw_left > elapsed ? lw->lw_left - elapsed : 1);
     }
+}
 
-    *failed_to_lock = 1;
-    errno = saved_errno;
-    return -1;
+/*
+ * SIGNAL() doesn't ask for SIGALRM to restart system calls, so this
+ * interrupts the blocking lock request with EINTR.
+ */
+
+static void
+waitalrm(int sig)
+{
+    NMH_UNUSED(sig);
+
+    if (waiting)
+	waiting->lw_expired = 1;
 }
 
 
@@ -492,8 +697,20 @@ lkopen_dot (const char *file, int access, mode_t mode, int *failed_to_lock)
 
 #if !defined(HAVE_LIBLOCKFILE)
     {
-	int i;
-	for (i = 0; i < LOCK_RETRIES; ++i) {
+	int misses = 0;
+	time_t now, deadline;
+	struct timespec pause;
+
+	/*
+	 * There is nothing to block on here, so poll, but back off
+	 * exponentially from DOT_PAUSE_MIN rather than sleeping for
+	 * whole seconds: most dot locks are held only briefly.
+	 */
+	pause.tv_sec = 0;
+	pause.tv_nsec = DOT_PAUSE_MIN;
+	deadline = time(NULL) + LOCK_WAIT;
+
+	for (;;) {
             struct stat st;
 
 	    /* attempt to create lock file */
@@ -506,21 +723,24 @@ lkopen_dot (const char *file, int access, mode_t mode, int *failed_to_lock)
             /*
              * Abort locking, if we fail to lock after 5 attempts
              * and are never able to stat the lock file.  Or, if
-             * we can stat the lockfile but exceed LOCK_RETRIES
-             * seconds waiting for it (by falling out of the loop).
+             * we can stat the lockfile but exceed LOCK_WAIT
+             * seconds waiting for it.
              */
+            time (&now);
             if (stat (lkinfo.curlock, &st) == -1) {
-                if (i++ > 5) break;
-                sleep (1);
-            } else {
-                time_t curtime;
-                time (&curtime);
-                
-                /* check for stale lockfile, else sleep */
-                if (curtime > st.st_ctime + RSECS)
-                    (void) m_unlink (lkinfo.curlock);
-                else
-                    sleep (1);
+                if (++misses > 5) break;
+            } else if (now > st.st_ctime + RSECS && now < deadline) {
+                /* stale lockfile, so remove it and try again at once */
+                (void) m_unlink (lkinfo.curlock);
+                lockname (file, &lkinfo, 1);
+                continue;
+            }
+            if (now >= deadline) break;
+
+            nanosleep (&pause, NULL);
+            if (pause.tv_sec == 0 && (pause.tv_nsec *= 2) >= DOT_PAUSE_MAX) {
+                pause.tv_sec = DOT_PAUSE_MAX / 1000000000L;
+                pause.tv_nsec = DOT_PAUSE_MAX % 1000000000L;
             }
             lockname (file, &lkinfo, 1);
 	}
@@ -674,6 +894,23 @@ timerON (char *curlock, int fd)
 }
 
 
+/*
+ * Returns true if fd is in the list of open lockfiles.
+ */
+
+static bool
+timerFIND (int fd)
+{
+    struct lock *lp;
+
+    for (lp = l_top; lp; lp = lp->l_next)
+	if (lp->l_fd == fd)
+	    return true;
+
+    return false;
+}
+
+
 /*
  * Search through the list of lockfiles for the
  * current lockfile, and remove it from the list.
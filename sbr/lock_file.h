@@ -27,3 +27,10 @@ int lkclosedata(int fd, const char *name);
 int lkfclosedata(FILE *f, const char *name);
 int lkclosespool(int fd, const char *name);
 int lkfclosespool(FILE *f, const char *name);
+
+/*
+ * Reading a data file without changing its directory, for callers that
+ * only look, such as folder_load() with a summary.  See lock_file.c.
+ */
+FILE *lkfpeekdata(const char *file, struct stat *st, int *failed_to_lock);
+bool lkfpeekchanged(FILE *fp, const char *file, const struct stat *st);
@@ -12,6 +12,7 @@
 #include "context_find.h"
 #include "seq_getnum.h"
 #include "error.h"
+#include "seq_msgs.h"
 #include "h/utils.h"
 
 /*
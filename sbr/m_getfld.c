@@ -11,6 +11,7 @@
 #include "h/mts.h"
 #include "h/utils.h"
 #include <inttypes.h>
+#include <sys/mman.h>
 
 /*
    Purpose
@@ -53,6 +54,7 @@
 
      char **pat_map
      char *fdelim
+     int fdelimanchor
      char *delimend
      int fdelimlen
      char *edelim
@@ -207,6 +209,8 @@
  * static prototypes
  */
 static void Ungetc(m_getfld_state_t s);
+static char *find_delim (m_getfld_state_t, char *, size_t);
+static int delim_anchor (const char *, int);
 static int m_Eom (m_getfld_state_t);
 
 #define eom(c,s)	(s->msg_style != MS_DEFAULT && \
@@ -222,6 +226,14 @@ static int m_Eom (m_getfld_state_t);
 
 /* This replaces the old approach, with its direct access to stdio
  * internals.  It uses one fread() to load a buffer that we manage.
+ * A regular file with more than MSG_INPUT_SIZE bytes left to read is
+ * instead mapped into memory in its entirety, so the parser works
+ * straight from the page cache without copying it through the buffer,
+ * if the caller has said with m_getfld_map_input() that it's safe to.
+ * Reading a page of a mapped file that has since been truncated raises
+ * SIGBUS, so that's only for a file the caller has locked, such as a
+ * maildrop that inc is reading, and not for one that another process
+ * might be rewriting, such as the file given to scan -file or burst.
  *
  * MSG_INPUT_SIZE is the size of the buffer.
  * MAX_DELIMITER_SIZE is the maximum size of the delimiter used to
@@ -241,10 +253,20 @@ struct m_getfld_state {
 
     /* Holds content of iob. */
     char msg_buf[2 * MSG_INPUT_SIZE + MAX_DELIMITER_SIZE];
-    /* Points to the next byte to read from msg_buf. */
+    /* The whole of iob if it has been mapped, else NULL. */
+    char *map;
+    /* The length of map. */
+    size_t maplen;
+    /* Whether the caller has iob locked, so that it may be mapped. */
+    bool map_ok;
+    /* Whether mapping iob has been attempted. */
+    bool map_tried;
+    /* The start of the input held in memory:  map or msg_buf. */
+    char *base;
+    /* Points to the next byte to read from base. */
     char *readpos;
-    /* Points to just after the last valid byte in msg_buf.  If readpos
-     * equals end then msg_buf is empty. */
+    /* Points to just after the last valid byte from base.  If readpos
+     * equals end then the input held is exhausted. */
     char *end;
 
     /* Whether the caller intends to ftell(3)/fseek(3) iob's position,
@@ -281,6 +303,9 @@ struct m_getfld_state {
     char *fdelim;
     /* strlen(fdelim). */
     int fdelimlen;
+    /* The index in fdelim of the byte that's least likely to occur in
+     * a message body, and so the one searched for first. */
+    int fdelimanchor;
     /* The second char of msg_delim.  Used when the first char has
      * already been matched to test the rest. */
     char *edelim;
@@ -316,7 +341,10 @@ m_getfld_state_t m_getfld_state_init(FILE *iob)
     m_getfld_state_t s;
 
     NEW(s);
-    s->readpos = s->end = s->msg_buf;
+    s->readpos = s->end = s->base = s->msg_buf;
+    s->map = NULL;
+    s->maplen = 0;
+    s->map_ok = s->map_tried = false;
     s->bytes_read = s->total_bytes_read = 0;
     s->last_caller_pos = s->last_internal_pos = 0;
     s->iob = iob;
@@ -325,6 +353,7 @@ m_getfld_state_t m_getfld_state_init(FILE *iob)
     s->msg_delim = "";
     s->fdelim = s->delimend = s->edelim = NULL;
     s->fdelimlen = s->edelimlen = 0;
+    s->fdelimanchor = 0;
     s->state = FLD;
     s->track_filepos = 0;
 
@@ -353,6 +382,19 @@ m_getfld_track_filepos (m_getfld_state_t *gstate, FILE *iob)
     (*gstate)->track_filepos = 1;
 }
 
+/* If the caller has iob locked, so that it can't be truncated, m_getfld()
+   may map it into memory rather than read it.  This must be called
+   before the first read from iob. */
+void
+m_getfld_map_input (m_getfld_state_t *gstate, FILE *iob)
+{
+    if (! *gstate) {
+	*gstate = m_getfld_state_init(iob);
+    }
+
+    (*gstate)->map_ok = true;
+}
+
 /* m_getfld_track_filepos() with the existing iob. */
 void
 m_getfld_track_filepos2(m_getfld_state_t *gstate)
@@ -373,6 +415,8 @@ m_getfld_state_destroy (m_getfld_state_t *gstate)
 	    free (s->fdelim-1);
 	    free (s->pat_map);
 	}
+	if (s->map)
+	    munmap (s->map, s->maplen);
 	free (s);
 	*gstate = 0;
     }
@@ -433,6 +477,15 @@ enter_getfld (m_getfld_state_t *gstate, FILE *iob)
 
     if ((pos = ftello(iob)) == -1)
         adios("getfld's iob", "failed to get offset on entry");
+    if (s->map) {
+        /* All of the file is at hand, so just move to the caller's
+           position.  iob is already there. */
+        if (pos > (off_t) s->maplen)
+            pos = s->maplen;
+        s->readpos = s->map + pos;
+        s->total_bytes_read = pos;
+        return;
+    }
     if (pos == 0 && s->last_internal_pos == 0)
         return;
 
@@ -450,7 +503,7 @@ enter_getfld (m_getfld_state_t *gstate, FILE *iob)
            Or, this is the first call and the file position
            was not at 0. */
 
-        if (s->readpos + pos_movement >= s->msg_buf  &&
+        if (s->readpos + pos_movement >= s->base  &&
             s->readpos + pos_movement < s->end) {
             /* This is currently unused.  It could be used by
                parse_mime() if it was changed to use a global
@@ -501,6 +554,35 @@ leave_getfld (m_getfld_state_t s)
     }
 }
 
+/* Map iob, from its current position to its end, if it's a regular
+ * file with more left than would fit in one buffer load.  Returns
+ * whether it was mapped, in which case readpos and end cover the
+ * rest of the file. */
+static bool
+map_input (m_getfld_state_t s)
+{
+    struct stat st;
+    off_t pos;
+    void *map;
+
+    if (fstat (fileno (s->iob), &st) == -1  ||  ! S_ISREG (st.st_mode)  ||
+        (pos = ftello (s->iob)) == -1  ||
+        st.st_size - pos <= MSG_INPUT_SIZE  ||
+        (uintmax_t) st.st_size > SIZE_MAX)
+        return false;
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno (s->iob), 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    s->map = s->base = map;
+    s->maplen = st.st_size;
+    s->readpos = s->map + pos;
+    s->end = s->map + s->maplen;
+
+    return true;
+}
+
 static size_t
 read_more (m_getfld_state_t s)
 {
@@ -510,6 +592,15 @@ read_more (m_getfld_state_t s)
     ssize_t retain = s->end - s->msg_buf < s->edelimlen ? 0 : s->edelimlen;
     size_t num_read;
 
+    if (s->map)
+        /* Everything has already been read. */
+        return 0;
+    if (! s->map_tried) {
+        s->map_tried = true;
+        if (s->map_ok  &&  map_input (s))
+            return s->end - s->readpos;
+    }
+
     if (retain > 0) {
         if (retain < s->end - s->readpos)
             retain = s->end - s->readpos;
@@ -552,12 +643,12 @@ Peek (m_getfld_state_t s)
     return c;
 }
 
-/* If there's room, undo the consumption of one character from msg_buf,
- * rewinding so it's read next, else die. */
+/* If there's room, undo the consumption of one character from the
+ * input held, rewinding so it's read next, else die. */
 static void
 Ungetc(m_getfld_state_t s)
 {
-    if (s->readpos == s->msg_buf)
+    if (s->readpos == s->base)
         die("Ungetc() at start of message buffer.");
 
     s->readpos--;
@@ -576,6 +667,15 @@ m_getfld (m_getfld_state_t *gstate, char name[NAMESZ], char *buf, int *bufsz,
     enter_getfld (gstate, iob);
     s = *gstate;
 
+    if (s->state == BODY  &&  *bufsz <= 1) {
+	/* There's only room for the NUL.  Checking for the end of the
+	   message would consume the start of a delimiter that then
+	   couldn't be returned. */
+	*bufsz = *buf = 0;
+	leave_getfld (s);
+	return s->state;
+    }
+
     if ((c = Getc(s)) == EOF) {
 	*bufsz = *buf = 0;
 	leave_getfld (s);
@@ -720,7 +820,7 @@ m_getfld (m_getfld_state_t *gstate, char name[NAMESZ], char *buf, int *bufsz,
 		       we'll jump right to the FLDPLUS handling code,
 		       which will not store that character, but
 		       instead move on to the next one. */
-		    if (s->readpos > s->msg_buf) {
+		    if (s->readpos > s->base) {
 			--s->readpos;
 			--s->bytes_read;
 		    }
@@ -769,7 +869,7 @@ m_getfld (m_getfld_state_t *gstate, char name[NAMESZ], char *buf, int *bufsz,
 		 */
 		char *ep;
 
-                if ((ep = memmem(bp, c, s->fdelim, s->fdelimlen)))
+                if ((ep = find_delim (s, bp, c)))
                     /* Plus one to nab the '\n' that starts fdelim as
                      * that ends the previous line;  it isn't part of
                      * msg_delim. */
@@ -929,6 +1029,7 @@ m_unknown(m_getfld_state_t *gstate, FILE *iob)
     s->delimend = s->msg_delim + s->edelimlen;
     if (s->edelimlen <= 1)
 	die("maildrop delimiter must be at least 2 bytes");
+    s->fdelimanchor = delim_anchor (s->fdelim, s->fdelimlen);
 
     /*
      * build a Boyer-Moore end-position map for the matcher in m_getfld.
@@ -964,6 +1065,76 @@ m_unknown2(m_getfld_state_t *gstate)
 }
 
 
+/*
+ * Return the first occurrence of fdelim in the len bytes at bp, or
+ * NULL.  Rather than try every position, this lets memchr(3), which
+ * C libraries vectorise, skip to each occurrence of the anchor byte,
+ * which is chosen to be rare in message bodies, e.g. the 'F' of
+ * "\nFrom " or the ^A of MMDF's delimiter.
+ */
+static char *
+find_delim (m_getfld_state_t s, char *bp, size_t len)
+{
+    size_t anchor = s->fdelimanchor;
+    size_t dlen = s->fdelimlen;
+    char *cp, *ep;
+
+    if (len < dlen)
+	return NULL;
+
+    /* The anchor can be no further on than this and still have all of
+     * the delimiter in the buffer. */
+    ep = bp + len - dlen + anchor;
+
+    for (cp = bp + anchor;
+	 (cp = memchr (cp, s->fdelim[anchor], ep - cp + 1));
+	 cp++) {
+	if (memcmp (cp - anchor, s->fdelim, dlen) == 0)
+	    return cp - anchor;
+	if (cp == ep)
+	    break;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Choose the byte of the delimiter to search for first:  the first
+ * control character, else the first that's neither alphanumeric nor
+ * space, else the first capital letter, else the first byte.
+ */
+static int
+delim_anchor (const char *delim, int len)
+{
+    int best = 0, bestrank = 4;
+    int i;
+
+    for (i = 0; i < len; i++) {
+	unsigned char c = delim[i];
+	int rank;
+
+	if (c == '\n' || c == ' ' || c == '\t')
+	    rank = 3;
+	else if (iscntrl (c))
+	    rank = 0;
+	else if (! isalnum (c))
+	    rank = 1;
+	else if (isupper (c))
+	    rank = 2;
+	else
+	    continue;
+
+	if (rank < bestrank) {
+	    best = i;
+	    bestrank = rank;
+	}
+    }
+
+    return best;
+}
+
+
 /*
  * test for msg delimiter string
  */
@@ -8,6 +8,7 @@ m_getfld_state_t m_getfld_state_init(FILE *);
 void m_getfld_state_reset(m_getfld_state_t *);
 void m_getfld_track_filepos(m_getfld_state_t *, FILE *);
 void m_getfld_track_filepos2(m_getfld_state_t *);
+void m_getfld_map_input(m_getfld_state_t *, FILE *);
 void m_getfld_state_destroy(m_getfld_state_t *);
 int m_getfld(m_getfld_state_t *, char[NAMESZ], char *, int *, FILE *);
 int m_getfld2(m_getfld_state_t *, char[NAMESZ], char *, int *);
@@ -12,6 +12,7 @@
 #include "trimcpy.h"
 #include "getcpy.h"
 #include "readconfig.h"
+#include "context_index.h"
 #include "error.h"
 #include "h/utils.h"
 
@@ -25,6 +26,9 @@ struct procstr {
 static struct procstr procs[] = {
     { "context",       &context },
     { "mh-sequences",  &mh_seq },
+    { "mh-sequences-journal", &mh_seq_journal },
+    { "mh-index",      &mh_index },
+    { "mh-summary",    &mh_summary },
     { "buildmimeproc", &buildmimeproc },
     { "fileproc",      &fileproc },
     { "formatproc",    &formatproc },
@@ -132,6 +136,7 @@ readconfig (struct node **npp, FILE *ib, const char *file, int ctx)
     }
 
     opp = npp;
+    context_index_reset ();
 }
 
 
@@ -0,0 +1,521 @@
+/* seq_file.c -- the public sequence file of a folder, and its journal
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information.
+ */
+
+#include "h/mh.h"
+#include "seq_file.h"
+#include "m_getfld.h"
+#include "brkstring.h"
+#include "m_atoi.h"
+#include "error.h"
+#include "lock_file.h"
+#include "m_mktemp.h"
+#include "seq_msgs.h"
+#include "h/utils.h"
+#include <inttypes.h>
+
+/*
+ * Rewriting the sequence file costs time in proportion to all of its
+ * sequences, however little has changed.  So if the user names a
+ * journal with the "mh-sequences-journal" profile entry, small changes
+ * are appended to it instead, and replayed over the sequence file
+ * whenever it's read:
+ *
+ *	nmh-sequences-journal 1 <inode> <size> <mtime> [<nsec>]
+ *	+<name>: <ranges>
+ *	-<name>: <ranges>
+ *	...
+ *
+ * The header gives the status of the sequence file that the journal
+ * was started against, with the nanoseconds of its mtime where the
+ * system keeps them, since a rewrite can fall within the same second;  if another program rewrites the file, the
+ * journal no longer applies, and is ignored.  Each record adds or
+ * removes ranges of messages from a sequence.  Once the journal would
+ * be more than half the size of the sequence file, the file is
+ * rewritten in its usual form and the journal removed, so other MH
+ * programs always find a plain sequence file, if one that may lag.
+ *
+ * Both are only changed with the sequence file locked.
+ */
+
+#define JOURNAL_MAGIC "nmh-sequences-journal 1"
+
+static rvector_t seq_file_set (struct seq_file *, const char *);
+static rvector_t seq_file_find (struct seq_file *, const char *);
+static void replay_journal (struct seq_file *, const char *);
+static void add_records (charstring_t, struct seq_file *, struct seq_file *);
+static bool append_journal (struct seq_file *, struct seq_file *,
+			    const char *, charstring_t);
+static size_t put_runs (charstring_t, rvector_t, rvector_t);
+
+
+struct seq_file *
+seq_file_create (void)
+{
+    struct seq_file *sf;
+
+    NEW0(sf);
+    sf->names = svector_create (8);
+
+    return sf;
+}
+
+
+struct seq_file *
+seq_file_read (FILE *fp, const char *path, const char *foldpath)
+{
+    struct seq_file *sf = seq_file_create ();
+    int state;
+    char *cp, name[NAMESZ], field[NMH_BUFSIZ], jpath[PATH_MAX];
+    m_getfld_state_t gstate;
+    rvector_t set;
+    struct stat st;
+
+    /* Use m_getfld2 to scan sequence file */
+    gstate = m_getfld_state_init(fp);
+    for (;;) {
+	int fieldsz = sizeof field;
+	switch (state = m_getfld2(&gstate, name, field, &fieldsz)) {
+	    case FLD:
+	    case FLDPLUS:
+		cp = mh_xstrdup(field);
+		while (state == FLDPLUS) {
+		    fieldsz = sizeof field;
+		    state = m_getfld2(&gstate, name, field, &fieldsz);
+		    cp = add (field, cp);
+		}
+		/* A sequence given twice takes its last value. */
+		set = seq_file_set (sf, name);
+		rvector_clear_all (set);
+		seq_file_parse (set, cp);
+		free (cp);
+		continue;
+
+	    case BODY:
+		lkfclosedata (fp, path);
+		die("no blank lines are permitted in %s", path);
+		break;
+
+	    case FILEEOF:
+		break;
+
+	    default:
+		lkfclosedata (fp, path);
+		die("%s is poorly formatted", path);
+	}
+	break;	/* break from for loop */
+    }
+    m_getfld_state_destroy (&gstate);
+
+    if (fstat (fileno (fp), &st) == 0) {
+	sf->ino = st.st_ino;
+	sf->size = st.st_size;
+	sf->mtime = st.st_mtime;
+	sf->mtime_nsec = MTIME_NSEC (st);
+    }
+
+    if (mh_seq_journal && *mh_seq_journal) {
+	snprintf (jpath, sizeof jpath, "%s/%s", foldpath, mh_seq_journal);
+	replay_journal (sf, jpath);
+    }
+
+    return sf;
+}
+
+
+/*
+ * Apply the records of the journal that were completely written.  The
+ * size of what's applied is kept, so that a damaged journal is seen to
+ * differ from it, and is not appended to.
+ */
+
+static void
+replay_journal (struct seq_file *sf, const char *jpath)
+{
+    FILE *fp;
+    char *line = NULL, *cp;
+    size_t len = 0;
+    ssize_t n;
+    intmax_t ino, size, mtime;
+    long nsec;
+    int fields;
+    off_t jsize;
+    rvector_t set, drop;
+    int lo, hi;
+
+    if ((fp = fopen (jpath, "r")) == NULL)
+	return;
+
+    /* A header without nanoseconds is from where they aren't known. */
+    if ((n = getline (&line, &len, fp)) == -1  ||
+	(fields = sscanf (line, JOURNAL_MAGIC " %" SCNdMAX " %" SCNdMAX
+			  " %" SCNdMAX " %ld", &ino, &size, &mtime, &nsec)) < 3  ||
+	ino != (intmax_t) sf->ino  ||  size != (intmax_t) sf->size  ||
+	mtime != (intmax_t) sf->mtime  ||
+	(fields == 4  &&  nsec != sf->mtime_nsec)) {
+	free (line);
+	fclose (fp);
+	return;
+    }
+    jsize = n;
+
+    drop = rvector_create ();
+    while ((n = getline (&line, &len, fp)) != -1) {
+	if (line[n - 1] != '\n'  ||  (*line != '+'  &&  *line != '-')  ||
+	    (cp = strchr (line, ':')) == NULL  ||  cp == line + 1)
+	    break;
+	*cp++ = '\0';
+
+	if (*line == '+') {
+	    seq_file_parse (seq_file_set (sf, line + 1), cp);
+	} else if ((set = seq_file_find (sf, line + 1))) {
+	    rvector_clear_all (drop);
+	    seq_file_parse (drop, cp);
+	    for (lo = rvector_next (drop, 1, &hi); lo;
+		 lo = rvector_next (drop, hi + 1, &hi))
+		rvector_clear_range (set, lo, hi);
+	}
+	jsize += n;
+    }
+    rvector_free (drop);
+
+    free (line);
+    fclose (fp);
+    sf->jsize = jsize;
+}
+
+
+/*
+ * The runs are taken from the folder's own set, without making a list
+ * of them to parse again.
+ */
+
+void
+seq_file_add (struct seq_file *sf, struct msgs *mp, size_t i)
+{
+    char *name = svector_at (mp->msgattrs, i);
+    rvector_t seq, set = NULL;
+    int msgnum, hi, start;
+
+    if (!strcmp (current, name)) {
+	if (mp->curmsg)
+	    rvector_set (seq_file_set (sf, name), mp->curmsg);
+	return;
+    }
+    if (mp->nummsg == 0)
+	return;
+
+    seq = seq_msgs (mp, i);
+    for (msgnum = rvector_next (seq, mp->lowmsg, &hi);
+	 msgnum && msgnum <= mp->hghmsg;
+	 msgnum = rvector_next (seq, hi + 1, &hi)) {
+	hi = min (hi, mp->hghmsg);
+	while (msgnum <= hi) {
+	    while (msgnum <= hi && !does_exist (mp, msgnum))
+		msgnum++;
+	    for (start = msgnum; msgnum <= hi && does_exist (mp, msgnum); )
+		msgnum++;
+	    if (start < msgnum) {
+		if (!set)
+		    set = seq_file_set (sf, name);
+		rvector_set_range (set, start, msgnum - 1);
+	    }
+	}
+    }
+}
+
+
+/*
+ * Each range is a message number, or two joined by a hyphen, and is
+ * ignored if it isn't, just as when the file was parsed a message at
+ * a time.
+ */
+
+void
+seq_file_parse (rvector_t set, const char *ranges)
+{
+    char *copy, *cp, **ap;
+    int lo, hi;
+
+    copy = mh_xstrdup (ranges);
+    for (ap = brkstring (copy, " ", "\n"); *ap; ap++) {
+	if ((cp = strchr (*ap, '-')))
+	    *cp++ = '\0';
+	if ((lo = m_atoi (*ap)) > 0) {
+	    hi = cp ? m_atoi (cp) : lo;
+	    rvector_set_range (set, lo, hi);
+	}
+    }
+    free (copy);
+}
+
+
+char *
+seq_file_list (struct seq_file *sf, size_t i)
+{
+    charstring_t list = charstring_create (0);
+    char *cp;
+
+    put_runs (list, sf->sets[i], NULL);
+    cp = charstring_buffer_copy (list);
+    charstring_free (list);
+
+    return cp;
+}
+
+
+void
+seq_file_save (struct seq_file *old, struct seq_file *sf, FILE *fp,
+	       const char *foldpath)
+{
+    char seqfile[PATH_MAX], jpath[PATH_MAX], *cp;
+    charstring_t records;
+    struct stat st;
+    size_t i;
+    bool any = false, appended;
+
+    snprintf (seqfile, sizeof seqfile, "%s/%s", foldpath, mh_seq);
+
+    if (mh_seq_journal && *mh_seq_journal) {
+	snprintf (jpath, sizeof jpath, "%s/%s", foldpath, mh_seq_journal);
+
+	records = charstring_create (0);
+	add_records (records, old, sf);
+	appended = append_journal (old, sf, jpath, records);
+	charstring_free (records);
+	if (appended)
+	    return;
+
+	/* The journal is removed first, so that it's never replayed
+	 * over the rewritten file. */
+	(void) m_unlink (jpath);
+    }
+
+    rewind (fp);
+    if (ftruncate (fileno (fp), 0) < 0)
+	advise ("sequence file", "ftruncate");
+    for (i = 0; i < svector_size (sf->names); i++) {
+	cp = seq_file_list (sf, i);
+	if (*cp) {
+	    fprintf (fp, "%s: %s\n", svector_at (sf->names, i), cp);
+	    any = true;
+	}
+	free (cp);
+    }
+    fflush (fp);
+
+    if (!any) {
+	(void) m_unlink (seqfile);
+    } else if (fstat (fileno (fp), &st) == 0) {
+	sf->ino = st.st_ino;
+	sf->size = st.st_size;
+	sf->mtime = st.st_mtime;
+	sf->mtime_nsec = MTIME_NSEC (st);
+    }
+    sf->jsize = 0;
+}
+
+
+/*
+ * Add the records that take the sequences in old to those in sf.
+ */
+
+static void
+add_records (charstring_t records, struct seq_file *old,
+	     struct seq_file *sf)
+{
+    charstring_t runs = charstring_create (0);
+    rvector_t set;
+    size_t i;
+    char *name;
+
+    for (i = 0; i < svector_size (sf->names); i++) {
+	name = svector_at (sf->names, i);
+	set = seq_file_find (old, name);
+
+	charstring_clear (runs);
+	if (put_runs (runs, sf->sets[i], set)) {
+	    charstring_push_back (records, '+');
+	    charstring_append_cstring (records, name);
+	    charstring_append_cstring (records, ": ");
+	    charstring_append (records, runs);
+	    charstring_push_back (records, '\n');
+	}
+
+	charstring_clear (runs);
+	if (set  &&  put_runs (runs, set, sf->sets[i])) {
+	    charstring_push_back (records, '-');
+	    charstring_append_cstring (records, name);
+	    charstring_append_cstring (records, ": ");
+	    charstring_append (records, runs);
+	    charstring_push_back (records, '\n');
+	}
+    }
+
+    /* Sequences that are no longer public. */
+    for (i = 0; i < svector_size (old->names); i++) {
+	name = svector_at (old->names, i);
+	if (seq_file_find (sf, name))
+	    continue;
+
+	charstring_clear (runs);
+	if (put_runs (runs, old->sets[i], NULL)) {
+	    charstring_push_back (records, '-');
+	    charstring_append_cstring (records, name);
+	    charstring_append_cstring (records, ": ");
+	    charstring_append (records, runs);
+	    charstring_push_back (records, '\n');
+	}
+    }
+
+    charstring_free (runs);
+}
+
+
+/*
+ * Append records to the journal if the sequence file and journal are
+ * still those that old was read from, and the journal would stay small
+ * enough;  if there are no records, there's nothing to write.  Returns
+ * false if the sequence file should be rewritten instead.
+ */
+
+static bool
+append_journal (struct seq_file *old, struct seq_file *sf,
+		const char *jpath, charstring_t records)
+{
+    struct stat st;
+    char header[BUFSIZ];
+    off_t jsize;
+    FILE *fp;
+    bool failed;
+
+    if (stat (jpath, &st) == 0 ? st.st_size != old->jsize : old->jsize != 0)
+	return false;
+    jsize = old->jsize;
+
+    if (charstring_bytes (records) == 0)
+	goto unchanged;
+
+    header[0] = '\0';
+    if (old->jsize == 0 && old->mtime_nsec < 0)
+	snprintf (header, sizeof header,
+		  JOURNAL_MAGIC " %" PRIdMAX " %" PRIdMAX " %" PRIdMAX "\n",
+		  (intmax_t) old->ino, (intmax_t) old->size,
+		  (intmax_t) old->mtime);
+    else if (old->jsize == 0)
+	snprintf (header, sizeof header,
+		  JOURNAL_MAGIC " %" PRIdMAX " %" PRIdMAX " %" PRIdMAX " %ld\n",
+		  (intmax_t) old->ino, (intmax_t) old->size,
+		  (intmax_t) old->mtime, old->mtime_nsec);
+    jsize = old->jsize + strlen (header) + charstring_bytes (records);
+    if (jsize > old->size / 2)
+	return false;
+
+    if ((fp = fopen (jpath, old->jsize ? "a" : "w")) == NULL)
+	return false;
+    fputs (header, fp);
+    fputs (charstring_buffer (records), fp);
+    failed = ferror (fp);
+    if (fclose (fp) == EOF)
+	failed = true;
+    if (failed)
+	return false;
+
+unchanged:
+    sf->ino = old->ino;
+    sf->size = old->size;
+    sf->mtime = old->mtime;
+    sf->mtime_nsec = old->mtime_nsec;
+    sf->jsize = jsize;
+
+    return true;
+}
+
+
+/*
+ * Append the runs of set that aren't in minus, which may be NULL, to
+ * list, separated by spaces.  Returns the number of runs.
+ */
+
+static size_t
+put_runs (charstring_t list, rvector_t set, rvector_t minus)
+{
+    char buf[2 * BUFSIZ];
+    int lo, hi, end, next, nhi;
+    size_t n = 0;
+
+    for (lo = rvector_next (set, 1, &hi); lo;
+	 lo = rvector_next (set, hi + 1, &hi)) {
+	for (; lo <= hi; lo = nhi + 1) {
+	    if (minus == NULL  ||  (next = rvector_next (minus, lo, &nhi)) == 0
+		||  next > hi) {
+		end = hi;
+		nhi = hi;
+	    } else {
+		end = next - 1;
+		if (nhi > hi)
+		    nhi = hi;
+	    }
+	    if (end < lo)
+		continue;
+
+	    if (lo == end)
+		snprintf (buf, sizeof buf, "%s%d", n ? " " : "", lo);
+	    else
+		snprintf (buf, sizeof buf, "%s%d-%d", n ? " " : "", lo, end);
+	    charstring_append_cstring (list, buf);
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+
+/* Return the set for sequence name, adding an empty one if it's new. */
+
+static rvector_t
+seq_file_set (struct seq_file *sf, const char *name)
+{
+    rvector_t set;
+    size_t n;
+
+    if ((set = seq_file_find (sf, name)))
+	return set;
+
+    svector_push_back (sf->names, mh_xstrdup (name));
+    n = svector_size (sf->names);
+    sf->sets = mh_xrealloc (sf->sets, n * sizeof *sf->sets);
+
+    return sf->sets[n - 1] = rvector_create ();
+}
+
+
+static rvector_t
+seq_file_find (struct seq_file *sf, const char *name)
+{
+    char **slot = svector_find (sf->names, name);
+
+    return slot ? sf->sets[slot - svector_strs (sf->names)] : NULL;
+}
+
+
+void
+seq_file_free (struct seq_file *sf)
+{
+    size_t i;
+
+    if (sf == NULL)
+	return;
+
+    for (i = 0; i < svector_size (sf->names); i++) {
+	free (svector_at (sf->names, i));
+	rvector_free (sf->sets[i]);
+    }
+    free (sf->sets);
+    svector_free (sf->names);
+    free (sf);
+}
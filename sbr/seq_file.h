@@ -0,0 +1,59 @@
+/* seq_file.h -- the public sequence file of a folder, and its journal
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information. */
+
+/*
+ * The public sequences as the sequence file, with its journal replayed
+ * over it, gives them.  Each set holds the message numbers written,
+ * whether or not the messages exist;  an empty set is a sequence that
+ * isn't in the file.  ino, size, and mtime (with mtime_nsec, its
+ * nanoseconds where known) are the sequence file's status when it was read, which a journal must have been started
+ * against to apply to it.
+ */
+struct seq_file {
+    svector_t names;
+    rvector_t *sets;		/* indexed like names              */
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    off_t jsize;		/* bytes of journal replayed, or 0 */
+};
+
+struct seq_file *seq_file_create(void);
+
+/*
+ * Read the public sequences from fp, the open and locked sequence file
+ * named path in folder foldpath.  If the "mh-sequences-journal" profile
+ * entry is set, its journal is replayed over them.  Dies if the
+ * sequence file is poorly formatted.
+ */
+struct seq_file *seq_file_read(FILE *, const char *, const char *)
+    NONNULL(1, 2, 3);
+
+/*
+ * Add sequence i of mp, with the messages that seq_list() would list
+ * for it, if there are any.
+ */
+void seq_file_add(struct seq_file *, struct msgs *, size_t) NONNULL(1, 2);
+
+/* Add the messages in ranges, such as "1-3 7", to set. */
+void seq_file_parse(rvector_t, const char *) NONNULL(1, 2);
+
+/* Return sequence i of sf as a list of ranges, which the caller frees. */
+char *seq_file_list(struct seq_file *, size_t) NONNULL(1);
+
+/*
+ * Write the public sequences in sf to fp, the open and locked sequence
+ * file of folder foldpath, which old was read from.  If the journal is
+ * enabled, and the changes from old are small compared to the file,
+ * they're appended to the journal instead.  Otherwise the file is
+ * rewritten, or removed if sf has no sequences, and the journal is
+ * removed.
+ */
+void seq_file_save(struct seq_file *, struct seq_file *, FILE *,
+    const char *) NONNULL(1, 2, 3, 4);
+
+void seq_file_free(struct seq_file *);
@@ -10,6 +10,7 @@
 #include "m_name.h"
 #include "seq_list.h"
 #include "seq_getnum.h"
+#include "seq_msgs.h"
 #include "h/utils.h"
 
 /* allocate this much buffer space at a time */
@@ -23,8 +24,9 @@ static int len = 0;
 char *
 seq_list(struct msgs *mp, char *seqname)
 {
-    int i, j, seqnum;
+    int i, j, hi, seqnum;
     char *bp;
+    rvector_t seq;
 
     /* On first invocation, allocate initial buffer space */
     if (!buffer) {
@@ -56,51 +58,59 @@ seq_list(struct msgs *mp, char *seqname)
 
     bp = buffer;
 
-    for (i = mp->lowmsg; i <= mp->hghmsg; ++i) {
-	/*
-	 * If message doesn't exist, or isn't in
-	 * the sequence, then continue.
-	 */
-	if (!does_exist(mp, i) || !in_sequence(mp, seqnum, i))
-	    continue;
-
-	/*
-	 * See if we need to enlarge buffer.  Since we don't know
-	 * exactly how many character this particular message range
-	 * will need, we enlarge the buffer if we are within
-	 * 50 characters of the end.
-	 */
-	if (bp - buffer > len - 50) {
-	    char *newbuf;
-
-	    len += MAXBUFFER;
-	    newbuf = mh_xrealloc (buffer, (size_t) len);
-	    bp = newbuf + (bp - buffer);
-	    buffer = newbuf;
-	}
-
-	/*
-	 * If this is not the first message range in
-	 * the list, first add a space.
-	 */
-	if (bp > buffer)
-	    *bp++ = ' ';
-
-	strcpy(bp, m_name(i));
-	bp += strlen(bp);
-	j = i;			/* Remember beginning of message range */
-
-	/*
-	 * Scan to the end of this message range
-	 */
-	for (++i; i <= mp->hghmsg && does_exist(mp, i) && in_sequence(mp, seqnum, i);
-	     ++i)
-	    ;
-
-	if (i - j > 1) {
-            *bp++ = '-';
-	    strcpy(bp, m_name(i - 1));
+    /*
+     * Walk the runs of the sequence that lie in the folder, rather
+     * than every message.  Messages that have gone since they were
+     * added break a run up.
+     */
+    seq = seq_msgs (mp, seqnum);
+    for (i = rvector_next (seq, mp->lowmsg, &hi); i && i <= mp->hghmsg;
+	 i = rvector_next (seq, hi + 1, &hi)) {
+	hi = min (hi, mp->hghmsg);
+	for (; i <= hi; ++i) {
+	    /*
+	     * If message doesn't exist, then continue.
+	     */
+	    if (!does_exist(mp, i))
+		continue;
+
+	    /*
+	     * See if we need to enlarge buffer.  Since we don't know
+	     * exactly how many character this particular message range
+	     * will need, we enlarge the buffer if we are within
+	     * 50 characters of the end.
+	     */
+	    if (bp - buffer > len - 50) {
+		char *newbuf;
+
+		len += MAXBUFFER;
+		newbuf = mh_xrealloc (buffer, (size_t) len);
+		bp = newbuf + (bp - buffer);
+		buffer = newbuf;
+	    }
+
+	    /*
+	     * If this is not the first message range in
+	     * the list, first add a space.
+	     */
+	    if (bp > buffer)
+		*bp++ = ' ';
+
+	    strcpy(bp, m_name(i));
 	    bp += strlen(bp);
+	    j = i;			/* Remember beginning of message range */
+
+	    /*
+	     * Scan to the end of this message range
+	     */
+	    for (++i; i <= hi && does_exist(mp, i); ++i)
+		;
+
+	    if (i - j > 1) {
+		*bp++ = '-';
+		strcpy(bp, m_name(i - 1));
+		bp += strlen(bp);
+	    }
 	}
     }
     return bp > buffer ? buffer : NULL;
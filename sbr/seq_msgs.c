@@ -0,0 +1,183 @@
+/* seq_msgs.c -- the messages in each sequence of a folder
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information.
+ */
+
+#include "h/mh.h"
+#include "seq_msgs.h"
+#include "h/utils.h"
+
+
+/*
+ * Return the set of messages in sequence seqnum, creating it, empty,
+ * if the sequence is new.
+ */
+
+rvector_t
+seq_msgs (struct msgs *mp, size_t seqnum)
+{
+    size_t i;
+
+    if (seqnum >= mp->num_msgseqs) {
+	i = mp->num_msgseqs;
+	mp->num_msgseqs = seqnum + 1;
+	mp->msgseqs = mh_xrealloc (mp->msgseqs,
+				   mp->num_msgseqs * sizeof *mp->msgseqs);
+	for (; i < mp->num_msgseqs; i++)
+	    mp->msgseqs[i] = rvector_create ();
+    }
+
+    return mp->msgseqs[seqnum];
+}
+
+
+/*
+ * Add the messages from lo to hi that exist to sequence seqnum.
+ * Each unbroken run of them is added in one go.
+ */
+
+void
+seq_msgs_add (struct msgs *mp, size_t seqnum, int lo, int hi)
+{
+    rvector_t seq = seq_msgs (mp, seqnum);
+    int msgnum, start;
+
+    lo = max (lo, mp->lowmsg);
+    hi = min (hi, mp->hghmsg);
+
+    for (msgnum = lo; msgnum <= hi; ) {
+	while (msgnum <= hi && !does_exist (mp, msgnum))
+	    msgnum++;
+	for (start = msgnum; msgnum <= hi && does_exist (mp, msgnum); )
+	    msgnum++;
+	rvector_set_range (seq, start, msgnum - 1);
+    }
+}
+
+
+/*
+ * Return the number of messages in sequence seqnum that exist,
+ * counting a run at a time.
+ */
+
+int
+seq_count (struct msgs *mp, size_t seqnum)
+{
+    rvector_t seq = seq_msgs (mp, seqnum);
+    int msgnum, hi, count = 0;
+
+    for (msgnum = rvector_next (seq, mp->lowmsg, &hi);
+	 msgnum && msgnum <= mp->hghmsg;
+	 msgnum = rvector_next (seq, hi + 1, &hi)) {
+	hi = min (hi, mp->hghmsg);
+	for (; msgnum <= hi; msgnum++)
+	    if (does_exist (mp, msgnum))
+		count++;
+    }
+
+    return count;
+}
+
+
+/*
+ * The rest move a message's sequences along with its other flags; see
+ * clear_msg_flags() and friends in h/mh.h.  A bvector holding all of a
+ * message's flags has sequence seqnum at bit FFATTRSLOT + seqnum.
+ */
+
+void
+seq_clear_msg (struct msgs *mp, int msgnum)
+{
+    size_t i;
+
+    for (i = 0; i < mp->num_msgseqs; i++)
+	rvector_clear (mp->msgseqs[i], msgnum);
+}
+
+void
+seq_copy_msg (struct msgs *mp, int to, int from)
+{
+    size_t i;
+
+    for (i = 0; i < mp->num_msgseqs; i++) {
+	if (rvector_at (mp->msgseqs[i], from))
+	    rvector_set (mp->msgseqs[i], to);
+	else
+	    rvector_clear (mp->msgseqs[i], to);
+    }
+}
+
+void
+seq_get_msg (struct msgs *mp, bvector_t flags, int msgnum)
+{
+    size_t i;
+
+    for (i = 0; i < mp->num_msgseqs; i++) {
+	if (rvector_at (mp->msgseqs[i], msgnum))
+	    bvector_set (flags, FFATTRSLOT + i);
+	else
+	    bvector_clear (flags, FFATTRSLOT + i);
+    }
+}
+
+void
+seq_set_msg (struct msgs *mp, bvector_t flags, int msgnum)
+{
+    size_t i;
+
+    for (i = 0; i < mp->num_msgseqs; i++) {
+	if (bvector_at (flags, FFATTRSLOT + i))
+	    rvector_set (mp->msgseqs[i], msgnum);
+	else
+	    rvector_clear (mp->msgseqs[i], msgnum);
+	/* Only the sets hold sequence membership. */
+	bvector_clear (msgstat (mp, msgnum), FFATTRSLOT + i);
+    }
+}
+
+
+/*
+ * Renumber the messages from lo to hi in every sequence at once:
+ * message n takes the sequences that message from[n - lo] was in.
+ * Each sequence is built again in one ascending pass, so a whole
+ * folder can be reordered without moving its runs a message at a time.
+ */
+
+void
+seq_permute (struct msgs *mp, int lo, int hi, const int *from)
+{
+    rvector_t old, new;
+    size_t i;
+    int msgnum, end, start;
+
+    for (i = 0; i < mp->num_msgseqs; i++) {
+	old = mp->msgseqs[i];
+	new = rvector_create ();
+
+	for (msgnum = rvector_next (old, 1, &end);
+	     msgnum && msgnum < lo;
+	     msgnum = rvector_next (old, end + 1, &end))
+	    rvector_set_range (new, msgnum, min (end, lo - 1));
+
+	for (msgnum = lo, start = 0; msgnum <= hi; msgnum++) {
+	    if (rvector_at (old, from[msgnum - lo])) {
+		if (!start)
+		    start = msgnum;
+	    } else if (start) {
+		rvector_set_range (new, start, msgnum - 1);
+		start = 0;
+	    }
+	}
+	if (start)
+	    rvector_set_range (new, start, hi);
+
+	for (msgnum = rvector_next (old, hi + 1, &end); msgnum;
+	     msgnum = rvector_next (old, end + 1, &end))
+	    rvector_set_range (new, msgnum, end);
+
+	rvector_free (old);
+	mp->msgseqs[i] = new;
+    }
+}
@@ -0,0 +1,14 @@
+/* seq_msgs.h -- the messages in each sequence of a folder
+ *
+ * This code is Copyright (c) 2019, by the authors of nmh.  See the
+ * COPYRIGHT file in the root directory of the nmh distribution for
+ * complete copyright information. */
+
+rvector_t seq_msgs(struct msgs *, size_t) NONNULL(1);
+void seq_msgs_add(struct msgs *, size_t, int, int) NONNULL(1);
+int seq_count(struct msgs *, size_t) NONNULL(1);
+void seq_clear_msg(struct msgs *, int) NONNULL(1);
+void seq_copy_msg(struct msgs *, int, int) NONNULL(1);
+void seq_get_msg(struct msgs *, bvector_t, int) NONNULL(1, 2);
+void seq_set_msg(struct msgs *, bvector_t, int) NONNULL(1, 2);
+void seq_permute(struct msgs *, int, int, const int *) NONNULL(1, 4);
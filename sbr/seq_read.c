@@ -7,22 +7,19 @@
  */
 
 #include "h/mh.h"
-#include "m_getfld.h"
 #include "seq_read.h"
+#include "seq_file.h"
 #include "ssequal.h"
-#include "trimcpy.h"
 #include "getcpy.h"
-#include "m_atoi.h"
-#include "brkstring.h"
-#include "error.h"
 #include "h/utils.h"
 #include "lock_file.h"
+#include "seq_msgs.h"
 
 /*
  * static prototypes
  */
-static int seq_init (struct msgs *, char *, char *);
-static int seq_public (struct msgs *, int, int *);
+static int seq_init (struct msgs *, char *, rvector_t);
+static int seq_public (struct msgs *, int, bool, int *);
 static void seq_private (struct msgs *);
 
 
@@ -33,7 +30,7 @@ static void seq_private (struct msgs *);
  */
 
 int
-seq_read (struct msgs *mp, int lockflag)
+seq_read (struct msgs *mp, int lockflag, bool peek)
 {
     int failed_to_lock = 0;
 
@@ -49,7 +46,7 @@ seq_read (struct msgs *mp, int lockflag)
 	return OK;
 
     /* Initialize the public sequences */
-    if (seq_public (mp, lockflag, &failed_to_lock) == NOTOK) {
+    if (seq_public (mp, lockflag, peek, &failed_to_lock) == NOTOK) {
 	if (failed_to_lock) return NOTOK;
     }
 
@@ -65,13 +62,14 @@ seq_read (struct msgs *mp, int lockflag)
  */
 
 static int
-seq_public (struct msgs *mp, int lockflag, int *failed_to_lock)
+seq_public (struct msgs *mp, int lockflag, bool peek, int *failed_to_lock)
 {
-    int state;
-    char *cp, seqfile[PATH_MAX];
-    char name[NAMESZ], field[NMH_BUFSIZ];
+    char seqfile[PATH_MAX];
     FILE *fp;
-    m_getfld_state_t gstate;
+    struct stat st;
+    struct seq_file *sf;
+    size_t i;
+    int hi;
 
     /*
      * If mh_seq == NULL or if *mh_seq == '\0' (the user has defined
@@ -84,46 +82,36 @@ seq_public (struct msgs *mp, int lockflag, int *failed_to_lock)
     /* get filename of sequence file */
     snprintf (seqfile, sizeof(seqfile), "%s/%s", mp->foldpath, mh_seq);
 
-    if ((fp = lkfopendata (seqfile, lockflag ? "r+" : "r", failed_to_lock))
-	== NULL)
-	return NOTOK;
-
-    /* Use m_getfld2 to scan sequence file */
-    gstate = m_getfld_state_init(fp);
-    for (;;) {
-	int fieldsz = sizeof field;
-	switch (state = m_getfld2(&gstate, name, field, &fieldsz)) {
-	    case FLD: 
-	    case FLDPLUS:
-		if (state == FLDPLUS) {
-		    cp = mh_xstrdup(field);
-		    while (state == FLDPLUS) {
-			fieldsz = sizeof field;
-			state = m_getfld2(&gstate, name, field, &fieldsz);
-			cp = add (field, cp);
-		    }
-		    seq_init (mp, mh_xstrdup(name), trimcpy (cp));
-		    free (cp);
-		} else {
-		    seq_init (mp, mh_xstrdup(name), trimcpy (field));
-		}
-		continue;
-
-	    case BODY:
-		lkfclosedata (fp, seqfile);
-		die("no blank lines are permitted in %s", seqfile);
-		break;
-
-	    case FILEEOF:
-		break;
-
-	    default: 
-		lkfclosedata (fp, seqfile);
-		die("%s is poorly formatted", seqfile);
+    if (peek && !lockflag) {
+	if ((fp = lkfpeekdata (seqfile, &st, failed_to_lock)) == NULL)
+	    return NOTOK;
+	sf = seq_file_read (fp, seqfile, mp->foldpath);
+	if (lkfpeekchanged (fp, seqfile, &st)) {
+	    /* Written while we read it, so read it again, locked. */
+	    seq_file_free (sf);
+	    lkfclosedata (fp, seqfile);
+	    peek = false;
 	}
-	break;	/* break from for loop */
+    } else {
+	peek = false;
+    }
+    if (!peek) {
+	if ((fp = lkfopendata (seqfile, lockflag ? "r+" : "r",
+			       failed_to_lock)) == NULL)
+	    return NOTOK;
+	sf = seq_file_read (fp, seqfile, mp->foldpath);
     }
-    m_getfld_state_destroy (&gstate);
+
+    /* A set the journal has emptied is a sequence that's gone. */
+    for (i = 0; i < svector_size (sf->names); i++)
+	if (rvector_next (sf->sets[i], 1, &hi))
+	    seq_init (mp, mh_xstrdup(svector_at (sf->names, i)), sf->sets[i]);
+
+    /* Kept so that seq_save() can journal just what changes. */
+    if (mh_seq_journal && *mh_seq_journal)
+	mp->pubseqs = sf;
+    else
+	seq_file_free (sf);
 
     if (lockflag) {
 	mp->seqhandle = fp;
@@ -149,6 +137,7 @@ seq_private (struct msgs *mp)
     int i, j, alen, plen;
     char *cp;
     struct node *np;
+    rvector_t set = rvector_create ();
 
     alen = LEN("atr-");
     plen = strlen (mp->foldpath) + 1;
@@ -160,29 +149,31 @@ seq_private (struct msgs *mp)
 		&& strcmp (mp->foldpath, np->n_name + j + 1) == 0) {
 	    cp = mh_xstrdup(np->n_name + alen);
 	    *(cp + j - alen) = '\0';
-	    if ((i = seq_init (mp, cp, getcpy (np->n_field))) != -1)
+	    rvector_clear_all (set);
+	    if (np->n_field)
+		seq_file_parse (set, np->n_field);
+	    if ((i = seq_init (mp, cp, set)) != -1)
 		make_seq_private (mp, i);
 	}
     }
+    rvector_free (set);
 }
 
 
 /*
  * Add the name of sequence to the list of folder sequences.
- * Then parse the list of message ranges for this
- * sequence, and setup the various bit flags for each
- * message in the sequence.
+ * Then add the messages in set that exist to the sequence,
+ * a run at a time.
  *
  * Return internal index for the sequence if successful.
  * Return -1 on error.
  */
 
 static int
-seq_init (struct msgs *mp, char *name, char *field)
+seq_init (struct msgs *mp, char *name, rvector_t set)
 {
     unsigned int i;
-    int j, k, is_current;
-    char *cp, **ap;
+    int lo, hi, is_current;
 
     /*
      * Check if this is "cur" sequence,
@@ -193,13 +184,11 @@ seq_init (struct msgs *mp, char *name, char *field)
     /*
      * Search for this sequence name to see if we've seen
      * it already.  If we've seen this sequence before,
-     * then clear the bit for this sequence from all the
-     * messages in this folder.
+     * then empty it.
      */
     for (i = 0; i < svector_size (mp->msgattrs); i++) {
 	if (!strcmp (svector_at (mp->msgattrs, i), name)) {
-	    for (j = mp->lowmsg; j <= mp->hghmsg; j++)
-		clear_sequence (mp, i, j);
+	    rvector_clear_all (seq_msgs (mp, i));
 	    break;
 	}
     }
@@ -214,36 +203,20 @@ seq_init (struct msgs *mp, char *name, char *field)
 	svector_push_back (mp->msgattrs, name);
     }
 
-    /*
-     * Split up the different message ranges at whitespace
-     */
-    for (ap = brkstring (field, " ", "\n"); *ap; ap++) {
-	if ((cp = strchr(*ap, '-')))
-	    *cp++ = '\0';
-	if ((j = m_atoi (*ap)) > 0) {
-	    k = cp ? m_atoi (cp) : j;
-
-	    /*
-	     * Keep mp->curmsg and "cur" sequence in synch.  Unlike
-	     * other sequences, this message doesn't need to exist.
-	     * Think about the series of command (rmm; next) to
-	     * understand why this can be the case.  But if it does
-	     * exist, we will still set the bit flag for it like
-	     * other sequences.
-	     */
-	    if (is_current)
-		mp->curmsg = j;
-	    /*
-	     * We iterate through messages in this range
-	     * and flip on bit for this sequence.
-	     */
-	    for (; j <= k; j++) {
-		if (j >= mp->lowmsg && j <= mp->hghmsg && does_exist(mp, j))
-		    add_sequence (mp, i, j);
-	    }
-	}
+    for (lo = rvector_next (set, 1, &hi); lo;
+	 lo = rvector_next (set, hi + 1, &hi)) {
+	/*
+	 * Keep mp->curmsg and "cur" sequence in synch.  Unlike
+	 * other sequences, this message doesn't need to exist.
+	 * Think about the series of command (rmm; next) to
+	 * understand why this can be the case.  But if it does
+	 * exist, we will still set the bit flag for it like
+	 * other sequences.
+	 */
+	if (is_current)
+	    mp->curmsg = lo;
+	seq_msgs_add (mp, i, lo, hi);
     }
 
-    free (field);	/* free string containing message ranges */
     return i;
 }
@@ -17,9 +17,13 @@
  *		  and a pointer to the filehandle will be stored in
  *		  folder structure, where it will later be used by
  *		  seq_save().
+ * peek		- If true, and lockflag isn't, read the sequence file
+ *		  without creating a lock file beside it (see
+ *		  lkfpeekdata()), so that the folder's directory
+ *		  isn't changed.
  *
  * Return values:
  *     OK       - successfully read the sequence files, or they don't exist
  *     NOTOK    - failed to lock sequence file
  */
-int seq_read(struct msgs *, int);
+int seq_read(struct msgs *, int, bool);
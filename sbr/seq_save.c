@@ -11,6 +11,7 @@
 #include "context_replace.h"
 #include "context_del.h"
 #include "seq_list.h"
+#include "seq_file.h"
 #include "error.h"
 #include "h/signals.h"
 #include "lock_file.h"
@@ -21,7 +22,8 @@
  * 1.  If sequence is public and folder is readonly,
  *     then change it to be private
  * 2a. If sequence is public, then add it to the sequences file
- *     in folder (name specified by mh-sequences profile entry).
+ *     in folder (name specified by mh-sequences profile entry),
+ *     or journal its changes; see seq_file.c.
  * 2b. If sequence is private, then add it to the
  *     context file.
  */
@@ -30,9 +32,10 @@ void
 seq_save (struct msgs *mp)
 {
     size_t i;
-    char flags, *cp, attr[BUFSIZ], seqfile[PATH_MAX];
+    char flags, *cp, attr[BUFSIZ], seqfile[PATH_MAX], jpath[PATH_MAX];
     FILE *fp;
     sigset_t set, oset;
+    struct seq_file *sf = NULL;
 
     /* check if sequence information has changed */
     if (!(mp->msgflags & SEQMOD)) {
@@ -59,10 +62,47 @@ seq_save (struct msgs *mp)
     else
 	snprintf (seqfile, sizeof(seqfile), "%s/%s", mp->foldpath, mh_seq);
 
+    /*
+     * If the public sequences were read with the journal enabled,
+     * collect them, so that just what has changed can be written.
+     * This needs the sequence file open and locked, without
+     * truncating it.
+     */
+    if (mp->pubseqs && !is_readonly(mp)) {
+	int failed_to_lock = 0;
+
+	if (mp->seqhandle) {
+	    fp = mp->seqhandle;
+	    mp->seqhandle = NULL;
+	    free(mp->seqname);
+	    mp->seqname = NULL;
+	} else {
+	    fp = lkfopendata (seqfile, "r+", &failed_to_lock);
+	}
+
+	if (fp) {
+	    sf = seq_file_create ();
+
+	    /* block a few signals */
+	    sigemptyset (&set);
+	    sigaddset(&set, SIGHUP);
+	    sigaddset(&set, SIGINT);
+	    sigaddset(&set, SIGQUIT);
+	    sigaddset(&set, SIGTERM);
+	    sigprocmask (SIG_BLOCK, &set, &oset);
+	}
+    }
+
     for (i = 0; i < svector_size (mp->msgattrs); i++) {
 	snprintf (attr, sizeof(attr), "atr-%s-%s",
 		  svector_at (mp->msgattrs, i), mp->foldpath);
 
+	if (sf && !is_seq_private(mp, i)) {
+	    context_del (attr);			/* delete sequence from context */
+	    seq_file_add (sf, mp, i);
+	    continue;
+	}
+
 	/* get space separated list of sequence ranges */
 	if (!(cp = seq_list(mp, svector_at (mp->msgattrs, i)))) {
 	    context_del (attr);			/* delete sequence from context */
@@ -112,6 +152,13 @@ priv:
 		    goto priv;
 		}
 
+		/* A journal can't apply to the rewritten file. */
+		if (mh_seq_journal && *mh_seq_journal) {
+		    snprintf (jpath, sizeof(jpath), "%s/%s", mp->foldpath,
+			      mh_seq_journal);
+		    (void) m_unlink (jpath);
+		}
+
 		/* block a few signals */
 		sigemptyset (&set);
 		sigaddset(&set, SIGHUP);
@@ -124,7 +171,13 @@ priv:
 	}
     }
 
-    if (fp) {
+    if (sf) {
+	seq_file_save (mp->pubseqs, sf, fp, mp->foldpath);
+	lkfclosedata (fp, seqfile);
+	sigprocmask (SIG_SETMASK, &oset, &set);  /* reset signal mask */
+	seq_file_free (mp->pubseqs);
+	mp->pubseqs = sf;
+    } else if (fp) {
 	lkfclosedata (fp, seqfile);
 	sigprocmask (SIG_SETMASK, &oset, &set);  /* reset signal mask */
     } else {
@@ -10,6 +10,7 @@
  *   bvector:  bit vector
  *   svector:  vector of char arrays
  *   ivector:  vector of ints
+ *   rvector:  set of positive ints, held as sorted runs
  *
  * The interfaces provide only the capabilities needed by nmh.  The
  * implementations rely on dynamic allocation, so that a vector
@@ -23,12 +24,20 @@
  * The struct's tiny member is used for storage. */
 #define BVEC_INIT_SIZE (sizeof *(((bvector_t)NULL)->tiny) * CHAR_BIT)
 
+/* The storage of a struct bvector's bits:  tiny unless bits has been
+ * allocated.  A null bits, rather than one pointing at tiny, lets the
+ * struct be moved, and one that's all zeros be an empty vector. */
+#define BVEC_STORE(vec) ((vec)->bits ? (vec)->bits : (vec)->tiny)
+
 /* The default number of char pointers in a struct svector. */
 #define SVEC_INIT_SIZE 256
 
 /* The default number of ints in a struct ivector. */
 #define IVEC_INIT_SIZE 256
 
+/* The default number of runs in a struct rvector. */
+#define RVEC_INIT_SIZE 4
+
 /*
  * These try to hide the type of the "bits" member of bvector.  But if
  * that is changed to a type that's wider than unsigned long, the 1ul
@@ -70,7 +79,7 @@ bvector_create (void)
 void
 bvector_init(struct bvector *bv)
 {
-    bv->bits = bv->tiny;
+    bv->bits = NULL;
     bv->maxsize = BVEC_INIT_SIZE;
     memset(bv->tiny, 0, sizeof bv->tiny);
 }
@@ -78,16 +87,16 @@ bvector_init(struct bvector *bv)
 void
 bvector_copy (bvector_t dest, bvector_t src)
 {
-    size_t bytes = BVEC_BYTES(src->maxsize);
+    size_t maxsize = max (src->maxsize, BVEC_INIT_SIZE);
+    size_t bytes = BVEC_BYTES(maxsize);
 
-    if (dest->bits != dest->tiny)
-        free(dest->bits);
+    free(dest->bits);
     if (bytes <= sizeof dest->tiny)
-        dest->bits = dest->tiny;
+        dest->bits = NULL;
     else
         dest->bits = mh_xmalloc (bytes);
-    memcpy (dest->bits, src->bits, bytes);
-    dest->maxsize = src->maxsize;
+    memcpy (BVEC_STORE(dest), BVEC_STORE(src), bytes);
+    dest->maxsize = maxsize;
 }
 
 void
@@ -100,22 +109,21 @@ bvector_free (bvector_t vec)
 void
 bvector_fini(struct bvector *bv)
 {
-    if (bv->bits != bv->tiny)
-        free(bv->bits);
+    free(bv->bits);
 }
 
 void
 bvector_clear (bvector_t vec, size_t n)
 {
     if (n < vec->maxsize)
-        vec->bits[BVEC_WORD(n)] &= ~(1ul << BVEC_OFFSET(n));
+        BVEC_STORE(vec)[BVEC_WORD(n)] &= ~(1ul << BVEC_OFFSET(n));
 }
 
 
 void
 bvector_clear_all (bvector_t vec)
 {
-    memset (vec->bits, 0, BVEC_BYTES(vec->maxsize));
+    memset (BVEC_STORE(vec), 0, BVEC_BYTES(vec->maxsize));
 }
 
 
@@ -127,14 +135,14 @@ bvector_set (bvector_t vec, size_t n)
 
     if (n >= vec->maxsize)
         bvector_resize (vec, n);
-    vec->bits[word] |= 1ul << offset;
+    BVEC_STORE(vec)[word] |= 1ul << offset;
 }
 
 unsigned int
 bvector_at (bvector_t vec, size_t i)
 {
     if (i < vec->maxsize)
-        return !!(vec->bits[BVEC_WORD(i)] & (1ul << BVEC_OFFSET(i)));
+        return !!(BVEC_STORE(vec)[BVEC_WORD(i)] & (1ul << BVEC_OFFSET(i)));
 
     return 0;
 }
@@ -145,10 +153,17 @@ bvector_resize (bvector_t vec, size_t newsize)
     size_t oldsize = vec->maxsize;
     size_t bytes;
 
+    if (oldsize == 0) {
+        /* An all-zero vector; tiny is clear. */
+        oldsize = vec->maxsize = BVEC_INIT_SIZE;
+        if (newsize < oldsize)
+            return;
+    }
+
     while ((vec->maxsize *= 2) < newsize)
         ;
     bytes = BVEC_BYTES(vec->maxsize);
-    if (vec->bits == vec->tiny) {
+    if (!vec->bits) {
         vec->bits = mh_xmalloc(bytes);
         memcpy(vec->bits, vec->tiny, sizeof vec->tiny);
     } else
@@ -161,7 +176,7 @@ bvector_resize (bvector_t vec, size_t newsize)
 unsigned long
 bvector_first_bits (bvector_t vec)
 {
-    return *vec->bits;
+    return *BVEC_STORE(vec);
 }
 
 
@@ -320,3 +335,225 @@ ivector_resize (ivector_t vec, size_t maxsize)
     memset(vec->ints + old_maxsize, 0,
         (vec->maxsize - old_maxsize) * sizeof *vec->ints);
 }
+
+
+/* Runs are kept sorted, and neither overlap nor touch:  runs[i].hi + 1
+ * < runs[i + 1].lo.  So a set of consecutive ints is always one run. */
+struct rvector {
+    struct rvec_run {
+        int lo, hi;
+    } *runs;
+    size_t maxsize;
+    size_t size;
+    size_t hint;    /* The run last found, where a walk will look next. */
+};
+
+static size_t rvector_find (rvector_t, int);
+static void rvector_splice (rvector_t, size_t, size_t, size_t);
+
+rvector_t
+rvector_create (void)
+{
+    rvector_t vec;
+
+    NEW(vec);
+    vec->maxsize = RVEC_INIT_SIZE;
+    vec->runs = mh_xmalloc (vec->maxsize * sizeof *vec->runs);
+    vec->size = 0;
+    vec->hint = 0;
+
+    return vec;
+}
+
+void
+rvector_free (rvector_t vec)
+{
+    free (vec->runs);
+    free (vec);
+}
+
+void
+rvector_clear_all (rvector_t vec)
+{
+    vec->size = 0;
+}
+
+/* Add lo to hi inclusive, merging with any runs they overlap or touch. */
+void
+rvector_set_range (rvector_t vec, int lo, int hi)
+{
+    size_t first, last;
+    struct rvec_run *r;
+
+    if (lo > hi)
+        return;
+
+    /* The usual case when reading or building a sequence in order. */
+    if (vec->size == 0 || lo > vec->runs[vec->size - 1].hi + 1) {
+        rvector_splice (vec, vec->size, 0, 1);
+        r = vec->runs + vec->size - 1;
+        r->lo = lo;
+        r->hi = hi;
+        return;
+    }
+    r = vec->runs + vec->size - 1;
+    if (lo >= r->lo) {
+        if (hi > r->hi)
+            r->hi = hi;
+        return;
+    }
+
+    /* Runs first to last - 1 overlap or touch lo to hi. */
+    first = rvector_find (vec, lo - 1);
+    for (last = first; last < vec->size && vec->runs[last].lo <= hi + 1; last++)
+        continue;
+
+    if (first == last) {
+        rvector_splice (vec, first, 0, 1);
+    } else {
+        if (vec->runs[first].lo < lo)
+            lo = vec->runs[first].lo;
+        if (vec->runs[last - 1].hi > hi)
+            hi = vec->runs[last - 1].hi;
+        rvector_splice (vec, first, last - first, 1);
+    }
+    vec->runs[first].lo = lo;
+    vec->runs[first].hi = hi;
+}
+
+void
+rvector_set (rvector_t vec, int n)
+{
+    rvector_set_range (vec, n, n);
+}
+
+void
+rvector_clear (rvector_t vec, int n)
+{
+    size_t i = rvector_find (vec, n);
+    struct rvec_run *r = vec->runs + i;
+
+    if (i == vec->size || r->lo > n)
+        return;
+
+    if (r->lo == r->hi) {
+        rvector_splice (vec, i, 1, 0);
+    } else if (n == r->lo) {
+        r->lo++;
+    } else if (n == r->hi) {
+        r->hi--;
+    } else {
+        rvector_splice (vec, i, 0, 1);
+        r = vec->runs + i;
+        r[0].lo = r[1].lo;
+        r[0].hi = n - 1;
+        r[1].lo = n + 1;
+    }
+}
+
+/* Remove lo to hi inclusive, trimming or splitting the runs at either
+ * end. */
+void
+rvector_clear_range (rvector_t vec, int lo, int hi)
+{
+    size_t first, last;
+    struct rvec_run *r;
+
+    if (lo > hi)
+        return;
+
+    first = rvector_find (vec, lo);
+    if (first == vec->size || vec->runs[first].lo > hi)
+        return;
+
+    r = vec->runs + first;
+    if (r->lo < lo && r->hi > hi) {
+        rvector_splice (vec, first, 0, 1);
+        r = vec->runs + first;
+        r[0].lo = r[1].lo;
+        r[0].hi = lo - 1;
+        r[1].lo = hi + 1;
+        return;
+    }
+    if (r->lo < lo) {
+        r->hi = lo - 1;
+        first++;
+    }
+
+    /* Runs first to last - 1 lie within lo to hi. */
+    for (last = first; last < vec->size && vec->runs[last].hi <= hi; last++)
+        continue;
+    if (last < vec->size && vec->runs[last].lo <= hi)
+        vec->runs[last].lo = hi + 1;
+    rvector_splice (vec, first, last - first, 0);
+}
+
+unsigned int
+rvector_at (rvector_t vec, int n)
+{
+    size_t i = rvector_find (vec, n);
+
+    return i < vec->size && vec->runs[i].lo <= n;
+}
+
+/* Return the least member that's at least n, and set *hi to the end of
+ * its run, or return 0 if there is none. */
+int
+rvector_next (rvector_t vec, int n, int *hi)
+{
+    size_t i = rvector_find (vec, n);
+
+    if (i == vec->size)
+        return 0;
+    *hi = vec->runs[i].hi;
+    return max (n, vec->runs[i].lo);
+}
+
+/* Return the index of the first run that ends at or after n, which is
+ * vec->size if there is none.  Walking the runs in order, that's
+ * usually the run last found or the one after it, so those are tried
+ * before searching. */
+static size_t
+rvector_find (rvector_t vec, int n)
+{
+    size_t lo, hi, mid;
+
+    for (lo = vec->hint; lo < vec->size && lo <= vec->hint + 1; lo++) {
+        if (vec->runs[lo].hi >= n) {
+            if (lo == 0 || vec->runs[lo - 1].hi < n)
+                return vec->hint = lo;
+            break;
+        }
+    }
+    if (lo == vec->size && (lo == 0 || vec->runs[lo - 1].hi < n))
+        return vec->hint = lo;
+
+    lo = 0;
+    hi = vec->size;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (vec->runs[mid].hi < n)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return vec->hint = lo;
+}
+
+/* Replace the del runs from i with add uninitialised ones. */
+static void
+rvector_splice (rvector_t vec, size_t i, size_t del, size_t add)
+{
+    size_t size = vec->size - del + add;
+
+    if (size > vec->maxsize) {
+        while ((vec->maxsize *= 2) < size)
+            ;
+        vec->runs = mh_xrealloc (vec->runs,
+            vec->maxsize * sizeof *vec->runs);
+    }
+    memmove (vec->runs + i + add, vec->runs + i + del,
+        (vec->size - i - del) * sizeof *vec->runs);
+    vec->size = size;
+}
@@ -6,8 +6,9 @@
 
 /* A vector of bits for tracking the sequence membership of a single
  * message.  Do not access the struct members; use vector.c.
- * Do not move or copy this struct as it may contain a pointer to
- * itself;  use bvector_copy(). */
+ * The struct may be moved, but copy it with bvector_copy() as it may
+ * own allocated bits.  One that's all zeros is an empty vector, so an
+ * array of them may come from calloc() without bvector_init(). */
 struct bvector {
     unsigned long *bits;
     size_t maxsize;
@@ -43,3 +44,17 @@ void ivector_free(ivector_t) NONNULL(1);
 int ivector_push_back(ivector_t, int) NONNULL(1);
 int ivector_at(ivector_t, size_t) NONNULL(1);
 int *ivector_atp(ivector_t, size_t) NONNULL(1);
+
+/* A set of positive ints, such as the messages in a sequence, held as
+ * sorted runs.  Lookup is a binary search on the runs. */
+typedef struct rvector *rvector_t;
+
+rvector_t rvector_create(void);
+void rvector_free(rvector_t) NONNULL(1);
+void rvector_clear(rvector_t, int) NONNULL(1);
+void rvector_clear_range(rvector_t, int, int) NONNULL(1);
+void rvector_clear_all(rvector_t) NONNULL(1);
+void rvector_set(rvector_t, int) NONNULL(1);
+void rvector_set_range(rvector_t, int, int) NONNULL(1);
+unsigned int rvector_at(rvector_t, int) NONNULL(1);
+int rvector_next(rvector_t, int, int *) NONNULL(1, 3);
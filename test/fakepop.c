@@ -117,6 +117,9 @@ main(int argc, char *argv[])
 		if (strcasecmp(linebuf, "CAPA") == 0) {
 			putpopbulk(s, "+OK We have no capabilities, really\r\n"
 				   "FAKE-CAPABILITY\r\n");
+			if (getenv("PIPELINING")) {
+				putcrlf(s, "PIPELINING");
+			}
 			if (xoauth != NULL) {
 				putcrlf(s, "SASL XOAUTH2");
 			}
@@ -229,39 +232,52 @@ putpopbulk(int socket, char *data)
 }
 
 /*
- * Get one line from the POP server.  We don't do any buffering here.
+ * Get one line from the POP client.  A client that pipelines its
+ * commands can send more than one at a time, so what's read after the
+ * line is kept for the next call.
  */
 
 static int
 getpop(int socket, char *data, ssize_t len)
 {
+	static char buf[LINESIZE];
+	static ssize_t buflen;
+	char *cp;
 	int cc;
-	int offset = 0;
 
 	for (;;) {
-		cc = read(socket, data + offset, len - offset);
+		if ((cp = memchr(buf, '\n', buflen))) {
+			ssize_t linelen = cp - buf + 1;
 
-		if (cc < 0) {
-			fprintf(stderr, "Read failed: %s\n", strerror(errno));
-			exit(1);
+			if (linelen < 2 || cp[-1] != '\r' || linelen > len) {
+				fprintf(stderr, "Bad command line\n");
+				exit(1);
+			}
+			memcpy(data, buf, linelen - 2);
+			data[linelen - 2] = '\0';
+			buflen -= linelen;
+			memmove(buf, buf + linelen, buflen);
+			return linelen - 2;
 		}
 
-		if (cc == 0) {
-			return 0;
+		if (buflen >= (ssize_t) sizeof(buf)) {
+			fprintf(stderr, "Input buffer overflow "
+				"(%d bytes)\n", (int) sizeof(buf));
+			exit(1);
 		}
 
-		offset += cc;
+		cc = read(socket, buf + buflen, sizeof(buf) - buflen);
 
-		if (offset >= len) {
-			fprintf(stderr, "Input buffer overflow "
-				"(%d bytes)\n", (int) len);
+		if (cc < 0) {
+			fprintf(stderr, "Read failed: %s\n", strerror(errno));
 			exit(1);
 		}
 
-		if (data[offset - 1] == '\n' && data[offset - 2] == '\r') {
-			data[offset - 2] = '\0';
-			return offset - 2;
+		if (cc == 0) {
+			return 0;
 		}
+
+		buflen += cc;
 	}
 }
 
@@ -13,6 +13,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #define PIDFILE "/tmp/fakesmtp.pid"
 
@@ -31,16 +32,25 @@ enum {
 
 void putcrlf(int, char *);
 int serve(const char *, const char *);
+int serve_several(const char *, const char *, int, int *);
 
 static int getsmtp(int, char *);
+static int getbytes(int, FILE *, long);
+
+static unsigned int bytesinbuf = 0;
+static char buffer[LINESIZE * 2];
 
 int
 main(int argc, char *argv[])
 {
-	int rc, conn, smtp_state;
+	int rc, conn, smtp_state, which;
 	FILE *f;
 	const char *xoauth = getenv("XOAUTH");
 	const char *smtputf8 = getenv("SMTPUTF8");
+	const char *pipelining = getenv("PIPELINING");
+	const char *chunking = getenv("CHUNKING");
+	const char *reject = getenv("REJECT");
+	const char *connections = getenv("CONNECTIONS");
 
 	if (argc != 3) {
 		fprintf(stderr, "Usage: %s output-filename port\n", argv[0]);
@@ -53,7 +63,25 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
-	conn = serve(PIDFILE, argv[2]);
+	if (connections != NULL && atoi(connections) > 1) {
+		/* What's sent on each connection after the first is
+		 * written to the output filename with its number added. */
+		conn = serve_several(PIDFILE, argv[2], atoi(connections),
+				     &which);
+		if (which > 0) {
+			char name[1024];
+
+			snprintf(name, sizeof(name), "%s.%d", argv[1], which);
+			fclose(f);
+			if (!(f = fopen(name, "w"))) {
+				fprintf(stderr, "Unable to open output file "
+					"\"%s\": %s\n", name, strerror(errno));
+				exit(1);
+			}
+		}
+	} else {
+		conn = serve(PIDFILE, argv[2]);
+	}
 
 	/*
 	 * Pretend to be an SMTP server.
@@ -70,6 +98,18 @@ main(int argc, char *argv[])
 		if (rc == -1)
 			break;	/* EOF */
 
+		if (chunking != NULL && smtp_state == SMTP_TOP &&
+		    strncmp(line, "BDAT ", 5) == 0) {
+			/* Just the text is written, so that it looks the
+			 * same however it was split up. */
+			if (getbytes(conn, f, atol(line + 5)) == -1)
+				break;	/* EOF */
+			putcrlf(conn, strstr(line, " LAST") ?
+				"250 Thanks for the info!" :
+				"250 Keep it coming");
+			continue;
+		}
+
                 fputs(line, f);
                 putc('\n', f);
 
@@ -111,9 +151,20 @@ main(int argc, char *argv[])
 			if (xoauth != NULL) {
 				putcrlf(conn, "250-AUTH XOAUTH2");
 			}
+			if (pipelining != NULL) {
+				putcrlf(conn, "250-PIPELINING");
+			}
+			if (chunking != NULL) {
+				putcrlf(conn, "250-CHUNKING");
+			}
 			putcrlf(conn, "250 I'll buy that for a dollar!");
 			continue;
 		}
+		if (reject != NULL && strncmp(line, "RCPT", 4) == 0 &&
+		    strstr(line, reject) != NULL) {
+			putcrlf(conn, "550 No such user");
+			continue;
+		}
 		if (xoauth != NULL) {
 			/* XOAUTH2 support enabled; handle AUTH (and EHLO above). */
 			if (strncmp(line, "AUTH", 4) == 0) {
@@ -133,6 +184,10 @@ main(int argc, char *argv[])
 	if (f)
 		fclose(f);
 
+	/* Wait for those serving the other connections. */
+	while (wait(NULL) > 0)
+		continue;
+
 	exit(0);
 }
 
@@ -144,8 +199,7 @@ static int
 getsmtp(int socket, char *data)
 {
 	int cc;
-	static unsigned int bytesinbuf = 0;
-	static char buffer[LINESIZE * 2], *p;
+	char *p;
 
 	for (;;) {
 		/*
@@ -167,6 +221,9 @@ getsmtp(int socket, char *data)
 			if (bytesinbuf > 0) {
 				memmove(buffer, buffer + cc + 2, bytesinbuf);
 			}
+			/* So that strchr() doesn't find what was moved. */
+			memset(buffer + bytesinbuf, 0,
+			       sizeof(buffer) - bytesinbuf);
 			return cc;
 		}
 
@@ -190,3 +247,40 @@ getsmtp(int socket, char *data)
 		bytesinbuf += cc;
 	}
 }
+
+/*
+ * Copy n bytes of BDAT text to the output file, without the CRs, so
+ * that it looks like text sent with DATA
+ */
+
+static int
+getbytes(int socket, FILE *f, long n)
+{
+	unsigned int i, cc;
+
+	while (n > 0) {
+		if (bytesinbuf == 0) {
+			int rc = read(socket, buffer, sizeof(buffer));
+
+			if (rc < 0) {
+				fprintf(stderr, "Read failed: %s\n",
+					strerror(errno));
+				exit(1);
+			}
+			if (rc == 0)
+				return -1;
+			bytesinbuf = rc;
+		}
+
+		cc = (long) bytesinbuf < n ? bytesinbuf : (unsigned int) n;
+		for (i = 0; i < cc; i++)
+			if (buffer[i] != '\r')
+				putc(buffer[i], f);
+		n -= cc;
+		bytesinbuf -= cc;
+		memmove(buffer, buffer + cc, bytesinbuf);
+		memset(buffer + bytesinbuf, 0, sizeof(buffer) - bytesinbuf);
+	}
+
+	return 0;
+}
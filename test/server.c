@@ -23,6 +23,8 @@ static const char *PIDFN = NULL;
 
 static void killpidfile(void);
 static void handleterm(int);
+static int listen_on(const char *, const char *);
+static int accept_conn(int);
 
 #ifndef EPROTOTYPE
 #define EPROTOTYPE 0
@@ -44,14 +46,64 @@ try_bind(int socket, const struct sockaddr *address, socklen_t len)
 
 int
 serve(const char *pidfn, const char *port)
+{
+	int l, conn;
+
+	l = listen_on(pidfn, port);
+	conn = accept_conn(l);
+	close(l);
+
+	return conn;
+}
+
+/*
+ * Like serve(), but take n connections, each served by a process of
+ * its own.  The one that takes the last is the one whose process ID is
+ * printed, and it should wait for the others before it exits.  *which
+ * is set to the number of the connection returned, from 0.
+ */
+int
+serve_several(const char *pidfn, const char *port, int n, int *which)
+{
+	int l, conn, i;
+
+	l = listen_on(pidfn, port);
+
+	for (i = 0; i < n - 1; i++) {
+		conn = accept_conn(l);
+
+		switch (fork()) {
+		case -1:
+			fprintf(stderr, "Unable to fork child: %s\n",
+				strerror(errno));
+			exit(1);
+		case 0:
+			close(l);
+			*which = i;
+			return conn;
+		default:
+			close(conn);
+		}
+	}
+
+	conn = accept_conn(l);
+	close(l);
+	*which = i;
+
+	return conn;
+}
+
+/*
+ * Listen on the port, in a process of our own whose ID is printed.
+ */
+static int
+listen_on(const char *pidfn, const char *port)
 {
 	struct addrinfo hints, *res;
-	int rc, l, conn, on;
+	int rc, l, on;
 	FILE *pid;
 	pid_t child;
-	fd_set readfd;
 	struct stat st;
-	struct timeval tv;
 
 	PIDFN = pidfn;
 
@@ -171,6 +223,19 @@ serve(const char *pidfn, const char *port)
 	signal(SIGTERM, handleterm);
 	atexit(killpidfile);
 
+	return l;
+}
+
+/*
+ * Wait 30 seconds for a connection, and accept it.
+ */
+static int
+accept_conn(int l)
+{
+	int rc, conn;
+	fd_set readfd;
+	struct timeval tv;
+
 	FD_ZERO(&readfd);
 	FD_SET(l, &readfd);
 	tv.tv_sec = 30;
@@ -201,9 +266,7 @@ serve(const char *pidfn, const char *port)
 		exit(1);
 	}
 
-	close(l);
-
-    return conn;
+	return conn;
 }
 
 /*
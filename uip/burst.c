@@ -9,6 +9,7 @@
 #include "sbr/m_name.h"
 #include "sbr/m_gmprot.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setprev.h"
 #include "sbr/seq_setcur.h"
 #include "sbr/seq_save.h"
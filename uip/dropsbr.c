@@ -8,7 +8,6 @@
 #include "h/nmh.h"
 #include "h/mh.h"
 #include "sbr/dtime.h"
-#include "sbr/strindex.h"
 #include "sbr/error.h"
 #include "h/utils.h"
 #include "h/dropsbr.h"
@@ -23,6 +22,8 @@
  */
 static int mbx_chk_mbox (int);
 static int mbx_chk_mmdf (int);
+static void mmdf_escape (char *, int);
+static int mbx_flush (char *, FILE *);
 
 
 /*
@@ -147,6 +148,9 @@ mbx_chk_mmdf (int fd)
 
 /*
  * Append message to end of file or maildrop.
+ *
+ * Output goes through a stdio stream on a duplicate of md, so that a
+ * message costs a write(2) per buffer rather than one per line.
  */
 
 int
@@ -154,63 +158,65 @@ mbx_copy (char *mailbox, int mbx_style, int md, int fd,
           char *text)
 {
     int i, j, size;
+    bool bol;
     char *cp, buffer[BUFSIZ + 1];   /* Space for NUL. */
-    FILE *fp;
+    FILE *fp, *out;
 
     size = 0;
 
+    if ((j = dup (md)) == NOTOK)
+	return NOTOK;
+    if ((out = fdopen (j, "w")) == NULL) {
+	close (j);
+	return NOTOK;
+    }
+
     switch (mbx_style) {
 	case MMDF_FORMAT: 
 	default: 
-	    j = LEN(MMDF_DELIM);
-	    if (write (md, MMDF_DELIM, j) != j)
-		return NOTOK;
+	    fputs (MMDF_DELIM, out);
 
 	    if (text) {
-		i = strlen (text);
-		if (write (md, text, i) != i)
-		    return NOTOK;
+		fputs (text, out);
 		for (cp = text; *cp++; size++)
 		    if (*cp == '\n')
 			size++;
 	    }
 		    
 	    while ((i = read (fd, buffer, sizeof buffer - 1)) > 0) {
-                buffer[i] = '\0';   /* Terminate for stringdex(). */
-
-		for ( ;	(j = stringdex (MMDF_DELIM, buffer)) >= 0; buffer[j]++)
-		    continue;
-		for ( ;	(j = stringdex (MMDF_DELIM, buffer)) >= 0; buffer[j]++)
-		    continue;
-		if (write (md, buffer, i) != i)
-		    return NOTOK;
+		mmdf_escape (buffer, i);
+		fwrite (buffer, 1, i, out);
 	    }
 
-	    j = LEN(MMDF_DELIM);
-	    if (write (md, MMDF_DELIM, j) != j)
-		return NOTOK;
+	    fputs (MMDF_DELIM, out);
 
-            return i == NOTOK ? NOTOK : OK;
+	    if (i == NOTOK) {
+		fclose (out);
+		return NOTOK;
+	    }
+	    return mbx_flush (mailbox, out);
 
 	case MBOX_FORMAT:
-	    if ((j = dup (fd)) == NOTOK)
+	    if ((j = dup (fd)) == NOTOK) {
+		fclose (out);
 		return NOTOK;
+	    }
 	    if ((fp = fdopen (j, "r")) == NULL) {
 		close (j);
+		fclose (out);
 		return NOTOK;
 	    }
 
 	    /* If text is given, we add it to top of message */
 	    if (text) {
-		i = strlen (text);
-		if (write (md, text, i) != i)
-		    return NOTOK;
+		fputs (text, out);
 		for (cp = text; *cp++; size++)
 		    if (*cp == '\n')
 			size++;
 	    }
 		    
-	    for (j = 0; fgets (buffer, sizeof(buffer), fp) != NULL; j++) {
+	    for (j = 0, bol = true; fgets (buffer, sizeof(buffer), fp) != NULL;
+		 j++) {
 
 		/*
 		 * Check the first line, and make some changes.
@@ -259,30 +265,61 @@ mbx_copy (char *mailbox, int mbx_style, int md, int fd,
 
 		/*
 		 * If this is not first line, and begins with
-		 * "From ", then prepend line with ">".
+		 * "From ", then prepend line with ">".  A line
+		 * longer than the buffer arrives in pieces, and
+		 * only the first of them starts a line.
 		 */
-		if (j != 0 && has_prefix(buffer, "From ")) {
-		    if (write (md, ">", 1) < 0) {
-			advise (mailbox, "write");
-		    }
+		if (j != 0 && bol && has_prefix(buffer, "From ")) {
+		    putc ('>', out);
 		    size++;
 		}
 		i = strlen (buffer);
-		if (write (md, buffer, i) != i) {
-		    fclose (fp);
-		    return NOTOK;
-		}
-	    }
-	    if (write (md, "\n", 1) != 1) {
-		fclose (fp);
-		return NOTOK;
+		fwrite (buffer, 1, i, out);
+		bol = i > 0 && buffer[i - 1] == '\n';
 	    }
+	    putc ('\n', out);
 
 	    fclose (fp);
 	    lseek(fd, 0, SEEK_END);
 
-	    return OK;
+	    return mbx_flush (mailbox, out);
+    }
+}
+
+
+/*
+ * Change the first byte of anything in buf that looks like an MMDF
+ * delimiter, so that it can't end the message early.
+ */
+
+static void
+mmdf_escape (char *buf, int len)
+{
+    char *cp, *ep;
+    int dlen;
+
+    dlen = LEN(MMDF_DELIM);
+    ep = buf + len;
+    for (cp = buf; (cp = memchr (cp, MMDF_DELIM[0], ep - cp)); cp++)
+	if (ep - cp >= dlen && memcmp (cp, MMDF_DELIM, dlen) == 0)
+	    (*cp)++;
+}
+
+
+/*
+ * Write out and close the stream used by mbx_copy().
+ */
+
+static int
+mbx_flush (char *mailbox, FILE *out)
+{
+    if (ferror (out) || fflush (out) == EOF) {
+	advise (mailbox, "write");
+	fclose (out);
+	return NOTOK;
     }
+
+    return fclose (out) == EOF ? NOTOK : OK;
 }
 
 
@@ -15,6 +15,7 @@
 
 #include "h/mh.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/smatch.h"
 #include "sbr/ssequal.h"
 #include "sbr/getfolder.h"
@@ -33,6 +34,7 @@
 #include "h/utils.h"
 #include "h/done.h"
 #include "sbr/m_maildir.h"
+#include "sbr/crawl_folders.h"
 
 /*
  * We allocate space to record the names of folders
@@ -55,6 +57,7 @@
     X("nofast", 0, NOFASTSW) \
     X("total", -5, TOTALSW) \
     X("nototal", -7, NOTOTALSW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
 
@@ -96,6 +99,7 @@ static bool recurse;            /* show nested folders? */
 static bool showzero = true;    /* show folders even if no messages in seq? */
 static bool Total = true;       /* display info on number of messages in
 				 * sequence found, and total num messages   */
+static int jobs = 1;            /* processes to read the folder tree with */
 
 static char curfolder[BUFSIZ];	/* name of the current folder */
 static char *nmhdir;		/* base nmh mail directory    */
@@ -114,7 +118,7 @@ static void GetFolderOrder(void);
 static void ScanFolders(void);
 static int AddFolder(char *, int);
 static void BuildFolderList(char *, int);
-static void BuildFolderListRecurse(char *, struct stat *, int);
+static bool BuildFolderListCallback(char *, void *);
 static void PrintFolders(void);
 static void AllocFolders(struct Folder **, int *, int);
 static int AssignPriority(char *);
@@ -211,6 +215,13 @@ main(int argc, char **argv)
 	    case NORECURSE:
 		recurse = false;
 		break;
+
+	    case JOBSSW:
+		if (!(cp = *argp++) || *cp == '-')
+		    die("missing argument to %s", argp[-2]);
+		if ((jobs = atoi (cp)) < 1)
+		    die("invalid argument to %s: %s", argp[-2], cp);
+		break;
 	    }
 	} else {
 	    /*
@@ -366,7 +377,7 @@ BuildFolderList(char *dirName, int searchdepth)
      * folder list. We just recurse into it.
      */
     if (!strcmp (dirName, ".")) {
-	BuildFolderListRecurse (".", &st, 0);
+	crawl_folders (".", BuildFolderListCallback, NULL, jobs);
 	return;
     }
 
@@ -376,78 +387,30 @@ BuildFolderList(char *dirName, int searchdepth)
      * then build folder list for subfolders.
      */
     if (AddFolder(dirName, showzero) && (recurse || searchdepth) && st.st_nlink > 2)
-	BuildFolderListRecurse(dirName, &st, searchdepth - 1);
+	crawl_folders (dirName, BuildFolderListCallback, NULL, jobs);
 }
 
 /*
- * Recursive building of folder list
+ * Called by crawl_folders for each subfolder.  Folders beginning
+ * with "." and numeric names, which we take for messages, are
+ * skipped.  Returns whether to recurse into this one.
  */
 
-static void
-BuildFolderListRecurse(char *dirName, struct stat *s, int searchdepth)
+static bool
+BuildFolderListCallback(char *name, void *baton)
 {
-    char *base, name[PATH_MAX];
-    char *n;
-    int nlinks;
-    DIR *dir;
-    struct dirent *dp;
-    struct stat st;
-
-    /*
-     * Keep track of number of directories we've seen so we can
-     * stop stat'ing entries in this directory once we've seen
-     * them all.  This optimization will fail if you have extra
-     * directories beginning with ".", since we don't bother to
-     * stat them.  But that shouldn't generally be a problem.
-     */
-    nlinks = s->st_nlink;
-    if (nlinks == 1) {
-      /* Disable the optimization under conditions where st_nlink
-         is set to 1.  That happens on Cygwin, for example:
-         http://cygwin.com/ml/cygwin-apps/2008-08/msg00264.html */
-      nlinks = INT_MAX;
-    }
-
-    if (!(dir = opendir(dirName)))
-	adios(dirName, "can't open directory");
-
-    /*
-     * A hack so that we don't see a
-     * leading "./" in folder names.
-     */
-    base = strcmp (dirName, ".") ? dirName : dirName + 1;
-
-    while (nlinks && (dp = readdir(dir))) {
-	if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
-	    nlinks--;
-	    continue;
-	}
-	if (dp->d_name[0] == '.')
-	    continue;
-	/* Check to see if the name of the file is a number
-	 * if it is, we assume it's a mail file and skip it
-	 */
-	for (n = dp->d_name; isdigit((unsigned char)*n); n++);
-	if (!*n)
-	    continue;
-	strncpy (name, base, sizeof(name) - 2);
-	if (*base)
-	    strcat(name, "/");
-	strncat(name, dp->d_name, sizeof(name) - strlen(name) - 1);
-	if ((stat(name, &st) != -1) && S_ISDIR(st.st_mode)) {
-	    /*
-	     * Check if this was really a symbolic link pointing
-	     * to a directory.  If not, then decrement link count.
-	     */
-	    if (lstat (name, &st) == -1)
-		nlinks--;
-	    /* Add this folder to the list */
-	    if (AddFolder(name, showzero) &&
-			(recurse || searchdepth) && st.st_nlink > 2)
-		BuildFolderListRecurse(name, &st, searchdepth - 1);
-	}
-    }
-    closedir(dir);
+    char *base, *n;
+    NMH_UNUSED (baton);
+
+    base = strrchr (name, '/');
+    base = base ? base + 1 : name;
+    if (*base == '.')
+	return false;
+    for (n = base; isdigit((unsigned char)*n); n++);
+    if (!*n)
+	return false;
+
+    return AddFolder(name, showzero) && recurse;
 }
 
 /*
@@ -459,7 +422,6 @@ static int
 AddFolder(char *name, int force)
 {
     unsigned int i;
-    int msgnum;
     bool nonzero;
     ivector_t seqnum = ivector_create (0), nSeq = ivector_create (0);
     struct Folder *f;
@@ -467,7 +429,7 @@ AddFolder(char *name, int force)
     char *cp;
 
     /* Read folder and create message structure */
-    if (!(mp = folder_read (name, 0))) {
+    if (!(mp = folder_read_summary (name))) {
 	/* Oops, error occurred.  Record it and continue. */
 	AllocFolders(&folders, &nFoldersAlloced, nFolders + 1);
 	f = &folders[nFolders++];
@@ -486,12 +448,8 @@ AddFolder(char *name, int force)
 
 	/* Now count messages in this sequence */
 	ivector_push_back (nSeq, 0);
-	if (mp->nummsg > 0 && ivector_at (seqnum, i) != -1) {
-	    for (msgnum = mp->lowmsg; msgnum <= mp->hghmsg; msgnum++) {
-		if (in_sequence(mp, ivector_at (seqnum, i), msgnum))
-		    (*ivector_atp (nSeq, i))++;
-	    }
-	}
+	if (mp->nummsg > 0 && ivector_at (seqnum, i) != -1)
+	    *ivector_atp (nSeq, i) = seq_count (mp, ivector_at (seqnum, i));
     }
 
     /* Check if any of the sequence checks were nonzero */
@@ -11,6 +11,7 @@
 #include "sbr/m_name.h"
 #include "sbr/m_getfld.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setprev.h"
 #include "sbr/seq_save.h"
 #include "sbr/smatch.h"
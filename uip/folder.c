@@ -59,6 +59,7 @@
     X("noprint", 0, NPRNTSW) \
     X("push", 0, PUSHSW) \
     X("pop", 0, POPSW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
 
@@ -78,6 +79,7 @@ static int fheader  = 0;	/* should we output a header?               */
 static bool frecurse;		/* recurse through subfolders               */
 static int ftotal   = 0;	/* should we output the totals?             */
 static bool all;		/* should we output all folders             */
+static int jobs = 1;		/* processes to read the folder tree with   */
 
 static int total_folders = 0;	/* total number of folders                  */
 
@@ -247,6 +249,13 @@ main (int argc, char **argv)
 		    listsw = true;
 		    pushsw = false;
 		    continue;
+
+		case JOBSSW:
+		    if (!(cp = *argp++) || *cp == '-')
+			die("missing argument to %s", argp[-2]);
+		    if ((jobs = atoi (cp)) < 1)
+			die("invalid argument to %s: %s", argp[-2], cp);
+		    continue;
 	    }
 	}
 	if (*cp == '+' || *cp == '@') {
@@ -364,7 +373,7 @@ main (int argc, char **argv)
 	    readonly_folders (); /* do any readonly folders */
 	    cp = context_find(pfolder);
 	    strncpy (folder, FENDNULL(cp), sizeof(folder));
-	    crawl_folders (".", get_folder_info_callback, NULL);
+	    crawl_folders (".", get_folder_info_callback, NULL, jobs);
 	} else {
 	    strncpy (folder, argfolder, sizeof(folder));
 	    if (get_folder_info (argfolder, msg)) {
@@ -376,7 +385,7 @@ main (int argc, char **argv)
 	     * we still need to list all level-1 sub-folders.
 	     */
 	    if (!frecurse)
-		crawl_folders (folder, get_folder_info_callback, NULL);
+		crawl_folders (folder, get_folder_info_callback, NULL, jobs);
 	}
     } else {
 	strncpy (folder, argfolder ? argfolder : getfolder (1), sizeof(folder));
@@ -489,7 +498,7 @@ get_folder_info (char *fold, char *msg)
     retval = get_folder_info_body (fold, msg, &crawl_children);
 
     if (crawl_children) {
-	crawl_folders (fold, get_folder_info_callback, NULL);
+	crawl_folders (fold, get_folder_info_callback, NULL, jobs);
     }
 
     return retval;
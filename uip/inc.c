@@ -38,6 +38,7 @@
 #include "sbr/m_gmprot.h"
 #include "sbr/getarguments.h"
 #include "sbr/concat.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setunseen.h"
 #include "sbr/seq_setcur.h"
 #include "sbr/seq_save.h"
@@ -130,6 +131,10 @@ typedef struct {
     long written;
 } pop_closure;
 
+/* The most RETRs to have outstanding with a server that takes
+ * pipelined commands. */
+#define POP_WINDOW 32
+
 extern char response[];
 
 /* This is an attempt to simplify things by putting all the
@@ -617,8 +622,17 @@ main (int argc, char **argv)
      */
     if (inc_type == INC_POP) {
         /* Mail from a POP server. */
-	int i;
+	int i, sent = 0;
         pop_closure pc;
+        bool pipelining;
+
+        /*
+         * If the server takes pipelined commands, keep the RETRs for
+         * the next messages, and the DELEs for those already stored,
+         * on their way while each message is read, rather than waiting
+         * for the reply to one before sending the next.
+         */
+        pipelining = nmsgs > 1  &&  pop_pipelining ();
 
         hghnum = msgnum = mp->hghmsg;
 	for (i = 1; i <= nmsgs; i++) {
@@ -631,7 +645,13 @@ main (int argc, char **argv)
 
             pc.written = 0;
             pc.mailout = pf;
-            if (pop_retr(i, pop_action, &pc) == NOTOK)
+            if (pipelining) {
+                while (sent < nmsgs  &&  sent < i + POP_WINDOW - 1)
+                    if (pop_send_retr (++sent) == NOTOK)
+                        die("%s", response);
+                if (pop_retr_reply (pop_action, &pc) == NOTOK)
+                    die("%s", response);
+            } else if (pop_retr(i, pop_action, &pc) == NOTOK)
                 die("%s", response);
 
             if (fflush (pf))
@@ -639,7 +659,7 @@ main (int argc, char **argv)
             fseek (pf, 0L, SEEK_SET);
 	    switch (incerr = scan (pf, msgnum, 0, nfs, width,
 			      msgnum == mp->hghmsg + 1 && chgflag,
-			      1, NULL, pc.written, noisy, &scanl)) {
+			      1, NULL, pc.written, noisy, &scanl, NULL)) {
 	    case SCNEOF:
 		printf ("%*d  empty\n", DMAXFOLDER, msgnum);
 		break;
@@ -675,7 +695,8 @@ main (int argc, char **argv)
             }
             free (cp);
 
-	    if (trnflag && pop_dele (i) == NOTOK)
+	    if (trnflag &&
+		(pipelining ? pop_send_dele (i) : pop_dele (i)) == NOTOK)
 		die("%s", response);
 
 	    scan_finished();
@@ -684,19 +705,23 @@ main (int argc, char **argv)
 	charstring_free (scanl);
 	scanl = NULL;
 
+	if (pipelining && pop_replies () == NOTOK)
+	    die("%s", response);
 	if (pop_quit () == NOTOK)
 	    die("%s", response);
 
     } else if (inc_type == INC_FILE && Maildir == NULL) {
         /* Mail from a spool file. */
 
+	if (locked)
+	    scan_map_input (in);
 	scan_detect_mbox_style (in);		/* the MAGIC invocation... */
 	hghnum = msgnum = mp->hghmsg;
 	for (;;) {
 	    /* create scanline for new message */
 	    switch (incerr = scan (in, msgnum + 1, msgnum + 1, nfs, width,
 			      msgnum == hghnum && chgflag, 1, NULL, 0L, noisy,
-			      &scanl)) {
+			      &scanl, NULL)) {
 	    case SCNFAT:
 	    case SCNEOF:
 		break;
@@ -781,7 +806,7 @@ main (int argc, char **argv)
 	    fseek (pf, 0L, SEEK_SET);
 	    switch (incerr = scan (pf, msgnum, 0, nfs, width,
 			      msgnum == mp->hghmsg + 1 && chgflag,
-			      1, NULL, 0, noisy, &scanl)) {
+			      1, NULL, 0, noisy, &scanl, NULL)) {
 	    case SCNEOF:
 		printf ("%*d  empty\n", DMAXFOLDER, msgnum);
 		break;
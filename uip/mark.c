@@ -9,6 +9,7 @@
 
 #include "h/mh.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_save.h"
 #include "sbr/smatch.h"
 #include "sbr/snprintb.h"
@@ -282,13 +283,17 @@ seq_printdebug (struct msgs *mp)
 {
     int msgnum;
     char buf[BUFSIZ];
+    bvector_t flags = bvector_create ();
 
     putchar('\n');
     for (msgnum = mp->lowsel; msgnum <= mp->hghsel; msgnum++) {
-	if (is_selected (mp, msgnum))
+	if (is_selected (mp, msgnum)) {
+	    get_msg_flags (mp, flags, msgnum);
 	    printf ("%*d: %s\n", DMAXFOLDER, msgnum,
 		    snprintb (buf, sizeof buf,
-			      (unsigned) bvector_first_bits (msgstat (mp, msgnum)),
+			      (unsigned) bvector_first_bits (flags),
 			      seq_bits (mp)));
+	}
     }
+    bvector_free (flags);
 }
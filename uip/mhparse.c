@@ -131,10 +131,14 @@ static int InitMessage (CT);
 static int InitApplication (CT);
 static int init_encoding (CT, OpenCEFunc);
 static unsigned long size_encoding (CT);
+static int decode_chunks (CT, int (*) (CT, void *, const char *, size_t),
+                          void *);
 static int InitBase64 (CT);
 static int openBase64 (CT, char **);
+static int decode_base64_chunk (CT, void *, const char *, size_t);
 static int InitQuoted (CT);
 static int openQuoted (CT, char **);
+static int decode_qp_chunk (CT, void *, const char *, size_t);
 static int Init7Bit (CT);
 static int openExternal (CT, CE, char **, int *);
 static int InitFile (CT);
@@ -1673,6 +1677,43 @@ size_encoding (CT ct)
 }
 
 
+/* Bytes of encoded content that are read and decoded at a time. */
+#define DECODE_CHUNK (4 * BUFSIZ)
+
+/*
+ * Read the encoded content of ct, from ct->c_fp, a chunk at a time and
+ * pass each to decode, along with state, to decode into ce->ce_fp.  So
+ * only a chunk of a large part is in memory at once.  Returns NOTOK if
+ * the content can't be read, after reporting it, or if decode does.
+ */
+static int
+decode_chunks (CT ct, int (*decode) (CT, void *, const char *, size_t),
+	       void *state)
+{
+    char buffer[DECODE_CHUNK];
+    long len = ct->c_end - ct->c_begin;
+    size_t cc;
+
+    fseek (ct->c_fp, ct->c_begin, SEEK_SET);
+    while (len > 0) {
+	if ((cc = fread (buffer, 1, min((size_t) len, sizeof buffer),
+			 ct->c_fp)) == 0) {
+	    if (ferror (ct->c_fp))
+		content_error (ct->c_file, ct, "error reading from");
+	    else
+		content_error (NULL, ct, "premature eof");
+	    return NOTOK;
+	}
+	len -= cc;
+
+	if ((*decode) (ct, state, buffer, cc) == NOTOK)
+	    return NOTOK;
+    }
+
+    return OK;
+}
+
+
 /*
  * BASE64
  */
@@ -1684,18 +1725,34 @@ InitBase64 (CT ct)
 }
 
 
+static int
+decode_base64_chunk (CT ct, void *state, const char *in, size_t len)
+{
+    CE ce = &ct->c_cefile;
+    unsigned char out[BASE64DECODESIZE(DECODE_CHUNK)];
+    size_t outlen;
+
+    if (decodeBase64chunk (state, in, len, out, &outlen) == NOTOK)
+	return NOTOK;
+
+    if (fwrite (out, 1, outlen, ce->ce_fp) < outlen) {
+	content_error (ce->ce_file, ct, "error writing to");
+	return NOTOK;
+    }
+
+    return OK;
+}
+
+
 static int
 openBase64 (CT ct, char **file)
 {
-    ssize_t cc, len;
-    int fd;
     bool own_ct_fp = false;
-    char *cp, *buffer = NULL;
+    char *cp;
     /* sbeck -- handle suffixes */
     CI ci;
     CE ce = &ct->c_cefile;
-    unsigned char *decoded;
-    size_t decoded_len;
+    struct base64_decoder decoder;
 
     if (ce->ce_fp) {
 	fseek (ce->ce_fp, 0L, SEEK_SET);
@@ -1743,11 +1800,9 @@ openBase64 (CT ct, char **file)
 	return NOTOK;
     }
 
-    if ((len = ct->c_end - ct->c_begin) < 0)
+    if (ct->c_end - ct->c_begin < 0)
 	die("internal error(1)");
 
-    buffer = mh_xmalloc (len + 1);
-
     if (! ct->c_fp) {
 	if ((ct->c_fp = fopen (ct->c_file, "r")) == NULL) {
 	    content_error (ct->c_file, ct, "unable to open for reading");
@@ -1756,45 +1811,10 @@ openBase64 (CT ct, char **file)
 	own_ct_fp = true;
     }
 
-    lseek (fd = fileno (ct->c_fp), (off_t) ct->c_begin, SEEK_SET);
-    cp = buffer;
-    while (len > 0) {
-	switch (cc = read (fd, cp, len)) {
-	case NOTOK:
-	    content_error (ct->c_file, ct, "error reading from");
-	    goto clean_up;
-
-	case OK:
-	    content_error (NULL, ct, "premature eof");
-	    goto clean_up;
-
-	default:
-	    if (cc > len)
-		cc = len;
-	    len -= cc;
-            cp += cc;
-        }
-    }
-
-    /* decodeBase64() requires null-terminated input. */
-    *cp = '\0';
-
-    if (decodeBase64 (buffer, &decoded, &decoded_len,
-		      ct->c_type == CT_TEXT) != OK)
-        goto clean_up;
-
-    {
-        size_t i;
-        unsigned char *decoded_p = decoded;
-        for (i = 0; i < decoded_len; ++i) {
-            putc (*decoded_p++, ce->ce_fp);
-        }
-        free(decoded);
-        if (ferror (ce->ce_fp)) {
-            content_error (ce->ce_file, ct, "error writing to");
-            goto clean_up;
-        }
-    }
+    decodeBase64init (&decoder, ct->c_type == CT_TEXT);
+    if (decode_chunks (ct, decode_base64_chunk, &decoder) == NOTOK  ||
+	decodeBase64end (&decoder) == NOTOK)
+	goto clean_up;
 
     fseek (ct->c_fp, 0L, SEEK_SET);
 
@@ -1811,7 +1831,6 @@ ready_to_go:
       fclose (ct->c_fp);
       ct->c_fp = NULL;
     }
-    free (buffer);
     return fileno (ce->ce_fp);
 
 clean_up:
@@ -1820,7 +1839,6 @@ clean_up:
       ct->c_fp = NULL;
     }
     free_encoding (ct, 0);
-    free (buffer);
     return NOTOK;
 }
 
@@ -1856,17 +1874,110 @@ InitQuoted (CT ct)
 }
 
 
+/*
+ * Quoted-printable is decoded a byte at a time, since a chunk can end
+ * anywhere in an escape sequence or a line.  Whitespace at the end of
+ * a line is dropped, so it's held until what follows it shows whether
+ * it is.
+ */
+struct qp_decoder {
+    enum { QP_TEXT, QP_EQUALS, QP_HEX } state;
+    unsigned char hex;		/* the first digit after an '='     */
+    charstring_t space;		/* whitespace that may end the line */
+    bool midline;		/* the line has no newline yet      */
+};
+
+/* Decode the next byte of a line with its trailing whitespace dropped. */
+static void
+qp_put (struct qp_decoder *qp, unsigned char c, FILE *fp)
+{
+    switch (qp->state) {
+    case QP_EQUALS:
+	qp->state = QP_TEXT;
+	if (c == '\n') {
+	    /* "=\n" soft line break, eat the \n */
+	    return;
+	}
+	if (isxdigit (c)) {
+	    qp->hex = c;
+	    qp->state = QP_HEX;
+	    return;
+	}
+	/* An invalid escape sequence; just show the raw bytes. */
+	putc ('=', fp);
+	break;
+
+    case QP_HEX:
+	qp->state = QP_TEXT;
+	if (isxdigit (c)) {
+	    putc (hex2nib[qp->hex & 0x7f] << 4 | hex2nib[c & 0x7f], fp);
+	    return;
+	}
+	putc ('=', fp);
+	putc (qp->hex, fp);
+	break;
+
+    case QP_TEXT:
+	break;
+    }
+
+    if (c == '=')
+	qp->state = QP_EQUALS;
+    else
+	putc (c, fp);
+}
+
+
+static int
+decode_qp_chunk (CT ct, void *state, const char *in, size_t len)
+{
+    struct qp_decoder *qp = state;
+    CE ce = &ct->c_cefile;
+    const char *cp, *ep = in + len;
+
+    for (cp = in; cp < ep; cp++) {
+	unsigned char c = *cp;
+
+	if (c == '\n') {
+	    charstring_clear (qp->space);
+	    qp_put (qp, c, ce->ce_fp);
+	    qp->midline = false;
+	    continue;
+	}
+
+	qp->midline = true;
+	if (isspace (c)) {
+	    charstring_push_back (qp->space, c);
+	    continue;
+	}
+
+	if (charstring_bytes (qp->space) > 0) {
+	    const char *sp = charstring_buffer (qp->space);
+	    const char *end = sp + charstring_bytes (qp->space);
+
+	    for (; sp < end; sp++)
+		qp_put (qp, *sp, ce->ce_fp);
+	    charstring_clear (qp->space);
+	}
+	qp_put (qp, c, ce->ce_fp);
+    }
+
+    if (ferror (ce->ce_fp)) {
+	content_error (ce->ce_file, ct, "error writing to");
+	return NOTOK;
+    }
+
+    return OK;
+}
+
+
 static int
 openQuoted (CT ct, char **file)
 {
-    int	cc, len, quoted;
     bool own_ct_fp = false;
-    char *cp, *ep;
-    char *bufp = NULL;
-    size_t buflen;
-    ssize_t gotlen;
-    unsigned char mask;
+    char *cp;
     CE ce = &ct->c_cefile;
+    struct qp_decoder decoder;
     /* sbeck -- handle suffixes */
     CI ci;
 
@@ -1916,7 +2027,7 @@ openQuoted (CT ct, char **file)
 	return NOTOK;
     }
 
-    if ((len = ct->c_end - ct->c_begin) < 0)
+    if (ct->c_end - ct->c_begin < 0)
 	die("internal error(2)");
 
     if (! ct->c_fp) {
@@ -1927,84 +2038,19 @@ openQuoted (CT ct, char **file)
 	own_ct_fp = true;
     }
 
-    quoted = 0;
-
-    fseek (ct->c_fp, ct->c_begin, SEEK_SET);
-    while (len > 0) {
-	if ((gotlen = getline(&bufp, &buflen, ct->c_fp)) == -1) {
-	    content_error (NULL, ct, "premature eof");
-	    goto clean_up;
-	}
-
-	if ((cc = gotlen) > len)
-	    cc = len;
-	len -= cc;
-
-	for (ep = (cp = bufp) + cc - 1; cp <= ep; ep--)
-	    if (!isspace ((unsigned char) *ep))
-		break;
-        *++ep = '\n';
-        ep++;
-
-	for (; cp < ep; cp++) {
-	    if (quoted > 0) {
-		/* in an escape sequence */
-		if (quoted == 1) {
-		    /* at byte 1 of an escape sequence */
-		    mask = hex2nib[((unsigned char) *cp) & 0x7f];
-		    /* next is byte 2 */
-		    quoted = 2;
-		} else {
-		    /* at byte 2 of an escape sequence */
-		    mask <<= 4;
-		    mask |= hex2nib[((unsigned char) *cp) & 0x7f];
-		    putc (mask, ce->ce_fp);
-		    if (ferror (ce->ce_fp)) {
-			content_error (ce->ce_file, ct, "error writing to");
-			goto clean_up;
-		    }
-		    /* finished escape sequence; next may be literal or a new
-		     * escape sequence */
-		    quoted = 0;
-		}
-		/* on to next byte */
-		continue;
-	    }
-
-	    /* not in an escape sequence */
-	    if (*cp == '=') {
-		/* starting an escape sequence, or invalid '='? */
-		if (cp + 1 < ep && cp[1] == '\n') {
-		    /* "=\n" soft line break, eat the \n */
-		    cp++;
-		    continue;
-		}
-		if (cp + 1 >= ep || cp + 2 >= ep) {
-		    /* We don't have 2 bytes left, so this is an invalid
-		     * escape sequence; just show the raw bytes (below). */
-		} else if (isxdigit ((unsigned char) cp[1]) &&
-					isxdigit ((unsigned char) cp[2])) {
-		    /* Next 2 bytes are hex digits, making this a valid escape
-		     * sequence; let's decode it (above). */
-		    quoted = 1;
-		    continue;
-		}
-                /* One or both of the next 2 is out of range, making this
-                 * an invalid escape sequence; just show the raw bytes
-                 * (below). */
-	    }
-
-	    /* Just show the raw byte. */
-	    putc (*cp, ce->ce_fp);
-	    if (ferror (ce->ce_fp)) {
-		content_error (ce->ce_file, ct, "error writing to");
-		goto clean_up;
-	    }
-	}
+    decoder.state = QP_TEXT;
+    decoder.space = charstring_create (0);
+    decoder.midline = false;
+    if (decode_chunks (ct, decode_qp_chunk, &decoder) == NOTOK) {
+	charstring_free (decoder.space);
+	goto clean_up;
     }
-    if (quoted) {
-	content_error (NULL, ct,
-		       "invalid QUOTED-PRINTABLE encoding -- end-of-content while still quoting");
+    /* The last line, if it has no newline, is given one. */
+    if (decoder.midline)
+	qp_put (&decoder, '\n', ce->ce_fp);
+    charstring_free (decoder.space);
+    if (ferror (ce->ce_fp)) {
+	content_error (ce->ce_file, ct, "error writing to");
 	goto clean_up;
     }
 
@@ -2023,7 +2069,6 @@ ready_to_go:
       fclose (ct->c_fp);
       ct->c_fp = NULL;
     }
-    free (bufp);
     return fileno (ce->ce_fp);
 
 clean_up:
@@ -2032,7 +2077,6 @@ clean_up:
       fclose (ct->c_fp);
       ct->c_fp = NULL;
     }
-    free (bufp);
     return NOTOK;
 }
 
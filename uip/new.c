@@ -12,12 +12,10 @@
 #include <sys/types.h>
 
 #include "h/mh.h"
-#include "sbr/m_getfld.h"
 #include "sbr/getarguments.h"
 #include "sbr/concat.h"
 #include "sbr/smatch.h"
 #include "sbr/r1bindex.h"
-#include "sbr/trimcpy.h"
 #include "sbr/vfgets.h"
 #include "sbr/getcpy.h"
 #include "sbr/m_atoi.h"
@@ -33,6 +31,7 @@
 #include "h/done.h"
 #include "h/utils.h"
 #include "sbr/lock_file.h"
+#include "sbr/seq_file.h"
 #include "sbr/m_maildir.h"
 
 #define NEW_SWITCHES \
@@ -115,12 +114,10 @@ get_msgnums(char *folder, char *sequences[])
 {
     char *seqfile = NULL;
     FILE *fp;
-    int state;
-    char name[NAMESZ], field[NMH_BUFSIZ];
-    char *cp;
+    struct seq_file *sf;
+    size_t i;
     char *msgnums = NULL, *this_msgnums, *old_msgnums;
     int failed_to_lock = 0;
-    m_getfld_state_t gstate;
 
     /* copied from seq_read.c:seq_public */
     /*
@@ -144,70 +141,29 @@ get_msgnums(char *folder, char *sequences[])
         return NULL;
     }
 
-    /* Use m_getfld2 to scan sequence file */
-    gstate = m_getfld_state_init(fp);
-    for (;;) {
-	int fieldsz = sizeof field;
-	switch (state = m_getfld2(&gstate, name, field, &fieldsz)) {
-            case FLD:
-            case FLDPLUS:
-                if (state == FLDPLUS) {
-                    cp = getcpy (field);
-                    while (state == FLDPLUS) {
-			fieldsz = sizeof field;
-			state = m_getfld2(&gstate, name, field, &fieldsz);
-                        cp = add (field, cp);
-                    }
-
-                    /* Here's where we differ from seq_public: if it's in a
-		     * sequence we want, save the list of messages. */
-                    if (seq_in_list(name, sequences)) {
-			this_msgnums = trimcpy(cp);
-			if (msgnums == NULL) {
-			    msgnums = this_msgnums;
-			} else {
-			    old_msgnums = msgnums;
-			    msgnums = concat(old_msgnums, " ",
-					     this_msgnums, NULL);
-			    free(old_msgnums);
-			    free(this_msgnums);
-			}
-                    }
-                    free (cp);
-                } else {
-		    /* and here */
-                    if (seq_in_list(name, sequences)) {
-			this_msgnums = trimcpy(field);
-			if (msgnums == NULL) {
-			    msgnums = this_msgnums;
-			} else {
-			    old_msgnums = msgnums;
-			    msgnums = concat(old_msgnums, " ",
-					     this_msgnums, NULL);
-			    free(old_msgnums);
-			    free(this_msgnums);
-			}
-                    }
-                }
-
-                continue;
-
-            case BODY:
-                die("no blank lines are permitted in %s", seqfile);
-                break;
-
-            case FILEEOF:
-                break;
+    /* The sequences as seq_read would find them, with any journal. */
+    sf = seq_file_read (fp, seqfile, m_maildir(folder));
+    lkfclosedata (fp, seqfile);
 
-            default:
-                die("%s is poorly formatted", seqfile);
-        }
-        break;  /* break from for loop */
+    /* Here's where we differ from seq_public: if it's in a sequence we
+     * want, save the list of messages. */
+    for (i = 0; i < svector_size (sf->names); i++) {
+	if (!seq_in_list(svector_at (sf->names, i), sequences))
+	    continue;
+	this_msgnums = seq_file_list (sf, i);
+	if (*this_msgnums == '\0') {
+	    free(this_msgnums);
+	} else if (msgnums == NULL) {
+	    msgnums = this_msgnums;
+	} else {
+	    old_msgnums = msgnums;
+	    msgnums = concat(old_msgnums, " ", this_msgnums, NULL);
+	    free(old_msgnums);
+	    free(this_msgnums);
+	}
     }
-    m_getfld_state_destroy (&gstate);
-
-    lkfclosedata (fp, seqfile);
 
+    seq_file_free (sf);
     free(seqfile);
 
     return msgnums;
@@ -287,7 +243,7 @@ check_folders(struct node **first, struct node **last,
 	if (chdir(m_maildir("")) < 0) {
 	    advise (m_maildir(""), "chdir");
 	}
-	crawl_folders(".", crawl_callback, &b);
+	crawl_folders(".", crawl_callback, &b, 1);
     } else {
 	fp = fopen(folders, "r");
 	if (fp  == NULL) {
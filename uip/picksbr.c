@@ -9,7 +9,6 @@
 #include "picksbr.h"
 #include "sbr/dtime.h"
 #include "sbr/dtime.h"
-#include "sbr/m_getfld.h"
 #include "sbr/smatch.h"
 #include "sbr/fmt_rfc2047.h"
 #include "sbr/brkstring.h"
@@ -59,6 +58,12 @@ DEFINE_SWITCH_ARRAY(PARSE, parswit);
  *
  * The matching power of this algorithm isn't as powerful as the re_xxx()
  * routines (no \(xxx\) and \n constructs).  Such is life.
+ *
+ * gcompile() compiles a pattern to a string of "items", each a
+ * character, any character, or a class, optionally starred.  This is
+ * then turned into a nondeterministic automaton with one state per
+ * item, which is simulated a machine word of states at a time, so each
+ * line is matched in a single pass without backtracking.
  */
 
 #define	CCHR	2
@@ -73,10 +78,64 @@ DEFINE_SWITCH_ARRAY(PARSE, parswit);
 #define LBSIZE  NMH_BUFSIZ
 #define	ESIZE	1024
 
+/*
+ * The automaton for a pattern of n items has states 0 to n, state i
+ * meaning that items 0 to i - 1 have been matched.  A bit of a set
+ * of states is held for each.
+ */
+typedef unsigned long pstates_t;
+#define PSTATE_BITS ((int) (CHAR_BIT * sizeof (pstates_t)))
+#define PSTATE_WORDS ((ESIZE + PSTATE_BITS) / PSTATE_BITS)
+
+struct pnfa {
+    int nstates;
+    int nwords;		/* pstates_t per set, <= PSTATE_WORDS   */
+    bool anchored;	/* pattern started with ^              */
+    bool atend;		/* pattern ended with $                */
+    pstates_t *trans;	/* for each byte, the items it matches */
+    pstates_t *star;	/* the items that are starred          */
+    pstates_t *start;	/* state 0, and the states it reaches   */
+    char first[3];	/* the bytes that can start a match     */
+};
+
 
 static char linebuf[LBSIZE + 1];
 static char decoded_linebuf[LBSIZE + 1];
 
+/*
+ * The header lines of the message being matched, unfolded and decoded,
+ * are read once, as the first leaf of the expression that wants each
+ * one asks for it, and kept for every other leaf.  The body could be
+ * any size, so it isn't kept:  each leaf that searches it reads it a
+ * line at a time, and only a second such leaf has to read it again.
+ */
+struct pline {
+    char *text;		/* unfolded, and decoded if it was encoded */
+    char *raw;		/* as unfolded, if different from text     */
+    bool last_header;	/* this is the last line of the header     */
+};
+
+static struct {
+    FILE *fp;
+    /* The stdio buffer for fp when only the header is wanted, so that
+     * a file system with a large block size doesn't have attachments
+     * read along with it. */
+    char iobuf[NMH_BUFSIZ];
+    long pos;		/* position in fp of the end of ibuf       */
+    long stop;		/* if non-zero, where the message ends     */
+    char ibuf[BUFSIZ];
+    char *cbp;		/* the next unread character in ibuf       */
+    char *ebp;		/* the end of the characters in ibuf       */
+    bool body;		/* the header has been read                */
+    bool eof;		/* all of the lines have been read         */
+    long bodypos;	/* position in fp of the start of the body */
+    bool bodyread;	/* the body has been read from bodypos     */
+    struct pline bodyline;	/* the body line last read         */
+    struct pline *lines;
+    size_t nlines;
+    size_t maxlines;
+} msg;
+
 /* the magic array for case-independence */
 static unsigned char cc[] = {
 	0000,0001,0002,0003,0004,0005,0006,0007,
@@ -124,7 +183,7 @@ static unsigned char cc[] = {
 #define	pinform		if (!talked++) inform
 
 struct nexus {
-    int (*n_action)(struct nexus *n, FILE *fp, int msgnum, long start, long stop);
+    int (*n_action)(struct nexus *n, int msgnum);
 
     union {
 	/* for {OR,AND,NOT}action */
@@ -139,6 +198,7 @@ struct nexus {
 	    int   un_circf;
 	    char  un_expbuf[ESIZE];
 	    char *un_patbuf;
+	    struct pnfa *un_nfa;
 	} st2;
 
 	/* for TWSaction */
@@ -157,12 +217,14 @@ struct nexus {
 #define	n_circf	 un.st2.un_circf
 #define	n_expbuf un.st2.un_expbuf
 #define	n_patbuf un.st2.un_patbuf
+#define	n_nfa	 un.st2.un_nfa
 
 #define	n_datef	 un.st3.un_datef
 #define	n_after	 un.st3.un_after
 #define	n_tws	 un.st3.un_tws
 
 static int talked;
+static bool header_only;	/* the expression only looks at headers */
 
 static char *datesw;
 static char **argp;
@@ -180,7 +242,8 @@ static struct tws *tws_special(char *);
  */
 static void PRaction(struct nexus *, int);
 static int gcompile(struct nexus *, char *);
-static int advance(char *, char *);
+static struct pnfa *nfa_build(char *, int);
+static int nfa_match(struct pnfa *, char *);
 static int cclass(unsigned char *, int, int);
 static int tcompile(char *, struct tws *, int);
 
@@ -188,19 +251,20 @@ static struct nexus *parse(void);
 static struct nexus *nexp1(void);
 static struct nexus *nexp2(void);
 static struct nexus *nexp3(void);
-static struct nexus *newnexus(int (*action)(struct nexus *n,
-    FILE *fp, int msgnum, long start, long stop));
+static struct nexus *newnexus(int (*action)(struct nexus *n, int msgnum));
 
-static int ORaction(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop);
-static int ANDaction(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop);
-static int NOTaction(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop);
-static int GREPaction(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop);
-static int TWSaction(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop);
+static bool headers_only(struct nexus *);
+static void msg_start(FILE *, long, long);
+static void msg_finish(void);
+static bool read_line(bool *);
+static struct pline *msg_line(size_t);
+static struct pline *body_line(bool);
+
+static int ORaction(struct nexus *n, int msgnum);
+static int ANDaction(struct nexus *n, int msgnum);
+static int NOTaction(struct nexus *n, int msgnum);
+static int GREPaction(struct nexus *n, int msgnum);
+static int TWSaction(struct nexus *n, int msgnum);
 
 
 int
@@ -218,6 +282,7 @@ pcompile (char **vec, char *date)
 	inform("%s unexpected", *argp);
 	return 0;
     }
+    header_only = headers_only (head);
 
     return 1;
 }
@@ -467,8 +532,7 @@ nexp3 (void)
 
 
 static struct nexus *
-newnexus(int (*action)(struct nexus *n, FILE *fp, int msgnum,
-    long start, long stop))
+newnexus(int (*action)(struct nexus *n, int msgnum))
 {
     struct nexus *p;
 
@@ -481,13 +545,209 @@ newnexus(int (*action)(struct nexus *n, FILE *fp, int msgnum,
 int
 pmatches (FILE *fp, int msgnum, long start, long stop, int debug)
 {
+    int result;
+
     if (!head)
 	return 1;
 
     if (!talked++ && debug)
 	PRaction (head, 0);
 
-    return (*head->n_action)(head, fp, msgnum, start, stop);
+    msg_start (fp, start, stop);
+    result = (*head->n_action)(head, msgnum);
+    msg_finish ();
+
+    return result;
+}
+
+
+/* Whether every leaf of the expression only matches header fields. */
+static bool
+headers_only (struct nexus *n)
+{
+    if (n->n_action == ORaction || n->n_action == ANDaction)
+	return headers_only (n->n_L_child) && headers_only (n->n_R_child);
+    if (n->n_action == NOTaction)
+	return headers_only (n->n_L_child);
+    if (n->n_action == GREPaction)
+	return n->n_header;
+
+    return true;
+}
+
+
+/*
+ * Start matching the message in fp between start and stop.  fp must
+ * not have been read yet, and must be closed before the next message
+ * is started.
+ */
+static void
+msg_start (FILE *fp, long start, long stop)
+{
+    if (header_only)
+	setvbuf (fp, msg.iobuf, _IOFBF, sizeof msg.iobuf);
+    fseek (fp, start, SEEK_SET);
+    msg.fp = fp;
+    msg.pos = start;
+    msg.stop = stop;
+    msg.cbp = msg.ebp = msg.ibuf;
+    msg.body = false;
+    msg.eof = false;
+    msg.bodyread = false;
+    msg.nlines = 0;
+}
+
+
+static void
+msg_finish (void)
+{
+    size_t i;
+
+    for (i = 0; i < msg.nlines; i++) {
+	free (msg.lines[i].text);
+	free (msg.lines[i].raw);
+    }
+    msg.nlines = 0;
+}
+
+
+/*
+ * Read the next line of the message into linebuf, unfolding it if it's
+ * a header field, or return false if there are no more.  last_header is
+ * set if it's the last line of the header.  A final line that isn't
+ * terminated by a newline is ignored.
+ */
+static bool
+read_line (bool *last_header)
+{
+    int c;
+    bool lf;
+    char *p1, *p2;
+
+    if (msg.eof)
+	return false;
+
+    p1 = linebuf;
+    p2 = msg.cbp;
+    lf = false;
+    for (;;) {
+	if (p2 >= msg.ebp) {
+	    if (fgets (msg.ibuf, sizeof msg.ibuf, msg.fp) == NULL
+		    || (msg.stop && msg.pos >= msg.stop)) {
+		msg.eof = true;
+		if (lf)
+		    break;
+		return false;
+	    }
+	    msg.pos += (long) strlen (msg.ibuf);
+	    p2 = msg.ibuf;
+	    msg.ebp = msg.ibuf + strlen (msg.ibuf);
+	}
+	c = *p2++;
+	if (lf && c != '\n') {
+	    if (c != ' ' && c != '\t') {
+		--p2;
+		break;
+	    }
+	    lf = false;
+	}
+	if (c == '\n') {
+	    if (msg.body)
+		break;
+	    if (lf) {
+		msg.body = true;
+		msg.bodypos = msg.pos - (long) (msg.ebp - p2);
+		break;
+	    }
+	    lf = true;
+	    /* Unfold by skipping the newline. */
+	    c = 0;
+	}
+	if (c && p1 < &linebuf[LBSIZE - 1])
+	    *p1++ = c;
+    }
+
+    *p1++ = 0;
+    msg.cbp = p2;
+    *last_header = msg.body  &&  lf;
+
+    return true;
+}
+
+
+/*
+ * Return line i of the message's header, reading up to it if need be,
+ * or NULL if the header has fewer lines.  Lines are unfolded and
+ * decoded.
+ */
+static struct pline *
+msg_line (size_t i)
+{
+    bool last_header;
+    struct pline *lp;
+
+    while (i >= msg.nlines) {
+	if (msg.body  ||  ! read_line (&last_header))
+	    return NULL;
+
+	if (msg.nlines >= msg.maxlines) {
+	    msg.maxlines = msg.maxlines ? 2 * msg.maxlines : 128;
+	    msg.lines = mh_xrealloc (msg.lines,
+				     msg.maxlines * sizeof *msg.lines);
+	}
+	lp = &msg.lines[msg.nlines++];
+	lp->raw = NULL;
+	lp->last_header = last_header;
+
+	/* Attempt to decode as a MIME header. */
+	if (decode_rfc2047 (linebuf, decoded_linebuf,
+			    sizeof decoded_linebuf)) {
+	    lp->text = mh_xstrdup(decoded_linebuf);
+	    lp->raw = mh_xstrdup(linebuf);
+	} else {
+	    lp->text = mh_xstrdup(linebuf);
+	}
+    }
+
+    return &msg.lines[i];
+}
+
+
+/*
+ * Return the first line of the body if first is set, else the next,
+ * or NULL if there are no more.  The line is only good until the next
+ * call.
+ */
+static struct pline *
+body_line (bool first)
+{
+    bool last_header;
+
+    if (first) {
+	/* Read the rest of the header, to find the body. */
+	while (msg_line (msg.nlines))
+	    continue;
+	if (! msg.body)
+	    return NULL;
+
+	/* The first leaf to search the body carries on from the end
+	   of the header;  any others go back to it. */
+	if (msg.bodyread) {
+	    fseek (msg.fp, msg.bodypos, SEEK_SET);
+	    msg.pos = msg.bodypos;
+	    msg.cbp = msg.ebp = msg.ibuf;
+	    msg.eof = false;
+	}
+	msg.bodyread = true;
+    }
+
+    if (! read_line (&last_header))
+	return NULL;
+    msg.bodyline.text = linebuf;
+    msg.bodyline.raw = NULL;
+    msg.bodyline.last_header = false;
+
+    return &msg.bodyline;
 }
 
 
@@ -535,27 +795,27 @@ PRaction (struct nexus *n, int level)
 
 
 static int
-ORaction(struct nexus *n, FILE *fp, int msgnum, long start, long stop)
+ORaction(struct nexus *n, int msgnum)
 {
-    if ((*n->n_L_child->n_action)(n->n_L_child, fp, msgnum, start, stop))
+    if ((*n->n_L_child->n_action)(n->n_L_child, msgnum))
 	return 1;
-    return (*n->n_R_child->n_action)(n->n_R_child, fp, msgnum, start, stop);
+    return (*n->n_R_child->n_action)(n->n_R_child, msgnum);
 }
 
 
 static int
-ANDaction(struct nexus *n, FILE *fp, int msgnum, long start, long stop)
+ANDaction(struct nexus *n, int msgnum)
 {
-    if (!(*n->n_L_child->n_action)(n->n_L_child, fp, msgnum, start, stop))
+    if (!(*n->n_L_child->n_action)(n->n_L_child, msgnum))
 	return 0;
-    return (*n->n_R_child->n_action)(n->n_R_child, fp, msgnum, start, stop);
+    return (*n->n_R_child->n_action)(n->n_R_child, msgnum);
 }
 
 
 static int
-NOTaction(struct nexus *n, FILE *fp, int msgnum, long start, long stop)
+NOTaction(struct nexus *n, int msgnum)
 {
-    return (!(*n->n_L_child->n_action)(n->n_L_child, fp, msgnum, start, stop));
+    return (!(*n->n_L_child->n_action)(n->n_L_child, msgnum));
 }
 
 
@@ -582,6 +842,7 @@ gcompile (struct nexus *n, char *astr)
 	switch (c) {
 	    case '\0': 
 		*ep++ = CEOF;
+		n->n_nfa = nfa_build (n->n_expbuf, n->n_circf);
 		return 1;
 
 	    case '.': 
@@ -650,170 +911,204 @@ cerror: ;
 
 
 static int
-GREPaction(struct nexus *n, FILE *fp, int msgnum, long start, long stop)
+GREPaction(struct nexus *n, int msgnum)
 {
-    int c;
-    bool body;
-    bool lf;
-    long pos = start;
-    char *p1, *p2, *ebp, *cbp;
-    char ibuf[BUFSIZ];
+    size_t i;
+    struct pline *lp;
     NMH_UNUSED (msgnum);
 
-    fseek (fp, start, SEEK_SET);
-    body = false;
-    ebp = cbp = ibuf;
-    for (;;) {
-	if (body && n->n_header)
-	    return 0;
-	p1 = linebuf;
-	p2 = cbp;
-	lf = false;
-	for (;;) {
-	    if (p2 >= ebp) {
-		if (fgets (ibuf, sizeof ibuf, fp) == NULL
-			|| (stop && pos >= stop)) {
-		    if (lf)
-			break;
-		    return 0;
-		}
-		pos += (long) strlen (ibuf);
-		p2 = ibuf;
-		ebp = ibuf + strlen (ibuf);
-	    }
-	    c = *p2++;
-	    if (lf && c != '\n') {
-		if (c != ' ' && c != '\t') {
-		    --p2;
-		    break;
-		}
-                lf = false;
-	    }
-	    if (c == '\n') {
-		if (body)
-		    break;
-                if (lf) {
-                    body = true;
-                    break;
-                }
-                lf = true;
-                /* Unfold by skipping the newline. */
-                c = 0;
+    for (i = 0; (lp = msg_line (i)); i++)
+	if (nfa_match (n->n_nfa, lp->text))
+	    return 1;
+    if (n->n_header)
+	return 0;
+
+    for (lp = body_line (true); lp; lp = body_line (false))
+	if (nfa_match (n->n_nfa, lp->text))
+	    return 1;
+
+    return 0;
+}
+
+
+#define PSTATE_SET(set, i)  ((set)[(i) / PSTATE_BITS] |= \
+			     (pstates_t) 1 << (i) % PSTATE_BITS)
+#define PSTATE_ISSET(set, i)  ((set)[(i) / PSTATE_BITS] >> \
+			       (i) % PSTATE_BITS & 1)
+
+/*
+ * Add to set the states reached from it by skipping starred items,
+ * which may match nothing.
+ */
+static void
+nfa_closure (struct pnfa *a, pstates_t *set)
+{
+    bool changed;
+    int w;
+
+    do {
+	pstates_t carry = 0;
+
+	changed = false;
+	for (w = 0; w < a->nwords; w++) {
+	    pstates_t skip = set[w] & a->star[w];
+	    pstates_t next = skip << 1 | carry;
+
+	    carry = skip >> (PSTATE_BITS - 1);
+	    if (next & ~set[w]) {
+		set[w] |= next;
+		changed = true;
 	    }
-	    if (c && p1 < &linebuf[LBSIZE - 1])
-		*p1++ = c;
 	}
+    } while (changed);
+}
 
-	*p1++ = 0;
-	cbp = p2;
-	p1 = linebuf;
-	p2 = n->n_expbuf;
 
-	/* Attempt to decode as a MIME header.	If it's the last header,
-	   body will be 1 and lf will be at least 1. */
-	if ((!body || lf)  &&
-	    decode_rfc2047 (linebuf, decoded_linebuf, sizeof decoded_linebuf)) {
-	    p1 = decoded_linebuf;
+/*
+ * Build the automaton for the items compiled into expbuf by gcompile().
+ */
+static struct pnfa *
+nfa_build (char *expbuf, int circf)
+{
+    struct pnfa *a;
+    unsigned char *ep;
+    int nitems, item, c, nfirst;
+
+    /* Count the items. */
+    for (nitems = 0, ep = (unsigned char *) expbuf; *ep != CEOF; nitems++) {
+	switch (*ep++ & ~STAR) {
+	    case CCHR:
+		ep++;
+		break;
+	    case CCL:
+	    case NCCL:
+		ep += *ep + 1;
+		break;
+	    case CDOL:
+		nitems--;
+		break;
 	}
+    }
 
-	if (n->n_circf) {
-	    if (advance (p1, p2))
-		return 1;
-	    continue;
+    NEW0(a);
+    a->nstates = nitems + 1;
+    a->nwords = (a->nstates + PSTATE_BITS - 1) / PSTATE_BITS;
+    a->anchored = circf;
+    a->trans = mh_xcalloc (256 * a->nwords, sizeof *a->trans);
+    a->star = mh_xcalloc (a->nwords, sizeof *a->star);
+    a->start = mh_xcalloc (a->nwords, sizeof *a->start);
+
+    for (item = 0, ep = (unsigned char *) expbuf; *ep != CEOF; item++) {
+	int op = *ep++;
+	unsigned char *set = ep;
+
+	if (op & STAR)
+	    PSTATE_SET(a->star, item);
+
+	/* Note which bytes match this item, with the same rules as
+	   advance() had:  a lowercase letter matches either case. */
+	switch (op & ~STAR) {
+	    case CCHR:
+		for (c = 1; c < 256; c++)
+		    if (*set == c || *set == cc[c])
+			PSTATE_SET(&a->trans[c * a->nwords], item);
+		ep++;
+		break;
+	    case CDOT:
+		for (c = 1; c < 256; c++)
+		    PSTATE_SET(&a->trans[c * a->nwords], item);
+		break;
+	    case CCL:
+	    case NCCL:
+		for (c = 1; c < 256; c++)
+		    if (cclass (set, c, (op & ~STAR) == CCL))
+			PSTATE_SET(&a->trans[c * a->nwords], item);
+		ep += *ep + 1;
+		break;
+	    case CDOL:
+		a->atend = true;
+		item--;
+		break;
 	}
+    }
 
-	if (*p2 == CCHR) {
-	    c = p2[1];
-	    do {
-		if (*p1 == c || cc[(unsigned char)*p1] == c)
-		    if (advance (p1, p2))
-			return 1;
-	    } while (*p1++);
-	    continue;
-	}
+    PSTATE_SET(a->start, 0);
+    nfa_closure (a, a->start);
 
-	do {
-	    if (advance (p1, p2))
-		return 1;
-	} while (*p1++);
+    /* If a match must start with one of a couple of bytes, lines can be
+       searched for them quickly. */
+    nfirst = 0;
+    if (nitems > 0  &&  ! PSTATE_ISSET(a->star, 0)) {
+	for (c = 1; c < 256 && nfirst < 3; c++)
+	    if (PSTATE_ISSET(&a->trans[c * a->nwords], 0))
+		a->first[nfirst++] = c;
     }
+    if (nfirst == 3)
+	nfirst = 0;
+    a->first[nfirst] = '\0';
+
+    return a;
 }
 
 
+/*
+ * Return whether the pattern's automaton matches anywhere in the line.
+ */
 static int
-advance (char *alp, char *aep)
+nfa_match (struct pnfa *a, char *line)
 {
-    unsigned char *lp, *ep, *curlp;
-
-    lp = (unsigned char *)alp;
-    ep = (unsigned char *)aep;
-    for (;;)
-	switch (*ep++) {
-	    case CCHR: 
-		if (*ep++ == *lp++ || ep[-1] == cc[lp[-1]])
-		    continue;
-		return 0;
+    unsigned char *lp = (unsigned char *) line;
+    int final = a->nstates - 1;
+    pstates_t cur[PSTATE_WORDS], next[PSTATE_WORDS];
+    size_t size = a->nwords * sizeof *cur;
+    int w, c;
 
-	    case CDOT: 
-		if (*lp++)
-		    continue;
-		return 0;
+    memcpy (cur, a->start, size);
+    for (;;) {
+	bool any = false;
 
-	    case CDOL: 
-		if (*lp == 0)
-		    continue;
-		return 0;
+	if (! a->atend  &&  PSTATE_ISSET(cur, final))
+	    return 1;
 
-	    case CEOF: 
-		return 1;
-
-	    case CCL: 
-		if (cclass (ep, *lp++, 1)) {
-		    ep += *ep + 1;
-		    continue;
-		}
-		return 0;
+	if (*lp == '\0')
+	    break;
 
-	    case NCCL: 
-		if (cclass (ep, *lp++, 0)) {
-		    ep += *ep + 1;
-		    continue;
-		}
+	/* Waiting for a match to start, so skip to where one can. */
+	if (*a->first  &&  ! a->anchored  &&
+	    memcmp (cur, a->start, size) == 0) {
+	    if ((lp = (unsigned char *) strpbrk ((char *) lp, a->first)) == NULL)
 		return 0;
+	}
 
-	    case CDOT | STAR: 
-		curlp = lp;
-		while (*lp++)
-		    continue;
-		goto star;
-
-	    case CCHR | STAR: 
-		curlp = lp;
-		while (*lp++ == *ep || cc[lp[-1]] == *ep)
-		    continue;
-		ep++;
-		goto star;
-
-	    case CCL | STAR: 
-	    case NCCL | STAR: 
-		curlp = lp;
-		while (cclass (ep, *lp++, ep[-1] == (CCL | STAR)))
-		    continue;
-		ep += *ep + 1;
-		goto star;
+	c = *lp++;
+	{
+	    pstates_t *t = &a->trans[c * a->nwords];
+	    pstates_t carry = 0;
 
-	star: 
-		do {
-		    lp--;
-		    if (advance ((char *) lp, (char *) ep))
-			return 1;
-		} while (lp > curlp);
-		return 0;
+	    for (w = 0; w < a->nwords; w++) {
+		pstates_t m = cur[w] & t[w];
+		pstates_t stay = m & a->star[w];
+		pstates_t move = m & ~a->star[w];
 
-	    default: 
-		inform("advance() botch -- you lose big, continuing...");
-		return 0;
+		next[w] = move << 1 | carry | stay;
+		carry = move >> (PSTATE_BITS - 1);
+	    }
 	}
+	nfa_closure (a, next);
+	if (! a->anchored)
+	    for (w = 0; w < a->nwords; w++)
+		next[w] |= a->start[w];
+
+	for (w = 0; w < a->nwords; w++) {
+	    cur[w] = next[w];
+	    if (cur[w])
+		any = true;
+	}
+	if (! any)
+	    return 0;
+    }
+
+    return PSTATE_ISSET(cur, final);
 }
 
 
@@ -930,57 +1225,58 @@ tws_special (char *ap)
 }
 
 
+/*
+ * Compare the first header field named n_datef with the date.  The
+ * header ends, as it does for m_getfld(), at a line that's empty,
+ * starts with a dash, or has no field name.
+ */
 static int
-TWSaction(struct nexus *n, FILE *fp, int msgnum, long start, long stop)
+TWSaction(struct nexus *n, int msgnum)
 {
     int state;
-    char *bp;
-    char buf[NMH_BUFSIZ], name[NAMESZ];
+    size_t i;
+    char *cp, *ep;
+    struct pline *lp;
     struct tws *tw;
-    m_getfld_state_t gstate;
-    NMH_UNUSED (stop);
-
-    fseek (fp, start, SEEK_SET);
-    gstate = m_getfld_state_init(fp);
-    for (bp = NULL;;) {
-	int bufsz = sizeof buf;
-	switch (state = m_getfld2(&gstate, name, buf, &bufsz)) {
-	    case FLD: 
-	    case FLDPLUS: 
-                free(bp);
-		bp = mh_xstrdup(buf);
-		while (state == FLDPLUS) {
-		    bufsz = sizeof buf;
-		    state = m_getfld2(&gstate, name, buf, &bufsz);
-		    bp = add (buf, bp);
-		}
-		if (!strcasecmp (name, n->n_datef))
-		    break;
-		continue;
 
-	    case BODY: 
-	    case FILEEOF: 
-	    case LENERR: 
-	    case FMTERR: 
-		if (state == LENERR || state == FMTERR)
-		    inform("format error in message %d", msgnum);
-                free(bp);
+    for (i = 0; (lp = msg_line (i)); i++) {
+	cp = lp->raw ? lp->raw : lp->text;
+	if (*cp == '\0'  ||  *cp == '-')
+	    return 0;
+	if ((ep = strchr (cp, ':')) == NULL  ||  ep - cp >= NAMESZ - 1) {
+	    /* Like m_getfld(), take a line with no field name to start
+	       the body, unless the name is too long or the message ends
+	       there. */
+	    if ((ep ? (size_t) (ep - cp) : strlen (cp)) >= NAMESZ - 1)
+		inform("field name \"%.*s\" exceeds %d bytes", NAMESZ - 1, cp,
+			NAMESZ - 2);
+	    else if (msg_line (i + 1)  ||  msg.body)
 		return 0;
-
-	    default: 
-		die("internal error -- you lose");
+	    else
+		inform("eof encountered in field \"%s\"", cp);
+	    inform("format error in message %d", msgnum);
+	    return 0;
 	}
-	break;
+
+	/* Trailing space isn't part of the field name. */
+	while (ep > cp  &&  isspace ((unsigned char) ep[-1]))
+	    ep--;
+	if (strlen (n->n_datef) == (size_t) (ep - cp)  &&
+	    ! strncasecmp (cp, n->n_datef, ep - cp))
+	    break;
+
+	if (lp->last_header)
+	    return 0;
     }
-    m_getfld_state_destroy (&gstate);
+    if (lp == NULL)
+	return 0;
 
-    if ((tw = dparsetime (bp)) == NULL)
+    if ((tw = dparsetime (strchr (cp, ':') + 1)) == NULL)
 	inform("unable to parse %s field in message %d, matching...",
 		n->n_datef, msgnum), state = 1;
     else
 	state = n->n_after ? (twsort (tw, &n->n_tws) > 0)
 	    : (twsort (tw, &n->n_tws) < 0);
 
-    free(bp);
     return state;
 }
@@ -24,6 +24,17 @@ static int poprint = 0;
 char response[BUFSIZ];
 static netsec_context *nsc = NULL;
 
+/*
+ * The RETR and DELE commands sent to a server that takes pipelined
+ * commands, and whose replies haven't been read yet, oldest first.  It's
+ * a ring of pendsize entries, npending of them from pendhead.
+ */
+static struct pending {
+    bool retr;			/* RETR, else DELE */
+    int msgno;
+} *pending;
+static size_t pendhead, npending, pendsize;
+
 /*
  * static prototypes
  */
@@ -35,6 +46,8 @@ static int traverse(int (*)(void *, char *), void *closure,
     const char *, ...) CHECK_PRINTF(3, 4);
 static int vcommand(const char *, va_list) CHECK_PRINTF(1, 0);
 static int pop_getline (char *, int, netsec_context *);
+static int send_pipelined(bool, int);
+static int pipelined_reply(int (*)(void *, char *), void *);
 static int pop_sasl_callback(enum sasl_message_type, unsigned const char *,
 			     unsigned int, unsigned char **, unsigned int *,
 			     void *, char **);
@@ -594,11 +607,107 @@ pop_dele (int msgno)
 }
 
 
+/*
+ * Find out whether the server takes pipelined commands (RFC 2449).
+ */
+
+bool
+pop_pipelining (void)
+{
+    int status;
+    bool pipelining = false;
+
+    if (command ("CAPA") == NOTOK)
+	return false;
+
+    while ((status = multiline ()) != DONE) {
+	if (status == NOTOK)
+	    return false;
+
+	if (strcasecmp (response, "PIPELINING") == 0)
+	    pipelining = true;
+    }
+
+    return pipelining;
+}
+
+
+/*
+ * Send a RETR or DELE to a server that takes pipelined commands, without
+ * waiting for its reply.  The replies are read, in the order the
+ * commands were sent, by pop_retr_reply() and pop_replies().
+ */
+
+int
+pop_send_retr (int msgno)
+{
+    return send_pipelined (true, msgno);
+}
+
+
+int
+pop_send_dele (int msgno)
+{
+    return send_pipelined (false, msgno);
+}
+
+
+/*
+ * Read the replies to pipelined commands up to and including the one
+ * to the oldest RETR, whose message is passed to action a line at a
+ * time.  A DELE that failed along the way fails it.
+ */
+
+int
+pop_retr_reply (int (*action)(void *, char *), void *closure)
+{
+    while (npending > 0  &&  !pending[pendhead].retr)
+	if (pipelined_reply (NULL, NULL) == NOTOK)
+	    return NOTOK;
+
+    if (npending == 0) {
+	snprintf (response, sizeof response, "no RETR is outstanding");
+	return NOTOK;
+    }
+
+    return pipelined_reply (action, closure);
+}
+
+
+/*
+ * Read the replies to all of the pipelined commands that are left.  The
+ * response is that of the first that failed.
+ */
+
+int
+pop_replies (void)
+{
+    int result = OK;
+    char buffer[sizeof response];
+
+    while (npending > 0) {
+	if (pipelined_reply (NULL, NULL) == NOTOK  &&  result == OK) {
+	    result = NOTOK;
+	    strncpy (buffer, response, sizeof buffer);
+	}
+    }
+
+    if (result == NOTOK)
+	strncpy (response, buffer, sizeof response);
+
+    return result;
+}
+
+
 int
 pop_quit (void)
 {
     int i;
 
+    /* The reply to QUIT comes after those that are still due. */
+    if (npending > 0)
+	pop_replies ();
+
     i = command ("QUIT");
     pop_done ();
 
@@ -611,6 +720,7 @@ pop_done (void)
 {
     if (nsc)
 	netsec_shutdown(nsc);
+    pendhead = npending = 0;
 
     return OK;
 }
@@ -694,6 +804,99 @@ multiline (void)
     return OK;
 }
 
+static int
+send_pipelined (bool retr, int msgno)
+{
+    char *errstr;
+
+    if (netsec_printf (nsc, &errstr, "%s %d\r\n", retr ? "RETR" : "DELE",
+		       msgno) != OK) {
+	strncpy (response, errstr, sizeof response);
+	response[sizeof response - 1] = '\0';
+	free (errstr);
+	return NOTOK;
+    }
+
+    if (npending == pendsize) {
+	struct pending *old = pending;
+	size_t i, oldsize = pendsize;
+
+	pendsize = pendsize ? pendsize * 2 : 64;
+	pending = mh_xcalloc (pendsize, sizeof *pending);
+	for (i = 0; i < npending; i++)
+	    pending[i] = old[(pendhead + i) % oldsize];
+	pendhead = 0;
+	free (old);
+    }
+    pending[(pendhead + npending) % pendsize].retr = retr;
+    pending[(pendhead + npending) % pendsize].msgno = msgno;
+    npending++;
+
+    return OK;
+}
+
+
+/*
+ * Read the reply to the oldest pipelined command, flushing any that
+ * haven't been sent yet.  The lines of a message that was retrieved are
+ * passed straight from the network buffer to action, if there is one.
+ */
+
+static int
+pipelined_reply (int (*action)(void *, char *), void *closure)
+{
+    struct pending *p = &pending[pendhead];
+    int result, snoopstate;
+    char *errstr, *line;
+
+    pendhead = (pendhead + 1) % pendsize;
+    npending--;
+
+    if (netsec_flush (nsc, &errstr) != OK) {
+	strncpy (response, errstr, sizeof response);
+	response[sizeof response - 1] = '\0';
+	free (errstr);
+	return NOTOK;
+    }
+
+    if (pop_getline (response, sizeof response, nsc) != OK)
+	return NOTOK;
+    if (poprint)
+	fprintf (stderr, "<--- %s\n", response);
+    if (*response != '+')
+	return NOTOK;
+    if (!p->retr)
+	return OK;
+
+    if ((snoopstate = netsec_get_snoop (nsc)))
+	netsec_set_snoop (nsc, 0);
+
+    for (;;) {
+	if ((line = netsec_readline (nsc, NULL, &errstr)) == NULL) {
+	    strncpy (response, errstr, sizeof response);
+	    response[sizeof response - 1] = '\0';
+	    free (errstr);
+	    result = NOTOK;
+	    break;
+	}
+	if (has_prefix (line, TRM)) {
+	    if (line[LEN(TRM)] == '\0') {
+		result = OK;
+		break;
+	    }
+	    line += LEN(TRM);
+	}
+	if (action  &&  (*action)(closure, line) != OK) {
+	    result = NOTOK;
+	    break;
+	}
+    }
+
+    netsec_set_snoop (nsc, snoopstate);
+    return result;
+}
+
+
 /*
  * This is now just a thin wrapper around netsec_readline().
  */
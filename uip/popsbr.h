@@ -14,5 +14,10 @@ int pop_init(char *, char *, char *, char *, int, int, char *, int, const char *
 int pop_stat(int *, int *);
 int pop_retr(int, int (*)(void *, char *), void *);
 int pop_dele(int);
+bool pop_pipelining(void);
+int pop_send_retr(int);
+int pop_send_dele(int);
+int pop_retr_reply(int (*)(void *, char *), void *);
+int pop_replies(void);
 int pop_quit(void);
 int pop_done(void);
@@ -90,11 +90,13 @@
     X("nowatch", 0, NWATCSW) \
     X("whom", -4, WHOMSW) /* interface from whom */ \
     X("width columns", 0, WIDTHSW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
     X("dashstuffing", -12, BITSTUFFSW) /* should we dashstuff BCC messages? */ \
     X("nodashstuffing", -14, NBITSTUFFSW) \
     X("idanno number", -6, ANNOSW) /* interface from send    */ \
+    X("session number", -7, SESSIONSW) /* interface from send */ \
     X("client host", -6, CLIESW) \
     X("server host", 6, SERVSW) /* specify alternate SMTP server */ \
     X("snoop", -5, SNOOPSW) /* snoop the SMTP transaction */ \
@@ -239,8 +241,11 @@ static struct headers RHeaders[] = {
 
 static short fccind = 0;	/* index into fccfold[] */
 static short outputlinelen = OUTPUTLINELEN;
+static int jobs = 1;		/* copies to post at once */
+static bool injob;		/* posting one of them, for post_copies() */
 
 static int pfd = NOTOK;		/* fd to write annotation list to        */
+static int sessionfd = NOTOK;	/* fd of send's session with the server  */
 static bool recipients;		/* how many people will get a copy	 */
 static int unkadr = 0;		/* how many of those were unknown        */
 static int badadr = 0;		/* number of bad addrs                   */
@@ -299,6 +304,12 @@ static char *serversw = NULL;
 
 static char prefix[] = "----- =_aaaaaaaaaa";
 
+/* A copy of the message to post, for the sighted or blind recipients. */
+struct copy {
+    char *file;
+    int bccque;
+};
+
 static char *partno = NULL;
 
 /*
@@ -325,8 +336,14 @@ static void p_refile (char *);
 static void fcc (char *, char *);
 static void fatal (char *, char *, ...) CHECK_PRINTF(2, 3);
 static void post (char *, int, int, int, char *, int, char *);
+static void post_copies (struct copy *, int, int, int, char *, int, char *);
+static int job_file (void);
 static void do_text (char *file, int fd);
+static void do_recipients (int, int, int, int);
+static void send_address (struct mailname *);
 static void do_an_address (struct mailname *, int);
+static void address_parts (struct mailname *, char **, char **, char *,
+                           size_t);
 static void do_addresses (int, int);
 static int find_prefix (void);
 
@@ -461,6 +478,13 @@ main (int argc, char **argv)
 			die("impossible width %d", outputlinelen);
 		    continue;
 
+		case JOBSSW:
+		    if (!(cp = *argp++) || *cp == '-')
+			die("missing argument to %s", argp[-2]);
+		    if ((jobs = atoi (cp)) < 1)
+			die("bad argument %s %s", argp[-2], cp);
+		    continue;
+
 		case ANNOSW: 
 		    if (!(cp = *argp++) || *cp == '-')
 			die("missing argument to %s", argp[-2]);
@@ -468,6 +492,13 @@ main (int argc, char **argv)
 			die("bad argument %s %s", argp[-2], cp);
 		    continue;
 
+		case SESSIONSW:
+		    if (!(cp = *argp++) || *cp == '-')
+			die("missing argument to %s", argp[-2]);
+		    if ((sessionfd = atoi (cp)) <= 2)
+			die("bad argument %s %s", argp[-2], cp);
+		    continue;
+
 		case CLIESW:
 		    if (!(clientsw = *argp++) || *clientsw == '-')
 			die("missing argument to %s", argp[-2]);
@@ -608,8 +639,66 @@ main (int argc, char **argv)
 
     alias (AliasFile);
 
-    if (!msg)
+    if (tls == -1) {
+#ifdef TLS_SUPPORT
+	/*
+	 * The user didn't specify any of the tls switches.  Try to
+	 * help them by implying -initialtls if they're using port 465
+	 * (smtps, until IANA revoked that registration in 1998).
+	 */
+	tls = ! strcmp (port, "465")  ||  ! strcasecmp (port, "smtps")
+	    ?  2
+	    :  0;
+#else  /* ! TLS_SUPPORT */
+	tls = 0;
+#endif /* ! TLS_SUPPORT */
+    }
+
+    if (tls == 1)
+	tlsflag = S_STARTTLS;
+    else if (tls == 2)
+	tlsflag = S_INITTLS;
+    else
+	tlsflag = 0;
+
+    if (noverify)
+	tlsflag |= S_NOVERIFY;
+
+    /*
+     * If we were given any oauth flags, store the appropriate profile
+     * entries and make sure an authservice was given (we have to do this
+     * here because we aren't guaranteed the authservice will be given on
+     * the command line before the other OAuth flags are given).
+     */
+
+    if (oauth_flag) {
+	int i;
+	char sbuf[128];
+
+	if (auth_svc == NULL) {
+	    die("No authentication service given with -authservice");
+	}
+
+	for (i = 0; oauthswitches[i].profname != NULL; i++) {
+		if (oauthswitches[i].value != NULL) {
+		    snprintf(sbuf, sizeof(sbuf),
+		    oauthswitches[i].profname, auth_svc);
+		    sbuf[sizeof(sbuf) - 1] = '\0';
+		    add_profile_entry(sbuf, oauthswitches[i].value);
+		}
+	}
+    }
+
+    if (!msg) {
+	/* Without a file, keep the connection for send's other posts. */
+	if (sessionfd != NOTOK)
+	    done (rp_isbad (sm_serve (sessionfd, clientsw, serversw, port,
+				      sasl, saslmech, user,
+				      oauth_flag ? auth_svc : NULL, tlsflag)));
 	die("usage: %s [switches] file", invo_name);
+    }
+    if (sessionfd != NOTOK)
+	sm_session (sessionfd);
 
     if (outputlinelen < 10)
 	die("impossible width %d", outputlinelen);
@@ -708,56 +797,6 @@ main (int argc, char **argv)
 	envelope = from;
     }
 
-    if (tls == -1) {
-#ifdef TLS_SUPPORT
-	/*
-	 * The user didn't specify any of the tls switches.  Try to
-	 * help them by implying -initialtls if they're using port 465
-	 * (smtps, until IANA revoked that registration in 1998).
-	 */
-	tls = ! strcmp (port, "465")  ||  ! strcasecmp (port, "smtps")
-	    ?  2
-	    :  0;
-#else  /* ! TLS_SUPPORT */
-	tls = 0;
-#endif /* ! TLS_SUPPORT */
-    }
-
-    if (tls == 1)
-	tlsflag = S_STARTTLS;
-    else if (tls == 2)
-	tlsflag = S_INITTLS;
-    else
-	tlsflag = 0;
-
-    if (noverify)
-	tlsflag |= S_NOVERIFY;
-
-    /*
-     * If we were given any oauth flags, store the appropriate profile
-     * entries and make sure an authservice was given (we have to do this
-     * here because we aren't guaranteed the authservice will be given on
-     * the command line before the other OAuth flags are given).
-     */
-
-    if (oauth_flag) {
-	int i;
-	char sbuf[128];
-
-	if (auth_svc == NULL) {
-	    die("No authentication service given with -authservice");
-	}
-
-	for (i = 0; oauthswitches[i].profname != NULL; i++) {
-		if (oauthswitches[i].value != NULL) {
-		    snprintf(sbuf, sizeof(sbuf),
-		    oauthswitches[i].profname, auth_svc);
-		    sbuf[sizeof(sbuf) - 1] = '\0';
-		    add_profile_entry(sbuf, oauthswitches[i].value);
-		}
-	}
-    }
-
     /* If we are doing a "whom" check */
     if (whomsw) {
 	/* This won't work with MTS_SENDMAIL_PIPE. */
@@ -766,6 +805,9 @@ main (int argc, char **argv)
     }
 
     if (msgflags & MINV) {
+	struct copy copies[2];
+	int ncopies = 0;
+
 	make_bcc_file (dashstuff);
 	if (msgflags & MVIS) {
 	    if (sm_mts != MTS_SENDMAIL_PIPE) {
@@ -776,9 +818,13 @@ main (int argc, char **argv)
 		verify_all_addresses (verbose, eai, envelope, oauth_flag,
                                       auth_svc);
 	    }
-	    post (tmpfil, 0, verbose, eai, envelope, oauth_flag, auth_svc);
+	    copies[ncopies].file = tmpfil;
+	    copies[ncopies++].bccque = 0;
 	}
-	post (bccfil, 1, verbose, eai, envelope, oauth_flag, auth_svc);
+	copies[ncopies].file = bccfil;
+	copies[ncopies++].bccque = 1;
+	post_copies (copies, ncopies, verbose, eai, envelope, oauth_flag,
+		     auth_svc);
 	(void) m_unlink (bccfil);
     } else {
 	post (tmpfil, 0, isatty (1), eai, envelope, oauth_flag, auth_svc);
@@ -1671,35 +1717,8 @@ static void
 do_addresses (int bccque, int talk)
 {
     int retval;
-    int	state;
-    struct mailname *lp;
 
-    state = 0;
-    for (lp = localaddrs.m_next; lp; lp = lp->m_next)
-	if (lp->m_bcc ? bccque : !bccque) {
-	    if (talk && !state)
-		puts("  -- Local Recipients --");
-	    do_an_address (lp, talk);
-	    state++;
-	}
-
-    state = 0;
-    for (lp = uuaddrs.m_next; lp; lp = lp->m_next)
-	if (lp->m_bcc ? bccque : !bccque) {
-	    if (talk && !state)
-		puts("  -- UUCP Recipients --");
-	    do_an_address (lp, talk);
-	    state++;
-	}
-
-    state = 0;
-    for (lp = netaddrs.m_next; lp; lp = lp->m_next)
-	if (lp->m_bcc ? bccque : !bccque) {
-	    if (talk && !state)
-		puts("  -- Network Recipients --");
-	    do_an_address (lp, talk);
-	    state++;
-	}
+    do_recipients (0, bccque, talk, 1);
 
     chkadr ();
 
@@ -1796,7 +1815,7 @@ post (char *file, int bccque, int talk, int eai, char *envelope,
         close (fd);
         fflush (stdout);
 
-        sm_end (!(msgflags & MINV) || bccque ? OK : DONE);
+        sm_end (!(msgflags & MINV) || bccque || injob ? OK : DONE);
         sigoff ();
 
         if (verbose) {
@@ -1812,6 +1831,106 @@ post (char *file, int bccque, int talk, int eai, char *envelope,
 }
 
 
+/*
+ * Post each copy.  With -jobs, up to that many are posted at once, by
+ * processes with a connection each.  What each writes is held until
+ * they've all finished, and then written in order, so it reads as if
+ * they'd been posted one after the other.
+ */
+
+static void
+post_copies (struct copy *copies, int ncopies, int talk, int eai,
+	     char *envelope, int oauth_flag, char *auth_svc)
+{
+    struct job {
+	pid_t pid;
+	int out, err;		/* what it writes to stdout and stderr */
+    } *jp;
+    int i, waited, failed = 0;
+
+    if (jobs <= 1  ||  ncopies <= 1  ||  sm_mts != MTS_SMTP) {
+	for (i = 0; i < ncopies; i++)
+	    post (copies[i].file, copies[i].bccque, talk, eai, envelope,
+		  oauth_flag, auth_svc);
+	return;
+    }
+
+    /*
+     * The jobs can't share the connection address verification used,
+     * nor relay over send's session at once, so each connects itself.
+     */
+    sm_session (NOTOK);
+    sm_end (OK);
+    fflush (stdout);
+
+    jp = mh_xcalloc (ncopies, sizeof *jp);
+    for (i = waited = 0; i < ncopies; i++) {
+	if (i - waited == jobs  &&  pidwait (jp[waited++].pid, NOTOK))
+	    failed++;
+
+	if ((jp[i].out = job_file ()) == NOTOK  ||
+	    (jp[i].err = job_file ()) == NOTOK)
+	    fatal (NULL, "unable to create temporary file in %s",
+		   get_temp_dir ());
+
+	switch (jp[i].pid = fork ()) {
+	case NOTOK:
+	    fatal ("fork", "unable to");
+	    break;
+
+	case OK:
+	    injob = true;
+	    unregister_for_removal (0);
+	    dup2 (jp[i].out, fileno (stdout));
+	    dup2 (jp[i].err, fileno (stderr));
+	    post (copies[i].file, copies[i].bccque, talk, eai, envelope,
+		  oauth_flag, auth_svc);
+	    sm_end (OK);
+	    done (0);
+	    break;
+
+	default:
+	    break;
+	}
+    }
+    while (waited < ncopies)
+	if (pidwait (jp[waited++].pid, NOTOK))
+	    failed++;
+
+    for (i = 0; i < ncopies; i++) {
+	lseek (jp[i].out, 0, SEEK_SET);
+	cpydata (jp[i].out, fileno (stdout), "job output", "standard output");
+	close (jp[i].out);
+	lseek (jp[i].err, 0, SEEK_SET);
+	cpydata (jp[i].err, fileno (stderr), "job output", "standard error");
+	close (jp[i].err);
+    }
+    free (jp);
+
+    if (failed) {
+	(void) m_unlink (tmpfil);
+	(void) m_unlink (bccfil);
+	done (1);
+    }
+}
+
+
+/* Return a file for a job to write to, already unlinked. */
+
+static int
+job_file (void)
+{
+    int fd;
+    char *cp;
+
+    if ((cp = m_mktemp2 (NULL, invo_name, &fd, NULL)) == NULL)
+	return NOTOK;
+    (void) m_unlink (cp);
+
+    return fd;
+}
+
+
 /* Address Verification */
 
 static void
@@ -1819,7 +1938,6 @@ verify_all_addresses (int talk, int eai, char *envelope, int oauth_flag,
                       char *auth_svc)
 {
     int retval;
-    struct mailname *lp;
 
     sigon ();
 
@@ -1837,20 +1955,7 @@ verify_all_addresses (int talk, int eai, char *envelope, int oauth_flag,
 
     if (talk && !whomsw)
 	puts(" -- Address Verification --");
-    if (talk && localaddrs.m_next)
-	puts("  -- Local Recipients --");
-    for (lp = localaddrs.m_next; lp; lp = lp->m_next)
-	do_an_address (lp, talk);
-
-    if (talk && uuaddrs.m_next)
-	puts("  -- UUCP Recipients --");
-    for (lp = uuaddrs.m_next; lp; lp = lp->m_next)
-	do_an_address (lp, talk);
-
-    if (talk && netaddrs.m_next)
-	puts("  -- Network Recipients --");
-    for (lp = netaddrs.m_next; lp; lp = lp->m_next)
-	do_an_address (lp, talk);
+    do_recipients (1, 0, talk, 0);
 
     chkadr ();
     if (talk && !whomsw)
@@ -1864,32 +1969,90 @@ verify_all_addresses (int talk, int eai, char *envelope, int oauth_flag,
 }
 
 
+/*
+ * Give the server the recipients, in the order of the local, UUCP and
+ * network lists:  all of them, or else the blind ones if bccque is set
+ * and the sighted ones if not, and report what it says of each.  A
+ * server that takes pipelined commands is sent up to sm_pipeline() of
+ * them ahead of the replies, and then DATA if data is set, so that a
+ * long list doesn't take a round trip for each recipient.
+ */
+static void
+do_recipients (int all, int bccque, int talk, int data)
+{
+    struct mailname *lists[] = { &localaddrs, &uuaddrs, &netaddrs };
+    static const char *const names[] = { "Local", "UUCP", "Network" };
+    struct recipient {
+	struct mailname *lp;
+	int list;
+    } *rcpts;
+    struct mailname *lp;
+    size_t nrcpts, sent, i;
+    int list, shown, window, retval;
+
+    nrcpts = 0;
+    for (list = 0; list < 3; list++)
+	for (lp = lists[list]->m_next; lp; lp = lp->m_next)
+	    nrcpts++;
+    rcpts = mh_xcalloc (nrcpts, sizeof *rcpts);
+
+    nrcpts = 0;
+    for (list = 0; list < 3; list++)
+	for (lp = lists[list]->m_next; lp; lp = lp->m_next)
+	    if (all || (lp->m_bcc ? bccque : !bccque)) {
+		rcpts[nrcpts].lp = lp;
+		rcpts[nrcpts++].list = list;
+	    }
+
+    /* whom without -check just lists the addresses. */
+    window = whomsw && !checksw ? 0 : sm_pipeline ();
+
+    shown = -1;
+    for (sent = i = 0; i < nrcpts; i++) {
+	for (; sent < nrcpts && sent - i < (size_t) window; sent++)
+	    send_address (rcpts[sent].lp);
+	if (data && sent == nrcpts) {
+	    if (rp_isbad (retval = sm_qdata ()))
+		fatal (NULL, "problem ending addresses; %s",
+		       rp_string (retval));
+	    data = 0;
+	}
+
+	if (talk && rcpts[i].list != shown) {
+	    shown = rcpts[i].list;
+	    printf ("  -- %s Recipients --\n", names[shown]);
+	}
+	do_an_address (rcpts[i].lp, talk);
+    }
+
+    free (rcpts);
+}
+
+
 static void
-do_an_address (struct mailname *lp, int talk)
+send_address (struct mailname *lp)
 {
     int retval;
     char *mbox, *host;
     char addr[BUFSIZ];
 
-    switch (lp->m_type) {
-	case LOCALHOST: 
-	    mbox = lp->m_mbox;
-	    host = lp->m_host;
-	    strncpy (addr, mbox, sizeof(addr));
-	    break;
+    address_parts (lp, &mbox, &host, addr, sizeof addr);
 
-	case UUCPHOST: 
-	    mbox = auxformat (lp, 0);
-	    host = NULL;
-	    snprintf (addr, sizeof(addr), "%s!%s", lp->m_host, lp->m_mbox);
-	    break;
+    if (rp_isbad (retval = sm_qadr (mbox, host,
+				    lp->m_type != UUCPHOST ? lp->m_path : NULL)))
+	fatal (NULL, "problem sending addresses; %s", rp_string (retval));
+}
 
-	default:		/* let SendMail decide if the host is bad  */
-	    mbox = lp->m_mbox;
-	    host = lp->m_host;
-	    snprintf (addr, sizeof(addr), "%s at %s", mbox, host);
-	    break;
-    }
+
+/* Report what the server says of lp, which send_address() has sent. */
+static void
+do_an_address (struct mailname *lp, int talk)
+{
+    int retval;
+    char *mbox, *host;
+    char addr[BUFSIZ];
+
+    address_parts (lp, &mbox, &host, addr, sizeof addr);
 
     if (talk)
 	printf ("  %s%s", addr, whomsw && lp->m_bcc ? "[BCC]" : "");
@@ -1902,8 +2065,7 @@ do_an_address (struct mailname *lp, int talk)
 	fputs(": ", stdout);
     fflush (stdout);
 
-    switch (retval = sm_wadr (mbox, host,
-			 lp->m_type != UUCPHOST ? lp->m_path : NULL)) {
+    switch (retval = sm_radr ()) {
 	case RP_OK: 
 	    if (talk)
 		puts("address ok");
@@ -1928,6 +2090,33 @@ do_an_address (struct mailname *lp, int talk)
 }
 
 
+/* Set the mailbox and host to give the server for lp, and addr to show. */
+static void
+address_parts (struct mailname *lp, char **mbox, char **host, char *addr,
+	       size_t addrlen)
+{
+    switch (lp->m_type) {
+	case LOCALHOST: 
+	    *mbox = lp->m_mbox;
+	    *host = lp->m_host;
+	    strncpy (addr, *mbox, addrlen);
+	    break;
+
+	case UUCPHOST: 
+	    *mbox = auxformat (lp, 0);
+	    *host = NULL;
+	    snprintf (addr, addrlen, "%s!%s", lp->m_host, lp->m_mbox);
+	    break;
+
+	default:		/* let SendMail decide if the host is bad  */
+	    *mbox = lp->m_mbox;
+	    *host = lp->m_host;
+	    snprintf (addr, addrlen, "%s at %s", *mbox, *host);
+	    break;
+    }
+}
+
+
 static void
 do_text (char *file, int fd)
 {
@@ -1968,9 +2157,11 @@ sigser (int i)
 {
     NMH_UNUSED (i);
 
-    (void) m_unlink (tmpfil);
-    if (msgflags & MINV)
-	(void) m_unlink (bccfil);
+    if (!injob) {
+	(void) m_unlink (tmpfil);
+	if (msgflags & MINV)
+	    (void) m_unlink (bccfil);
+    }
 
     if (!whomsw || checksw)
 	sm_end (NOTOK);
@@ -2093,9 +2284,12 @@ fatal (char *what, char *fmt, ...)
 
     err = errno;
 
-    (void) m_unlink (tmpfil);
-    if (msgflags & MINV)
-	(void) m_unlink (bccfil);
+    /* The other jobs may still be posting them. */
+    if (!injob) {
+	(void) m_unlink (tmpfil);
+	if (msgflags & MINV)
+	    (void) m_unlink (bccfil);
+    }
 
     if (!whomsw || checksw)
 	sm_end (NOTOK);
@@ -264,7 +264,7 @@ header_fd (void)
 
     /* get new format string */
     nfs = new_fs (form, format, SCANFMT);
-    scan (stdin, 0, 0, nfs, width, 0, 0, NULL, 0L, 0, &scanl);
+    scan (stdin, 0, 0, nfs, width, 0, 0, NULL, 0L, 0, &scanl, NULL);
     scan_finished ();
     if (newline) {
 	if (write (fd, "\n\r", 2) < 0) {
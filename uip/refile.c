@@ -9,6 +9,7 @@
 #include "h/mh.h"
 #include "sbr/m_name.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setprev.h"
 #include "sbr/seq_setcur.h"
 #include "sbr/seq_save.h"
@@ -20,6 +21,7 @@
 #include "sbr/folder_free.h"
 #include "sbr/folder_delmsgs.h"
 #include "sbr/folder_addmsg.h"
+#include "sbr/folder_realloc.h"
 #include "sbr/context_save.h"
 #include "sbr/context_replace.h"
 #include "sbr/context_find.h"
@@ -67,16 +69,18 @@ static char maildir[BUFSIZ];
 struct st_fold {
     char *f_name;
     struct msgs *f_mp;
+    int *f_seqs;	/* source folder's sequence numbers here, for copy_seqs */
 };
 
 /*
  * static prototypes
  */
 static void opnfolds (struct msgs *, struct st_fold *, int);
+static void reserve_folds (struct msgs *, struct st_fold *, int, int);
 static void clsfolds (struct st_fold *, int);
 static void remove_files (int, char **);
 static int m_file (struct msgs *, char *, int, struct st_fold *, int, int, int);
-static void copy_seqs (struct msgs *, int, struct msgs *, int);
+static void copy_seqs (struct msgs *, int, struct st_fold *, int);
 
 
 int
@@ -237,6 +241,7 @@ main (int argc, char **argv)
 
     /* create folder structures for each destination folder */
     opnfolds (mp, folders, foldp);
+    reserve_folds (mp, folders, foldp, preserve);
 
     /* Link all the selected messages into destination folders.
      *
@@ -332,6 +337,7 @@ opnfolds (struct msgs *src_folder, struct st_fold *folders, int nfolders)
 	    /* Source and destination folders are the same. */
 	    fp->f_mp = src_folder;
 	}
+	fp->f_seqs = NULL;
 
 	if (maildir[0] != '\0'  &&  chdir (maildir) < 0) {
 	    advise (maildir, "chdir");
@@ -340,6 +346,39 @@ opnfolds (struct msgs *src_folder, struct st_fold *folders, int nfolders)
 }
 
 
+/*
+ * Make room in the message status of each destination folder for all
+ * the selected messages of the source at once, rather than growing it
+ * a hundred messages at a time as they're added.
+ */
+
+static void
+reserve_folds (struct msgs *src_folder, struct st_fold *folders, int nfolders,
+	       int preserve)
+{
+    struct st_fold *fp, *ep;
+    struct msgs *mp;
+    int lo, hi;
+
+    for (fp = folders, ep = folders + nfolders; fp < ep; fp++) {
+	mp = fp->f_mp;
+	if (mp == src_folder)
+	    continue;
+
+	lo = mp->lowoff;
+	hi = (mp->nummsg ? mp->hghmsg : 0) + src_folder->numsel;
+	if (preserve) {
+	    lo = min (lo, src_folder->lowsel);
+	    hi = max (hi, src_folder->hghsel);
+	}
+	hi = max (hi, mp->hghoff);
+
+	if (!(fp->f_mp = folder_realloc (mp, lo, hi)))
+	    die("unable to allocate folder storage");
+    }
+}
+
+
 /*
  * Set the Previous-Sequence and then synchronize the
  * sequence file, for each destination folder.
@@ -355,6 +394,7 @@ clsfolds (struct st_fold *folders, int nfolders)
 	mp = fp->f_mp;
 	seq_setprev (mp);
 	seq_save (mp);
+	free (fp->f_seqs);
     }
 }
 
@@ -417,7 +457,7 @@ m_file (struct msgs *mp, char *msgfile, int oldmsgnum,
 				     0, preserve, nfolders == 1 && refile,
 				     maildir)) == -1)
 	    return 1;
-	if (oldmsgnum) copy_seqs (mp, oldmsgnum, fp->f_mp, msgnum);
+	if (oldmsgnum) copy_seqs (mp, oldmsgnum, fp, msgnum);
     }
     return 0;
 }
@@ -425,23 +465,35 @@ m_file (struct msgs *mp, char *msgfile, int oldmsgnum,
 
 /*
  * Copy sequence information for a refiled message to its
- * new folder.  Skip the cur sequence.
+ * new folder.  Skip the cur sequence.  Each sequence is looked up
+ * by name in the new folder only for the first message in it.
  */
 static void
-copy_seqs (struct msgs *oldmp, int oldmsgnum, struct msgs *newmp, int newmsgnum)
+copy_seqs (struct msgs *oldmp, int oldmsgnum, struct st_fold *fp,
+	   int newmsgnum)
 {
-    char **seq;
-    size_t seqnum;
-
-    for (seq = svector_strs (oldmp->msgattrs), seqnum = 0;
-	 *seq && seqnum < svector_size (oldmp->msgattrs);
-	 ++seq, ++seqnum) {
-	if (strcmp (current, *seq)) {
-	    assert ((int) seqnum == seq_getnum (oldmp, *seq));
-	    if (in_sequence (oldmp, seqnum, oldmsgnum)) {
-		seq_addmsg (newmp, *seq, newmsgnum,
-                            !is_seq_private (oldmp, seqnum), 0);
-	    }
+    struct msgs *newmp = fp->f_mp;
+    size_t seqnum, nseqs = svector_size (oldmp->msgattrs);
+    char *seq;
+
+    if (!fp->f_seqs) {
+	fp->f_seqs = mh_xmalloc ((nseqs + 1) * sizeof *fp->f_seqs);
+	for (seqnum = 0; seqnum < nseqs; seqnum++)
+	    fp->f_seqs[seqnum] = -1;
+    }
+
+    for (seqnum = 0; seqnum < nseqs; seqnum++) {
+	if (!in_sequence (oldmp, seqnum, oldmsgnum))
+	    continue;
+	if (fp->f_seqs[seqnum] >= 0) {
+	    add_sequence (newmp, fp->f_seqs[seqnum], newmsgnum);
+	    continue;
 	}
+
+	seq = svector_at (oldmp->msgattrs, seqnum);
+	if (strcmp (current, seq) &&
+	    seq_addmsg (newmp, seq, newmsgnum,
+			!is_seq_private (oldmp, seqnum), 0))
+	    fp->f_seqs[seqnum] = seq_getnum (newmp, seq);
     }
 }
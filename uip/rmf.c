@@ -19,6 +19,7 @@
 #include "sbr/context_replace.h"
 #include "sbr/context_del.h"
 #include "sbr/context_find.h"
+#include "sbr/context_index.h"
 #include "sbr/ambigsw.h"
 #include "sbr/path.h"
 #include "sbr/print_version.h"
@@ -269,6 +270,7 @@ rma (char *folder)
 	    pp = np;
 	}
     }
+    context_index_reset ();
 
     free(cp);
 }
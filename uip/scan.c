@@ -9,8 +9,10 @@
 #include "sbr/fmt_new.h"
 #include "sbr/dtime.h"
 #include "scansbr.h"
+#include "sbr/hdr_index.h"
 #include "sbr/m_name.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setprev.h"
 #include "sbr/seq_save.h"
 #include "sbr/smatch.h"
@@ -47,6 +49,7 @@
     X("reverse", 0, REVSW) \
     X("noreverse", 0, NREVSW) \
     X("file file", 4, FILESW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
 
@@ -58,6 +61,32 @@ DEFINE_SWITCH_ENUM(SCAN);
 DEFINE_SWITCH_ARRAY(SCAN, switches);
 #undef X
 
+/* scan_msg() couldn't open the message;  it has said why. */
+#define SCNSKIP (-4)
+
+/* What's needed to produce the listing of one message. */
+struct scan_ctx {
+    struct msgs *mp;
+    struct hdr_index *hi;	/* NULL if the folder isn't indexed */
+    char *nfs;
+    int width;
+    char *folder;
+    ivector_t seqnum;		/* the Unseen-Sequence sequences */
+    int num_unseen_seq;
+};
+
+/* A process formatting a share of the messages for -jobs. */
+struct scan_worker {
+    pid_t pid;
+    FILE *fp;			/* reads the worker's results */
+};
+
+static int scan_msg (struct scan_ctx *, int, charstring_t *,
+    struct hdr_index_entry **);
+static void scan_show (int, int, charstring_t, bool *, char *, int);
+static void scan_jobs (struct scan_ctx *, int, bool, bool *, int);
+static void scan_work (struct scan_ctx *, int, int, bool, FILE *);
+
 
 int
 main (int argc, char **argv)
@@ -66,16 +95,18 @@ main (int argc, char **argv)
     bool hdrflag = false;
     int ontty;
     int width = -1;
+    int jobs = 1;
     bool revflag = false;
     int i, state, msgnum;
     ivector_t seqnum = ivector_create (0);
-    bool unseen;
     int num_unseen_seq = 0;
     char *cp, *maildir, *file = NULL, *folder = NULL;
     char *form = NULL, *format = NULL, buf[BUFSIZ];
     char **argp, *nfs, **arguments;
     struct msgs_array msgs = { 0, 0, NULL };
     struct msgs *mp;
+    struct hdr_index *hi;
+    struct scan_ctx ctx;
     charstring_t scanl = NULL;
     FILE *in;
 
@@ -149,6 +180,13 @@ main (int argc, char **argv)
 		    if (strcmp (file = cp, "-"))
 			file = path (cp, TFILE);
 		    continue;
+
+		case JOBSSW:
+		    if (!(cp = *argp++) || *cp == '-')
+			die("missing argument to %s", argp[-2]);
+		    if ((jobs = atoi (cp)) < 1)
+			die("invalid argument to %s: %s", argp[-2], cp);
+		    continue;
 	    }
 	}
 	if (*cp == '+' || *cp == '@') {
@@ -192,7 +230,7 @@ main (int argc, char **argv)
 	scan_detect_mbox_style (in);
 	for (msgnum = 1; ; ++msgnum) {
 	    state = scan (in, msgnum, -1, nfs, width, 0, 0,
-			  hdrflag ? file : NULL, 0L, 1, &scanl);
+			  hdrflag ? file : NULL, 0L, 1, &scanl, NULL);
 	    if (scanl)
 		charstring_clear(scanl);
 	    if (state != SCNMSG)
@@ -253,57 +291,41 @@ main (int argc, char **argv)
 
     ontty = isatty (fileno (stdout));
 
-    for (msgnum = revflag ? mp->hghsel : mp->lowsel;
-	 (revflag ? msgnum >= mp->lowsel : msgnum <= mp->hghsel);
-	 msgnum += (revflag ? -1 : 1)) {
-	if (is_selected(mp, msgnum)) {
-
-	    if ((in = fopen (cp = m_name (msgnum), "r")) == NULL) {
-		    admonish (cp, "unable to open message");
-		continue;
+    /* Use the folder's index of parsed headers, if there is one. */
+    if ((hi = hdr_index_read (mp)))
+	scan_index_prepare (hi, nfs, width, folder, &scanl);
+
+    ctx.mp = mp;
+    ctx.hi = hi;
+    ctx.nfs = nfs;
+    ctx.width = width;
+    ctx.folder = folder;
+    ctx.seqnum = seqnum;
+    ctx.num_unseen_seq = num_unseen_seq;
+
+    if (jobs > 1 && mp->numsel > 1) {
+	scan_jobs (&ctx, jobs, revflag, &hdrflag, ontty);
+    } else {
+	for (msgnum = revflag ? mp->hghsel : mp->lowsel;
+	     (revflag ? msgnum >= mp->lowsel : msgnum <= mp->hghsel);
+	     msgnum += (revflag ? -1 : 1)) {
+	    if (is_selected(mp, msgnum)) {
+		struct hdr_index_entry *hent;
+
+		state = scan_msg (&ctx, msgnum, &scanl, &hent);
+		if (hent)
+		    hdr_index_store (hi, hent);
+		scan_show (msgnum, state, scanl, &hdrflag, folder, ontty);
 	    }
-
-	    if (hdrflag) {
-		printf ("FOLDER %s\t%s\n", folder, dtimenow(1));
-	    }
-
-	    /*
-	     * Check if message is in any sequence given
-	     * by Unseen-Sequence profile entry.
-	     */
-	    unseen = false;
-	    for (i = 0; i < num_unseen_seq; i++) {
-		if (in_sequence(mp, ivector_at (seqnum, i), msgnum)) {
-		    unseen = true;
-		    break;
-		}
-	    }
-
-	    switch (state = scan (in, msgnum, 0, nfs, width,
-			msgnum == mp->curmsg, unseen,
-			folder, 0L, 1, &scanl)) {
-		case SCNMSG: 
-		case SCNERR: 
-		    break;
-
-		default: 
-		    die("scan() botch (%d)", state);
-
-		case SCNEOF: 
-		    inform("message %d: empty", msgnum);
-		    break;
-	    }
-	    if (scanl)
-		charstring_clear(scanl);
-	    scan_finished ();
-	    hdrflag = false;
-	    fclose (in);
-	    if (ontty)
-		fflush (stdout);
 	}
     }
     charstring_free (scanl);
 
+    if (hi) {
+	hdr_index_save (hi, mp);
+	hdr_index_free (hi);
+    }
+
     ivector_free (seqnum);
     folder_free (mp);	/* free folder/message structure */
     if (clearflag)
@@ -312,3 +334,255 @@ main (int argc, char **argv)
     done (0);
     return 1;
 }
+
+
+/*
+ * Produce the listing of one message in *scanl, using the folder's
+ * index if there is one.  If the message had to be parsed and the
+ * folder is indexed, *hentp is set to the message's new index entry,
+ * else to NULL.  Returns the state from scan(), or SCNSKIP.
+ */
+static int
+scan_msg (struct scan_ctx *ctx, int msgnum, charstring_t *scanl,
+	  struct hdr_index_entry **hentp)
+{
+    struct msgs *mp = ctx->mp;
+    struct hdr_index_entry *cached = NULL, *hent = NULL;
+    struct stat st;
+    bool unseen;
+    char *cp;
+    int i, state;
+    FILE *in = NULL;
+
+    *hentp = NULL;
+
+    /*
+     * An up-to-date index entry means that the message file
+     * needn't be opened at all.
+     */
+    if (ctx->hi) {
+	if (stat (cp = m_name (msgnum), &st) == NOTOK) {
+	    admonish (cp, "unable to open message");
+	    return SCNSKIP;
+	}
+	if (! (cached = hdr_index_lookup (ctx->hi, msgnum, &st)))
+	    hent = hdr_index_entry_create (msgnum, &st);
+    }
+    if (! cached  &&
+	(in = fopen (cp = m_name (msgnum), "r")) == NULL) {
+	admonish (cp, "unable to open message");
+	hdr_index_entry_free (hent);
+	return SCNSKIP;
+    }
+
+    /*
+     * Check if message is in any sequence given
+     * by Unseen-Sequence profile entry.
+     */
+    unseen = false;
+    for (i = 0; i < ctx->num_unseen_seq; i++) {
+	if (in_sequence(mp, ivector_at (ctx->seqnum, i), msgnum)) {
+	    unseen = true;
+	    break;
+	}
+    }
+
+    if (cached) {
+	state = scan_entry (cached, msgnum, ctx->nfs, ctx->width,
+			    msgnum == mp->curmsg, unseen,
+			    ctx->folder, 0, scanl);
+    } else {
+	state = scan (in, msgnum, 0, ctx->nfs, ctx->width,
+		      msgnum == mp->curmsg, unseen,
+		      ctx->folder, 0L, 0, scanl, hent);
+	if (state == SCNMSG)
+	    *hentp = hent;
+	else
+	    hdr_index_entry_free (hent);
+    }
+
+    scan_finished ();
+    if (in)
+	fclose (in);
+
+    return state;
+}
+
+
+/*
+ * Output the listing of one message, preceded by the folder heading
+ * if *hdrflag is still set.
+ */
+static void
+scan_show (int msgnum, int state, charstring_t scanl, bool *hdrflag,
+	   char *folder, int ontty)
+{
+    switch (state) {
+	case SCNSKIP:
+	    return;
+
+	case SCNMSG:
+	case SCNERR:
+	case SCNEOF:
+	    break;
+
+	default:
+	    die("scan() botch (%d)", state);
+    }
+
+    if (*hdrflag) {
+	printf ("FOLDER %s\t%s\n", folder, dtimenow(1));
+	*hdrflag = false;
+    }
+    if (scanl) {
+	fputs (charstring_buffer (scanl), stdout);
+	charstring_clear (scanl);
+    }
+    if (state == SCNEOF)
+	inform("message %d: empty", msgnum);
+    if (ontty)
+	fflush (stdout);
+}
+
+
+/*
+ * Scan the selected messages with several processes.  The messages
+ * are dealt out to the workers in turn, and each sends back the
+ * listings of its share, in order, over a pipe.  Reading the pipes in
+ * the same rotation gives the listings in message order.
+ */
+static void
+scan_jobs (struct scan_ctx *ctx, int jobs, bool revflag, bool *hdrflag,
+	   int ontty)
+{
+    struct msgs *mp = ctx->mp;
+    struct scan_worker *workers;
+    charstring_t scanl = NULL;
+    int i, j, msgnum, state, failed = 0;
+
+    if (jobs > mp->numsel)
+	jobs = mp->numsel;
+    workers = mh_xcalloc (jobs, sizeof *workers);
+
+    /* Anything buffered would be output by a worker as well. */
+    fflush (stdout);
+    fflush (stderr);
+
+    for (i = 0; i < jobs; i++) {
+	int pd[2];
+
+	if (pipe (pd) == NOTOK)
+	    adios ("pipe", "unable to");
+
+	switch (workers[i].pid = fork ()) {
+	case NOTOK:
+	    adios ("fork", "unable to");
+	    break;
+
+	case OK:
+	    for (j = 0; j < i; j++)
+		fclose (workers[j].fp);
+	    close (pd[0]);
+	    scan_work (ctx, i, jobs, revflag, fdopen (pd[1], "w"));
+	    _exit (0);
+
+	default:
+	    close (pd[1]);
+	    if ((workers[i].fp = fdopen (pd[0], "r")) == NULL)
+		adios ("pipe", "unable to fdopen");
+	    break;
+	}
+    }
+
+    for (i = 0, msgnum = revflag ? mp->hghsel : mp->lowsel;
+	 (revflag ? msgnum >= mp->lowsel : msgnum <= mp->hghsel);
+	 msgnum += (revflag ? -1 : 1)) {
+	struct hdr_index_entry *hent = NULL;
+	FILE *fp;
+	size_t len;
+	int indexed;
+	char *line;
+
+	if (! is_selected (mp, msgnum))
+	    continue;
+
+	fp = workers[i++ % jobs].fp;
+	if (fscanf (fp, "%d %zu %d", &state, &len, &indexed) != 3  ||
+	    getc (fp) != '\n') {
+	    /* The worker has died;  it's said why. */
+	    failed = 1;
+	    break;
+	}
+	line = mh_xmalloc (len + 1);
+	if (fread (line, 1, len, fp) != len  ||
+	    (indexed  &&  hdr_index_entry_read (fp, &hent) != OK)) {
+	    free (line);
+	    failed = 1;
+	    break;
+	}
+	line[len] = '\0';
+
+	if (hent)
+	    hdr_index_store (ctx->hi, hent);
+	if (! scanl)
+	    scanl = charstring_create (len + 1);
+	charstring_append_cstring (scanl, line);
+	free (line);
+	scan_show (msgnum, state, scanl, hdrflag, ctx->folder, ontty);
+    }
+    charstring_free (scanl);
+
+    for (i = 0; i < jobs; i++) {
+	fclose (workers[i].fp);
+	if (pidwait (workers[i].pid, NOTOK) != 0)
+	    failed = 1;
+    }
+    free (workers);
+
+    if (failed)
+	die("scan worker failed");
+}
+
+
+/*
+ * Run in worker self of jobs:  produce the listings of every jobs'th
+ * selected message, starting with the self'th, and send each to out
+ * as its state, length, and whether an index entry follows, then the
+ * listing, then the entry.
+ */
+static void
+scan_work (struct scan_ctx *ctx, int self, int jobs, bool revflag,
+	   FILE *out)
+{
+    struct msgs *mp = ctx->mp;
+    charstring_t scanl = NULL;
+    int i, msgnum;
+
+    if (out == NULL)
+	adios ("pipe", "unable to fdopen");
+
+    for (i = 0, msgnum = revflag ? mp->hghsel : mp->lowsel;
+	 (revflag ? msgnum >= mp->lowsel : msgnum <= mp->hghsel);
+	 msgnum += (revflag ? -1 : 1)) {
+	struct hdr_index_entry *hent;
+	const char *line;
+	int state;
+
+	if (! is_selected (mp, msgnum)  ||  i++ % jobs != self)
+	    continue;
+
+	state = scan_msg (ctx, msgnum, &scanl, &hent);
+	line = scanl ? charstring_buffer (scanl) : "";
+	fprintf (out, "%d %zu %d\n", state, strlen (line), hent != NULL);
+	fputs (line, out);
+	if (hent) {
+	    hdr_index_entry_write (hent, out);
+	    hdr_index_entry_free (hent);
+	}
+	if (scanl)
+	    charstring_clear (scanl);
+    }
+
+    if (fflush (out) == EOF  ||  ferror (out))
+	_exit (1);
+}
@@ -12,6 +12,7 @@
 #include "sbr/m_gmprot.h"
 #include "sbr/m_getfld.h"
 #include "sbr/getcpy.h"
+#include "sbr/hdr_index.h"
 #include "sbr/error.h"
 #include "h/addrsbr.h"
 #include "h/fmt_scan.h"
@@ -28,6 +29,8 @@ static char **compbuffers = 0;		/* buffers for component text      */
 static struct comp **used_buf = 0;	/* stack for comp that use buffers */
 
 static int dat[5];			/* aux. data for format routine    */
+static int rlwidth;			/* size of each component buffer   */
+static int slwidth;			/* width of the scan line          */
 
 static m_getfld_state_t gstate;		/* for accessor functions below    */
 
@@ -42,6 +45,89 @@ static m_getfld_state_t gstate;		/* for accessor functions below    */
 		    DIEWRERR();\
 		}
 
+/*
+ * First-time initialization:  compile the format and set up the pool
+ * of component buffers.
+ */
+
+static void
+scan_init (char *nfs, int width, int outnum, char *folder, charstring_t *scanl)
+{
+    static bool deja_vu;
+    static int tty_width;
+    struct comp *cptr;
+    char **nxtbuf;
+    int i;
+
+    if (width == -1) {
+	if (!deja_vu) {
+	    deja_vu = true;
+	    tty_width = sc_width();
+	}
+
+	width = max(tty_width, WIDTH / 2);
+    } else if (width == 0) {
+	/* Unlimited width. */
+	width = INT_MAX;
+    }
+    dat[3] = slwidth = width;
+    *scanl = charstring_create (min(width, NMH_BUFSIZ));
+    if (outnum)
+	umask(~m_gmprot());
+
+    /* Compile format string */
+    ncomps = fmt_compile (nfs, &fmt, 1) + 2;
+
+    bodycomp = fmt_findcomp("body");
+    datecomp = fmt_findcomp("date");
+    cptr = fmt_findcomp("folder");
+    if (cptr && folder)
+	cptr->c_text = mh_xstrdup(folder);
+    cptr =  fmt_findcomp("dtimenow");
+    if (cptr)
+	cptr->c_text = getcpy(dtimenow (0));
+
+    /*
+     * In other programs I got rid of this complicated buffer switching,
+     * but since scan reads lots of messages at once and this complicated
+     * memory management, I decided to keep it; otherwise there was
+     * the potential for a lot of malloc() and free()s, and I could
+     * see the malloc() pool really getting fragmented.  Maybe it
+     * wouldn't be an issue in practice; perhaps this will get
+     * revisited someday.
+     *
+     * So, some notes for what's going on:
+     *
+     * nxtbuf is an array of pointers that contains malloc()'d buffers
+     * to hold our component text.  used_buf is an array of struct comp
+     * pointers that holds pointers to component structures we found while
+     * processing a message.
+     *
+     * We read in the message with m_getfld(), using "tmpbuf" as our
+     * input buffer.  tmpbuf is set at the start of message processing
+     * to the first buffer in our buffer pool (nxtbuf).
+     *
+     * Every time we find a component we care about, we set that component's
+     * text buffer to the current value of tmpbuf, and then switch tmpbuf
+     * to the next buffer in our pool.  We also add that component to
+     * our used_buf pool.
+     *
+     * When we're done, we go back and zero out all of the component
+     * text buffer pointers that we saved in used_buf.
+     *
+     * Note that this means c_text memory is NOT owned by the fmt_module
+     * and it's our responsibility to free it.
+     */
+
+    nxtbuf = compbuffers = mh_xcalloc(ncomps, sizeof *nxtbuf);
+    used_buf = mh_xcalloc(ncomps + 1, sizeof *used_buf);
+    used_buf += ncomps+1; *--used_buf = 0;
+    rlwidth = NMH_BUFSIZ;
+    for (i = ncomps; i--; )
+	*nxtbuf++ = mh_xmalloc(rlwidth);
+}
+
+
 /* outnum determines how the input from inb is copied.  If positive then
  * it is the number of the message to create, e.g. for inc(1), and all
  * of the email is copied into that message, with some tweaks.  If 0,
@@ -49,14 +135,16 @@ static m_getfld_state_t gstate;		/* for accessor functions below    */
  * buffer of body, even though this might not be enough to fulfill the
  * scan format and width.  Or if -1 then no copy is being created, but
  * all of inb must be read because the next message must be found, e.g.
- * `scan -file foo.mbox'. */
+ * `scan -file foo.mbox'.
+ *
+ * If hent isn't NULL, the components that were found are added to it
+ * so that the message needn't be parsed again while it's unchanged. */
 
 int
 scan (FILE *inb, int innum, int outnum, char *nfs, int width, int curflg,
-      int unseen, char *folder, long size, int noisy, charstring_t *scanl)
+      int unseen, char *folder, long size, int noisy, charstring_t *scanl,
+      struct hdr_index_entry *hent)
 {
-    static bool deja_vu;
-    static int tty_width;
     int i, compnum, state;
     char *cp, *tmpbuf, *startbody, **nxtbuf;
     char *saved_c_text = NULL;
@@ -66,79 +154,12 @@ scan (FILE *inb, int innum, int outnum, char *nfs, int width, int curflg,
     FILE *scnout = NULL;
     char name[NAMESZ];
     int bufsz;
-    static int rlwidth, slwidth;
 
     /* first-time only initialization, which will always happen the
        way the code is now, with callers initializing *scanl to NULL.
        scanl used to be a global. */
-    if (! *scanl) {
-	if (width == -1) {
-            if (!deja_vu) {
-                deja_vu = true;
-                tty_width = sc_width();
-            }
-
-            width = max(tty_width, WIDTH / 2);
-	} else if (width == 0) {
-	    /* Unlimited width. */
-	    width = INT_MAX;
-	}
-	dat[3] = slwidth = width;
-        *scanl = charstring_create (min(width, NMH_BUFSIZ));
-	if (outnum)
-	    umask(~m_gmprot());
-
-	/* Compile format string */
-	ncomps = fmt_compile (nfs, &fmt, 1) + 2;
-
-	bodycomp = fmt_findcomp("body");
-	datecomp = fmt_findcomp("date");
-	cptr = fmt_findcomp("folder");
-	if (cptr && folder)
-	    cptr->c_text = mh_xstrdup(folder);
-	cptr =  fmt_findcomp("dtimenow");
-	if (cptr)
-	    cptr->c_text = getcpy(dtimenow (0));
-
-	/*
-	 * In other programs I got rid of this complicated buffer switching,
-	 * but since scan reads lots of messages at once and this complicated
-	 * memory management, I decided to keep it; otherwise there was
-	 * the potential for a lot of malloc() and free()s, and I could
-	 * see the malloc() pool really getting fragmented.  Maybe it
-	 * wouldn't be an issue in practice; perhaps this will get
-	 * revisited someday.
-	 *
-	 * So, some notes for what's going on:
-	 *
-	 * nxtbuf is an array of pointers that contains malloc()'d buffers
-	 * to hold our component text.  used_buf is an array of struct comp
-	 * pointers that holds pointers to component structures we found while
-	 * processing a message.
-	 *
-	 * We read in the message with m_getfld(), using "tmpbuf" as our
-	 * input buffer.  tmpbuf is set at the start of message processing
-	 * to the first buffer in our buffer pool (nxtbuf).
-	 *
-	 * Every time we find a component we care about, we set that component's
-	 * text buffer to the current value of tmpbuf, and then switch tmpbuf
-	 * to the next buffer in our pool.  We also add that component to
-	 * our used_buf pool.
-	 *
-	 * When we're done, we go back and zero out all of the component
-	 * text buffer pointers that we saved in used_buf.
-	 *
-	 * Note that this means c_text memory is NOT owned by the fmt_module
-	 * and it's our responsibility to free it.
-	 */
-
-	nxtbuf = compbuffers = mh_xcalloc(ncomps, sizeof *nxtbuf);
-	used_buf = mh_xcalloc(ncomps + 1, sizeof *used_buf);
-	used_buf += ncomps+1; *--used_buf = 0;
-	rlwidth = NMH_BUFSIZ;
-	for (i = ncomps; i--; )
-	    *nxtbuf++ = mh_xmalloc(rlwidth);
-    }
+    if (! *scanl)
+	scan_init (nfs, width, outnum, folder, scanl);
 
     /*
      * each-message initialization
@@ -300,6 +321,16 @@ finished:
 	return SCNFAT;
     }
 
+    /* Remember the components that were found, for the folder's index. */
+    if (hent  &&  state == FILEEOF) {
+	struct comp **cpp;
+
+	for (cpp = savecomp; *cpp; cpp++)
+	    hdr_index_entry_add (hent, (*cpp)->c_name, (*cpp)->c_text);
+	if (bodycomp  &&  startbody)
+	    hdr_index_entry_add (hent, HDR_INDEX_BODY, startbody);
+    }
+
     /* Save and restore buffer so we don't trash our dynamic pool! */
     if (bodycomp) {
 	saved_c_text = bodycomp->c_text;
@@ -352,7 +383,131 @@ finished:
 }
 
 
-/* The following two functions allow access to the global gstate above. */
+/*
+ * Like scan() of a message in a folder, but taking the components
+ * from the folder's index rather than reading the message file.
+ */
+
+int
+scan_entry (struct hdr_index_entry *ep, int innum, char *nfs, int width,
+	    int curflg, int unseen, char *folder, int noisy,
+	    charstring_t *scanl)
+{
+    char **nxtbuf, *startbody = NULL, *saved_c_text = NULL;
+    struct comp *cptr, **savecomp;
+    size_t i;
+
+    if (! *scanl)
+	scan_init (nfs, width, 0, folder, scanl);
+
+    nxtbuf = compbuffers;
+    savecomp = used_buf;
+    dat[0] = innum;
+    dat[1] = curflg;
+    dat[2] = ep->size;
+    dat[4] = unseen;
+
+    /* Copy the text into the buffer pool, just as scan() would have
+     * read it there, because fmt_scan() can alter it. */
+    for (i = 0; i < ep->nfields  &&  nxtbuf < compbuffers + ncomps; i++) {
+	struct hdr_index_field *fp = &ep->fields[i];
+
+	if (strcmp (fp->name, HDR_INDEX_BODY) == 0) {
+	    if (bodycomp) {
+		startbody = *nxtbuf++;
+		trunccpy (startbody, fp->text, rlwidth);
+	    }
+	} else if ((cptr = fmt_findcasecomp (fp->name))  &&  ! cptr->c_text) {
+	    cptr->c_text = *nxtbuf++;
+	    trunccpy (cptr->c_text, fp->text, rlwidth);
+	    *--savecomp = cptr;
+	}
+    }
+
+    if (bodycomp) {
+	saved_c_text = bodycomp->c_text;
+	bodycomp->c_text = startbody;
+    }
+
+    if (datecomp) {
+	if (! datecomp->c_text) {
+	    if (datecomp->c_tws == NULL)
+		NEW0(datecomp->c_tws);
+	    *datecomp->c_tws = *dlocaltime (&ep->mtime);
+	    datecomp->c_flags |= CF_DATEFAB|CF_TRUE;
+	} else {
+	    datecomp->c_flags &= ~CF_DATEFAB;
+	}
+    }
+
+    fmt_scan (fmt, *scanl, slwidth, dat, NULL);
+
+    if (bodycomp)
+	bodycomp->c_text = saved_c_text;
+
+    if (noisy)
+	fputs (charstring_buffer (*scanl), stdout);
+
+    /* return dynamically allocated buffers to pool */
+    while ((cptr = *savecomp++)) {
+	cptr->c_text = NULL;
+    }
+
+    return SCNMSG;
+}
+
+
+/*
+ * Make sure the folder's index holds every component that the scan
+ * format refers to.
+ */
+
+void
+scan_index_prepare (struct hdr_index *hi, char *nfs, int width, char *folder,
+		    charstring_t *scanl)
+{
+    struct comp *cptr = NULL;
+    unsigned int bucket;
+    svector_t names;
+    size_t i;
+    int j, added;
+
+    if (! *scanl)
+	scan_init (nfs, width, 0, folder, scanl);
+
+    names = svector_create (ncomps);
+    while ((cptr = fmt_nextcomp (cptr, &bucket)))
+	svector_push_back (names, cptr->c_name);
+    hdr_index_require (hi, svector_strs (names), svector_size (names));
+    svector_free (names);
+
+    /*
+     * An entry must hold all of the index's components, not just this
+     * format's, so that other formats and sortm can use it.  So collect
+     * the others too, each in a buffer of its own.
+     */
+    for (i = added = 0; i < svector_size (hi->comps); i++) {
+	if (! fmt_findcasecomp (svector_at (hi->comps, i))) {
+	    fmt_addcompentry (svector_at (hi->comps, i));
+	    added++;
+	}
+    }
+    if (! bodycomp)
+	bodycomp = fmt_findcomp ("body");
+    if (added) {
+	compbuffers = mh_xrealloc (compbuffers,
+				   (ncomps + added) * sizeof *compbuffers);
+	for (j = ncomps; j < ncomps + added; j++)
+	    compbuffers[j] = mh_xmalloc (rlwidth);
+	free (used_buf - ncomps);
+	ncomps += added;
+	used_buf = mh_xcalloc (ncomps + 1, sizeof *used_buf);
+	used_buf += ncomps;
+    }
+}
+
+
+/* The following functions allow access to the global gstate above. */
 void
 scan_finished(void)
 {
@@ -364,3 +519,11 @@ scan_detect_mbox_style (FILE *f)
 {
     m_unknown (&gstate, f);
 }
+
+/* f is locked, so scan() may map it into memory.  Call before
+ * scan_detect_mbox_style(). */
+void
+scan_map_input (FILE *f)
+{
+    m_getfld_map_input (&gstate, f);
+}
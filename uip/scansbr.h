@@ -23,6 +23,15 @@
 
 #define	WIDTH  78
 
-int scan(FILE *, int, int, char *, int, int, int, char *, long, int, charstring_t *);
+struct hdr_index;
+struct hdr_index_entry;
+
+int scan(FILE *, int, int, char *, int, int, int, char *, long, int,
+    charstring_t *, struct hdr_index_entry *);
+int scan_entry(struct hdr_index_entry *, int, char *, int, int, int, char *,
+    int, charstring_t *);
+void scan_index_prepare(struct hdr_index *, char *, int, char *,
+    charstring_t *);
 void scan_finished(void);
 void scan_detect_mbox_style(FILE *);
+void scan_map_input(FILE *);
@@ -76,6 +76,7 @@
     X("watch", 0, WATCSW) \
     X("nowatch", 0, NWATCSW) \
     X("width columns", 0, WIDTHSW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
     X("dashstuffing", -12, BITSTUFFSW) \
@@ -123,6 +124,7 @@ extern int debugsw;		/* from sendsbr.c */
 extern bool forwsw;
 extern int inplace;
 extern bool pushsw;
+extern bool sessionsw;
 extern bool unique;
 extern bool verbsw;
 
@@ -298,6 +300,7 @@ main (int argc, char **argv)
 		case ALIASW: 
 		case FILTSW: 
 		case WIDTHSW: 
+		case JOBSSW:
 		case CLIESW: 
 		case SERVSW: 
 		case PORTSW:
@@ -476,6 +479,9 @@ go_to_it:
 
     status = 0;
 
+    /* The drafts' posts can share one connection to the server. */
+    sessionsw = msgp > 1;
+
     for (msgnum = 0; msgnum < msgp; msgnum++) {
         switch (sendsbr (vec, vecp, program, msgs[msgnum], &st, 1, auth_svc)) {
 	    case DONE: 
@@ -488,6 +494,7 @@ go_to_it:
 		break;
 	}
     }
+    end_session ();
 
     context_save ();	/* save the context file */
     done (status);
@@ -26,11 +26,13 @@
 #include "sbr/pidstatus.h"
 #include "sbr/arglist.h"
 #include "sbr/error.h"
+#include "sbr/r1bindex.h"
 #include "h/fmt_scan.h"
 #include "h/fmt_compile.h"
 #include "h/signals.h"
 #include <setjmp.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include "h/mime.h"
 #include "h/tws.h"
 #include "h/utils.h"
@@ -57,6 +59,7 @@ int debugsw = 0;		/* global */
 bool forwsw = true;
 int inplace = 1;
 bool pushsw;
+bool sessionsw;			/* share one session among the posts */
 bool unique;
 bool verbsw;
 
@@ -66,6 +69,10 @@ char *distfile = NULL;
 
 static jmp_buf env;
 
+static bool session_tried;
+static int session = NOTOK;	/* socket the posts attach to it with */
+static pid_t session_pid;
+
 /*
  * static prototypes
  */
@@ -74,6 +81,7 @@ static int tmp_fd (void);
 static void anno (int, struct stat *);
 static void annoaux (int);
 static int sendaux (char **, int, char *, char *, struct stat *);
+static void start_session (char **, int, char *);
 static void handle_sendfrom(char **, int *, char *, const char *);
 static int get_from_header_info(const char *, const char **, const char **, const char **);
 static const char *get_message_header_info(FILE *, char *);
@@ -200,11 +208,19 @@ sendaux (char **vec, int vecp, char *program, char *drft, struct stat *st)
 {
     pid_t child_id;
     int status, fd, fd2;
-    char backup[BUFSIZ], buf[BUFSIZ];
+    char backup[BUFSIZ], buf[BUFSIZ], sbuf[BUFSIZ];
 
     fd = pushsw ? tmp_fd () : NOTOK;
     fd2 = NOTOK;
 
+    if (sessionsw && !session_tried)
+	start_session (vec, vecp, program);
+    if (session != NOTOK) {
+	vec[vecp++] = "-session";
+	snprintf (sbuf, sizeof(sbuf), "%d", session);
+	vec[vecp++] = sbuf;
+    }
+
     if (annotext) {
 	if ((fd2 = tmp_fd ()) != NOTOK) {
 	    vec[vecp++] = "-idanno";
@@ -239,6 +255,8 @@ sendaux (char **vec, int vecp, char *program, char *drft, struct stat *st)
 	    dup2 (fd, fileno (stderr));
 	    close (fd);
 	}
+	if (session != NOTOK)
+	    fcntl (session, F_SETFD, 0);
 	execvp (program, vec);
 	fprintf (stderr, "unable to exec ");
 	perror (postproc);
@@ -278,6 +296,72 @@ sendaux (char **vec, int vecp, char *program, char *drft, struct stat *st)
 }
 
 
+/*
+ * Start a post without a file, which keeps its connection to the
+ * server open for the posts of each of the drafts, so that only the
+ * first connects and authenticates.  The others are given a socket to
+ * reach it with -session;  any whose switches for the server differ,
+ * say from sendfrom- entries, connect for themselves.
+ */
+
+static void
+start_session (char **vec, int vecp, char *program)
+{
+    int sv[2];
+    char buf[BUFSIZ];
+
+    session_tried = true;
+    if (debugsw || strcmp (r1bindex (program, '/'), "post"))
+	return;
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == NOTOK) {
+	advise ("socketpair", "unable to share a session, continuing...");
+	return;
+    }
+
+    switch (session_pid = fork ()) {
+    case NOTOK:
+	advise ("fork", "unable to share a session, continuing...");
+	close (sv[0]);
+	close (sv[1]);
+	return;
+
+    case OK:
+	close (sv[0]);
+	vec[vecp++] = "-session";
+	snprintf (buf, sizeof(buf), "%d", sv[1]);
+	vec[vecp++] = buf;
+	vec[vecp] = NULL;
+	execvp (program, vec);
+	fprintf (stderr, "unable to exec ");
+	perror (postproc);
+	_exit(1);
+
+    default:
+	close (sv[1]);
+	session = sv[0];
+	/* Only the posts get it. */
+	fcntl (session, F_SETFD, FD_CLOEXEC);
+	break;
+    }
+}
+
+
+/*
+ * End the session, which has the server QUIT.
+ */
+
+void
+end_session (void)
+{
+    if (session == NOTOK)
+	return;
+
+    close (session);
+    session = NOTOK;
+    (void) pidwait (session_pid, NOTOK);
+}
+
+
 /*
  * Mail error notification (and possibly a copy of the
  * message) back to the user, using the mailproc
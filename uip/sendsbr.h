@@ -5,3 +5,4 @@
  * complete copyright information. */
 
 int sendsbr(char **, int, char *, char *, struct stat *, int, const char *);
+void end_session (void);
@@ -10,6 +10,7 @@
 #include "sbr/m_name.h"
 #include "sbr/m_getfld.h"
 #include "sbr/getarguments.h"
+#include "sbr/seq_msgs.h"
 #include "sbr/seq_setprev.h"
 #include "sbr/seq_setcur.h"
 #include "sbr/seq_save.h"
@@ -32,6 +33,8 @@
 #include "h/done.h"
 #include "h/utils.h"
 #include "sbr/m_maildir.h"
+#include "sbr/hdr_index.h"
+#include <inttypes.h>
 
 #define SORTM_SWITCHES \
     X("datefield field", 0, DATESW) \
@@ -46,6 +49,9 @@
     X("noall", 0, NALLMSGS) \
     X("check", 0, CHECKSW) \
     X("nocheck", 0, NCHECKSW) \
+    X("jobs number", 0, JOBSSW) \
+    X("dryrun", 0, DRYSW) \
+    X("nodryrun", 0, NDRYSW) \
     X("version", 0, VERSIONSW) \
     X("help", 0, HELPSW) \
 
@@ -66,6 +72,22 @@ struct smsg {
 static struct smsg *smsgs;
 int nmsgs;
 
+/* A process parsing a share of the messages for -jobs. */
+struct sortm_worker {
+    pid_t pid;
+    FILE *fp;			/* reads the worker's results */
+};
+
+/*
+ * One rename of the plan for putting the messages in sorted order.
+ * A move to the number past the end of the folder parks the first
+ * message of a cycle, which is to end up as last.
+ */
+struct sortm_move {
+    int old, new;
+    int last;
+};
+
 char *subjsort;                 /* sort on subject if != 0 */
 time_t datelimit = 0;
 bool submajor;			/* if true, sort on subject-major */
@@ -79,13 +101,25 @@ typedef int (*qsort_comp) (const void *, const void *);
 /*
  * static prototypes
  */
-static int read_hdrs (struct msgs *, char *);
-static int get_fields (char *, int, struct smsg *);
+static int read_hdrs (struct msgs *, char *, struct hdr_index *, int);
+static char *index_comp (struct hdr_index *, char *);
+static char *index_text (struct hdr_index_entry *, char *);
+static int get_cached (char *, int, struct smsg *, struct hdr_index *);
+static int get_fields (char *, int, struct smsg *, struct hdr_index *,
+    struct hdr_index_entry **);
+static void set_keys (char *, int, struct smsg *, char *, char *, time_t);
+static void get_jobs (char *, int *, int, struct hdr_index *, int);
+static void get_work (char *, int *, int, struct hdr_index *, int, int,
+    FILE *);
+static void renumber_index (struct hdr_index *, struct smsg **);
 static int dsort (struct smsg **, struct smsg **);
 static int subsort (struct smsg **, struct smsg **);
 static int txtsort (struct smsg **, struct smsg **);
-static void rename_chain (struct msgs *, struct smsg **, int, int);
-static void rename_msgs (struct msgs *, struct smsg **);
+static struct sortm_move *plan_moves (struct msgs *, struct smsg **, int *,
+				      int *);
+static void rename_msgs (struct msgs *, struct smsg **, struct sortm_move *,
+			 int);
+static void print_moves (struct msgs *, struct sortm_move *, int, int);
 
 
 int
@@ -98,7 +132,11 @@ main (int argc, char **argv)
     struct msgs_array msgs = { 0, 0, NULL };
     struct msgs *mp;
     struct smsg **dlist;
+    struct hdr_index *hi;
+    struct sortm_move *plan;
     bool checksw = false;
+    bool dryrun = false;
+    int jobs = 1, nmoves, ncycles;
 
     if (nmh_init(argv[0], true, true)) { return 1; }
 
@@ -185,6 +223,20 @@ main (int argc, char **argv)
 	    case NCHECKSW:
 		checksw = false;
 		continue;
+
+	    case JOBSSW:
+		if (!(cp = *argp++) || *cp == '-')
+		    die("missing argument to %s", argp[-2]);
+		if ((jobs = atoi (cp)) < 1)
+		    die("invalid argument to %s: %s", argp[-2], cp);
+		continue;
+
+	    case DRYSW:
+		dryrun = true;
+		continue;
+	    case NDRYSW:
+		dryrun = false;
+		continue;
 	    }
 	}
 	if (*cp == '+' || *cp == '@') {
@@ -227,7 +279,23 @@ main (int argc, char **argv)
 	    done (1);
     seq_setprev (mp);	/* set the previous sequence */
 
-    if ((nmsgs = read_hdrs (mp, datesw)) <= 0)
+    /* Have the folder's header index hold the fields of the keys. */
+    if ((hi = hdr_index_read (mp))) {
+	char *keys[2];
+
+	keys[0] = datesw;
+	keys[1] = subjsort;
+	for (i = 0; i < 2 && keys[i]; i++) {
+	    if (index_comp (hi, keys[i]))
+		continue;
+	    keys[i] = mh_xstrdup(keys[i]);
+	    to_lower (keys[i]);
+	    hdr_index_require (hi, &keys[i], 1);
+	    free (keys[i]);
+	}
+    }
+
+    if ((nmsgs = read_hdrs (mp, datesw, hi, jobs)) <= 0)
 	die("no messages to sort");
 
     if (checksw  &&  check_failed) {
@@ -317,57 +385,181 @@ main (int argc, char **argv)
      * each of which contains a message number.
      */
 
-    rename_msgs (mp, dlist);
+    plan = plan_moves (mp, dlist, &nmoves, &ncycles);
+    if (dryrun) {
+	print_moves (mp, plan, nmoves, ncycles);
+    } else {
+	if (hi)
+	    renumber_index (hi, dlist);
+	rename_msgs (mp, dlist, plan, nmoves);
+    }
+    free (plan);
+    if (hi) {
+	if (!dryrun)
+	    hdr_index_save (hi, mp);
+	hdr_index_free (hi);
+    }
 
-    context_replace (pfolder, folder);	/* update current folder         */
-    seq_save (mp);			/* synchronize message sequences */
-    context_save ();			/* save the context file         */
+    if (!dryrun) {
+	context_replace (pfolder, folder);	/* update current folder         */
+	seq_save (mp);				/* synchronize message sequences */
+	context_save ();			/* save the context file         */
+    }
     folder_free (mp);			/* free folder/message structure */
     done (0);
     return 1;
 }
 
+/*
+ * Get the keys of the selected messages into smsgs[], from the
+ * folder's index where it has them, else by parsing the messages.
+ * Returns how many messages there are to sort.
+ */
+
 static int
-read_hdrs (struct msgs *mp, char *datesw)
+read_hdrs (struct msgs *mp, char *datesw, struct hdr_index *hi, int jobs)
 {
-    int msgnum;
-    struct smsg *s;
+    int msgnum, i, n, ntodo;
+    int *todo;			/* smsgs[] that must be parsed */
 
     smsgs = mh_xcalloc(mp->hghsel - mp->lowsel + 2, sizeof *smsgs);
-    s = smsgs;
+    todo = mh_xcalloc(mp->hghsel - mp->lowsel + 2, sizeof *todo);
+    n = ntodo = 0;
     for (msgnum = mp->lowsel; msgnum <= mp->hghsel; msgnum++) {
 	if (is_selected(mp, msgnum)) {
-	    if (get_fields (datesw, msgnum, s)) {
-		s->s_msg = msgnum;
-		s++;
+	    smsgs[n].s_msg = msgnum;
+	    if (! hi  ||  ! get_cached (datesw, msgnum, &smsgs[n], hi))
+		todo[ntodo++] = n;
+	    n++;
+	}
+    }
+
+    if (jobs > 1  &&  ntodo > 1) {
+	get_jobs (datesw, todo, ntodo, hi, jobs);
+    } else {
+	for (i = 0; i < ntodo; i++) {
+	    struct smsg *s = &smsgs[todo[i]];
+	    struct hdr_index_entry *hent;
+
+	    if (get_fields (datesw, s->s_msg, s, hi, &hent)) {
+		if (hent)
+		    hdr_index_store (hi, hent);
+	    } else {
+		s->s_msg = 0;
 	    }
 	}
     }
-    s->s_msg = 0;
-    return s - smsgs;
+    free (todo);
+
+    /* Drop the messages that couldn't be read. */
+    for (i = msgnum = 0; i < n; i++)
+	if (smsgs[i].s_msg)
+	    smsgs[msgnum++] = smsgs[i];
+    smsgs[msgnum].s_msg = 0;
+    return msgnum;
+}
+
+
+/*
+ * Return the index's name for the named field, if it holds its text,
+ * else NULL.
+ */
+
+static char *
+index_comp (struct hdr_index *hi, char *name)
+{
+    size_t i;
+
+    for (i = 0; i < svector_size (hi->comps); i++)
+	if (! strcasecmp (svector_at (hi->comps, i), name))
+	    return svector_at (hi->comps, i);
+
+    return NULL;
+}
+
+
+/*
+ * Return the text of the named field in an index entry, or NULL if
+ * the message doesn't have it.
+ */
+
+static char *
+index_text (struct hdr_index_entry *ep, char *name)
+{
+    size_t i;
+
+    for (i = 0; i < ep->nfields; i++)
+	if (! strcasecmp (ep->fields[i].name, name))
+	    return ep->fields[i].text;
+
+    return NULL;
+}
+
+
+/*
+ * Get a message's keys from the index, if it has an entry that's
+ * still valid.
+ */
+
+static int
+get_cached (char *datesw, int msg, struct smsg *smsg, struct hdr_index *hi)
+{
+    struct hdr_index_entry *ep;
+    struct stat st;
+    char *datecomp, *subjcomp = NULL;
+
+    if (stat (m_name (msg), &st) == NOTOK  ||
+	! (ep = hdr_index_lookup (hi, msg, &st)))
+	return 0;
+
+    /* The index holds at most a buffer's worth of each field, so
+     * a field that fills it may have been cut short. */
+    datecomp = index_text (ep, datesw);
+    if (subjsort)
+	subjcomp = index_text (ep, subjsort);
+    if ((datecomp  &&  strlen (datecomp) >= NMH_BUFSIZ - 1)  ||
+	(subjcomp  &&  strlen (subjcomp) >= NMH_BUFSIZ - 1))
+	return 0;
+
+    set_keys (datesw, msg, smsg, datecomp,
+	      subjcomp ? mh_xstrdup(subjcomp) : NULL, ep->mtime);
+    return 1;
 }
 
 
 /*
  * Parse the message and get the data or subject field,
- * if needed.
+ * if needed.  If the folder is indexed, *hentp is set to a
+ * new index entry for the message, else to NULL.
  */
 
 static int
-get_fields (char *datesw, int msg, struct smsg *smsg)
+get_fields (char *datesw, int msg, struct smsg *smsg, struct hdr_index *hi,
+	    struct hdr_index_entry **hentp)
 {
     int state;
     int compnum;
     char *msgnam, buf[NMH_BUFSIZ], nam[NAMESZ];
-    struct tws *tw;
-    char *datecomp = NULL, *subjcomp = NULL;
+    char *datecomp = NULL, *subjcomp = NULL, *cname;
+    struct hdr_index_entry *hent = NULL;
+    struct stat st;
     FILE *in;
     m_getfld_state_t gstate;
 
+    *hentp = NULL;
     if ((in = fopen (msgnam = m_name (msg), "r")) == NULL) {
 	admonish (msgnam, "unable to read message");
 	return 0;
     }
+    fstat (fileno (in), &st);
+
+    /*
+     * An entry has to hold all of the fields that the index does, as
+     * scan would have found them, so that scan can use it too.
+     */
+    if (hi)
+	hent = hdr_index_entry_create (msg, &st);
+
     gstate = m_getfld_state_init(in);
     for (compnum = 1;;) {
 	int bufsz = sizeof buf;
@@ -375,6 +567,16 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 	case FLD:
 	case FLDPLUS:
 	    compnum++;
+	    if (hent  &&  (cname = index_comp (hi, nam))  &&
+		! index_text (hent, cname)) {
+		char *cp, *text = mh_xstrdup(buf);
+
+		for (cp = text + strlen (text) - 1;
+		     cp >= text  &&  isspace ((unsigned char) *cp); cp--)
+		    *cp = '\0';
+		hdr_index_entry_add (hent, cname, text);
+		free (text);
+	    }
 	    if (!strcasecmp (nam, datesw)) {
 		datecomp = add (buf, datecomp);
 		while (state == FLDPLUS) {
@@ -382,7 +584,7 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 		    state = m_getfld2(&gstate, nam, buf, &bufsz);
 		    datecomp = add (buf, datecomp);
 		}
-		if (!subjsort || subjcomp)
+		if (!hent && (!subjsort || subjcomp))
 		    break;
 	    } else if (subjsort && !strcasecmp (nam, subjsort)) {
 		subjcomp = add (buf, subjcomp);
@@ -391,7 +593,7 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 		    state = m_getfld2(&gstate, nam, buf, &bufsz);
 		    subjcomp = add (buf, subjcomp);
 		}
-		if (datecomp)
+		if (!hent && datecomp)
 		    break;
 	    } else {
 		/* just flush this guy */
@@ -403,7 +605,24 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 	    continue;
 
 	case BODY:
+	    /* Keep as much of the start of the body as scan does. */
+	    if (hent  &&  index_comp (hi, "body")) {
+		int i;
+
+		if ((i = strlen (buf)) < (int) sizeof buf) {
+		    bufsz = sizeof buf - i;
+		    m_getfld2(&gstate, nam, buf + i, &bufsz);
+		}
+		hdr_index_entry_add (hent, HDR_INDEX_BODY, buf);
+	    }
+	    break;
+
 	case FILEEOF:
+	    /* scan doesn't index an empty message. */
+	    if (compnum == 1) {
+		hdr_index_entry_free (hent);
+		hent = NULL;
+	    }
 	    break;
 
 	case LENERR:
@@ -415,6 +634,7 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 	    }
             free(datecomp);
             free(subjcomp);
+	    hdr_index_entry_free (hent);
 	    fclose (in);
 	    return 0;
 
@@ -424,18 +644,36 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 	break;
     }
     m_getfld_state_destroy (&gstate);
+    fclose (in);
+
+    set_keys (datesw, msg, smsg, datecomp, subjcomp, st.st_mtime);
+    free(datecomp);
+    *hentp = hent;
+
+    return 1;
+}
+
+
+/*
+ * Set a message's sort keys from the text of its date and
+ * subject fields, either of which may be NULL.  subjcomp
+ * is kept by the smsg.
+ */
+
+static void
+set_keys (char *datesw, int msg, struct smsg *smsg, char *datecomp,
+	  char *subjcomp, time_t mtime)
+{
+    struct tws *tw;
 
     /*
      * If no date component, then use the modification
      * time of the file as its date
      */
     if (!datecomp || (tw = dparsetime (datecomp)) == NULL) {
-	struct stat st;
-
 	inform("can't parse %s field in message %d, "
             "will use file modification time", datesw, msg);
-	fstat (fileno (in), &st);
-	smsg->s_clock = st.st_mtime;
+	smsg->s_clock = mtime;
 	check_failed = 1;
     } else {
 	smsg->s_clock = dmktime (tw);
@@ -475,10 +713,173 @@ get_fields (char *datesw, int msg, struct smsg *smsg)
 
 	smsg->s_subj = subjcomp;
     }
-    fclose (in);
-    free(datecomp);
+}
 
-    return 1;
+
+/*
+ * Parse the messages in smsgs[todo[]] with several processes.  They
+ * are dealt out to the workers in turn, and each sends back the keys
+ * of its share, in order, over a pipe.  A message that couldn't be
+ * read has its s_msg cleared.
+ */
+
+static void
+get_jobs (char *datesw, int *todo, int ntodo, struct hdr_index *hi, int jobs)
+{
+    struct sortm_worker *workers;
+    int i, j, failed = 0;
+
+    if (jobs > ntodo)
+	jobs = ntodo;
+    workers = mh_xcalloc (jobs, sizeof *workers);
+
+    /* Anything buffered would be output by a worker as well. */
+    fflush (stdout);
+    fflush (stderr);
+
+    for (i = 0; i < jobs; i++) {
+	int pd[2];
+
+	if (pipe (pd) == NOTOK)
+	    adios ("pipe", "unable to");
+
+	switch (workers[i].pid = fork ()) {
+	case NOTOK:
+	    adios ("fork", "unable to");
+	    break;
+
+	case OK:
+	    for (j = 0; j < i; j++)
+		fclose (workers[j].fp);
+	    close (pd[0]);
+	    get_work (datesw, todo, ntodo, hi, i, jobs, fdopen (pd[1], "w"));
+	    _exit (0);
+
+	default:
+	    close (pd[1]);
+	    if ((workers[i].fp = fdopen (pd[0], "r")) == NULL)
+		adios ("pipe", "unable to fdopen");
+	    break;
+	}
+    }
+
+    for (i = 0; i < ntodo; i++) {
+	struct smsg *s = &smsgs[todo[i]];
+	struct hdr_index_entry *hent = NULL;
+	FILE *fp = workers[i % jobs].fp;
+	intmax_t clock;
+	size_t len;
+	int ok, failures, indexed;
+
+	if (fscanf (fp, "%d %" SCNdMAX " %d %zu %d", &ok, &clock, &failures,
+		    &len, &indexed) != 5  ||
+	    getc (fp) != '\n') {
+	    /* The worker has died;  it's said why. */
+	    failed = 1;
+	    break;
+	}
+	if (failures)
+	    check_failed = 1;
+	if (! ok) {
+	    s->s_msg = 0;
+	    continue;
+	}
+
+	s->s_clock = clock;
+	if (subjsort) {
+	    s->s_subj = mh_xmalloc (len + 1);
+	    if (fread (s->s_subj, 1, len, fp) != len) {
+		failed = 1;
+		break;
+	    }
+	    s->s_subj[len] = '\0';
+	}
+	if (indexed) {
+	    if (hdr_index_entry_read (fp, &hent) != OK) {
+		failed = 1;
+		break;
+	    }
+	    hdr_index_store (hi, hent);
+	}
+    }
+
+    for (i = 0; i < jobs; i++) {
+	fclose (workers[i].fp);
+	if (pidwait (workers[i].pid, NOTOK) != 0)
+	    failed = 1;
+    }
+    free (workers);
+
+    if (failed)
+	die("sortm worker failed");
+}
+
+
+/*
+ * Run in worker self of jobs:  parse every jobs'th message of
+ * smsgs[todo[]], starting with the self'th, and send its keys to
+ * out as whether it could be read, its date, whether there were
+ * any complaints about it, the length of its subject key, and
+ * whether an index entry follows, then the subject key, then the
+ * entry.
+ */
+
+static void
+get_work (char *datesw, int *todo, int ntodo, struct hdr_index *hi,
+	  int self, int jobs, FILE *out)
+{
+    int i;
+
+    if (out == NULL)
+	adios ("pipe", "unable to fdopen");
+
+    for (i = self; i < ntodo; i += jobs) {
+	struct smsg *s = &smsgs[todo[i]];
+	struct hdr_index_entry *hent;
+	int ok;
+
+	check_failed = 0;
+	ok = get_fields (datesw, s->s_msg, s, hi, &hent);
+	fprintf (out, "%d %" PRIdMAX " %d %zu %d\n", ok,
+		 ok ? (intmax_t) s->s_clock : 0, check_failed,
+		 ok && subjsort ? strlen (s->s_subj) : 0, hent != NULL);
+	if (ok  &&  subjsort)
+	    fputs (s->s_subj, out);
+	if (hent) {
+	    hdr_index_entry_write (hent, out);
+	    hdr_index_entry_free (hent);
+	}
+	if (ok && subjsort && *s->s_subj)
+	    free (s->s_subj);
+    }
+
+    if (fflush (out) == EOF  ||  ferror (out))
+	_exit (1);
+}
+
+
+/*
+ * Move the index entries of the messages that were renamed to their
+ * new numbers.  Renaming a file doesn't change what keys its entry,
+ * so the sorted messages needn't be parsed again.
+ */
+
+static void
+renumber_index (struct hdr_index *hi, struct smsg **mlist)
+{
+    struct hdr_index_entry **moved;
+    int i;
+
+    moved = mh_xcalloc (nmsgs, sizeof *moved);
+    for (i = 0; i < nmsgs; i++)
+	moved[i] = hdr_index_remove (hi, mlist[i]->s_msg);
+    for (i = 0; i < nmsgs; i++) {
+	if (moved[i]) {
+	    moved[i]->msgnum = smsgs[i].s_msg;
+	    hdr_index_store (hi, moved[i]);
+	}
+    }
+    free (moved);
 }
 
 /*
@@ -522,105 +923,143 @@ txtsort (struct smsg **a, struct smsg **b)
     return 1;
 }
 
-static void
-rename_chain (struct msgs *mp, struct smsg **mlist, int msg, int endmsg)
-{
-    int nxt, old, new;
-    char *newname, oldname[BUFSIZ];
-    char newbuf[PATH_MAX + 1];
-
-    for (;;) {
-	nxt = mlist[msg] - smsgs;	/* mlist[msg] is a ptr into smsgs */
-	mlist[msg] = NULL;
-	old = smsgs[nxt].s_msg;
-	new = smsgs[msg].s_msg;
-	strncpy (oldname, m_name (old), sizeof(oldname));
-	newname = m_name (new);
-	if (verbose)
-	    printf ("message %d becomes message %d\n", old, new);
-
-	(void)snprintf(oldname, sizeof (oldname), "%s/%d", mp->foldpath, old);
-	(void)snprintf(newbuf, sizeof (newbuf), "%s/%d", mp->foldpath, new);
-	ext_hook("ref-hook", oldname, newbuf);
-
-	if (rename (oldname, newname) == NOTOK)
-	    adios (newname, "unable to rename %s to", oldname);
-
-	copy_msg_flags (mp, new, old);
-	if (mp->curmsg == old)
-	    seq_setcur (mp, new);
-
-	if (nxt == endmsg)
-	    break;
-
-	msg = nxt;
-    }
-/*	if (nxt != endmsg); */
-/*	rename_chain (mp, mlist, nxt, endmsg); */
-}
+/*
+ * Plan the renames that put the messages of mlist at their sorted
+ * numbers.  The permutation is followed a cycle at a time: the first
+ * message of each cycle is parked at the number past the end of the
+ * folder, the rest of the cycle moves up behind it, and the parked
+ * message goes to the hole that's left.  So a cycle of n messages
+ * takes n + 1 renames, and messages that don't move take none.
+ */
 
-static void
-rename_msgs (struct msgs *mp, struct smsg **mlist)
+static struct sortm_move *
+plan_moves (struct msgs *mp, struct smsg **mlist, int *nmoves, int *ncycles)
 {
-    int i, j, old, new;
-    bvector_t tmpset = bvector_create ();
-    char f1[BUFSIZ], tmpfil[BUFSIZ];
-    char newbuf[PATH_MAX + 1];
-    struct smsg *sp;
+    struct sortm_move *plan, *mv;
+    char *moved;
+    int i, j, nxt, spare = mp->hghmsg + 1;
 
-    strncpy (tmpfil, m_name (mp->hghmsg + 1), sizeof(tmpfil));
+    /* Every cycle holds at least two messages. */
+    plan = mh_xmalloc ((nmsgs + nmsgs / 2 + 1) * sizeof *plan);
+    moved = mh_xcalloc (nmsgs, sizeof *moved);
+    mv = plan;
+    *ncycles = 0;
 
     for (i = 0; i < nmsgs; i++) {
-	if (! (sp = mlist[i]))
-	    continue;   /* did this one */
-
-	j = sp - smsgs;
-	if (j == i)
-	    continue;   /* this one doesn't move */
+	if (moved[i] || (j = mlist[i] - smsgs) == i)
+	    continue;	/* done already, or doesn't move */
+
+	/* the message that was j is to become i */
+	mv->old = smsgs[j].s_msg;
+	mv->new = spare;
+	mv->last = smsgs[i].s_msg;
+	mv++;
+	for (; j != i; j = nxt) {
+	    moved[j] = 1;
+	    nxt = mlist[j] - smsgs;
+	    mv->old = smsgs[nxt].s_msg;
+	    mv->new = smsgs[j].s_msg;
+	    mv++;
+	}
+	moved[i] = 1;
+	mv->old = spare;
+	mv->new = smsgs[i].s_msg;
+	mv++;
+	(*ncycles)++;
+    }
 
-	/*
-	 * the guy that was msg j is about to become msg i.
-	 * rename 'j' to make a hole, then recursively rename
-	 * guys to fill up the hole.
-	 */
-	old = smsgs[j].s_msg;
-	new = smsgs[i].s_msg;
-	strncpy (f1, m_name (old), sizeof(f1));
+    free (moved);
+    *nmoves = mv - plan;
+    return plan;
+}
 
-	if (verbose)
-	    printf ("renaming message chain from %d to %d\n", old, new);
+/*
+ * Carry out the plan: rename the files, then move the messages' flags
+ * and sequences to their new numbers in one pass.
+ */
 
-	/*
-	 *	Run the external hook to refile the old message as the
-	 *	temporary message number that is off of the end of the
-	 *	messages in the folder.
-	 */
+static void
+rename_msgs (struct msgs *mp, struct smsg **mlist, struct sortm_move *plan,
+	     int nmoves)
+{
+    struct sortm_move *mv;
+    struct bvector *flags;
+    int i, *from, lo, hi, curmsg = 0;
+    char oldname[BUFSIZ], newname[BUFSIZ];
+    char oldpath[PATH_MAX + 1], newpath[PATH_MAX + 1];
+
+    if (nmoves == 0)
+	return;
+
+    for (mv = plan; mv < plan + nmoves; mv++) {
+	if (verbose) {
+	    if (mv->new == mp->hghmsg + 1)
+		printf ("renaming message chain from %d to %d\n",
+			mv->old, mv->last);
+	    else if (mv->old != mp->hghmsg + 1)
+		printf ("message %d becomes message %d\n", mv->old, mv->new);
+	}
 
-	(void)snprintf(f1, sizeof (f1), "%s/%d", mp->foldpath, old);
-	(void)snprintf(newbuf, sizeof (newbuf), "%s/%d", mp->foldpath, mp->hghmsg + 1);
-	ext_hook("ref-hook", f1, newbuf);
+	(void)snprintf(oldpath, sizeof (oldpath), "%s/%d", mp->foldpath, mv->old);
+	(void)snprintf(newpath, sizeof (newpath), "%s/%d", mp->foldpath, mv->new);
+	ext_hook("ref-hook", oldpath, newpath);
 
-	if (rename (f1, tmpfil) == NOTOK)
-	    adios (tmpfil, "unable to rename %s to ", f1);
+	/* We're in the folder, so the short names are quicker to look up. */
+	(void)snprintf(oldname, sizeof (oldname), "%d", mv->old);
+	(void)snprintf(newname, sizeof (newname), "%d", mv->new);
+	if (rename (oldname, newname) == NOTOK)
+	    adios (newpath, "unable to rename %s to", oldpath);
+    }
 
-	get_msg_flags (mp, tmpset, old);
+    /*
+     * from[] gives the message that each number from lo to hi now
+     * holds; the numbers that aren't being sorted keep their own.
+     */
+    lo = mp->lowsel;
+    hi = mp->hghsel;
+    from = mh_xmalloc ((hi - lo + 1) * sizeof *from);
+    for (i = lo; i <= hi; i++)
+	from[i - lo] = i;
+    for (i = 0; i < nmsgs; i++)
+	from[smsgs[i].s_msg - lo] = mlist[i]->s_msg;
 
-	rename_chain (mp, mlist, j, i);
+    flags = mh_xcalloc (nmsgs, sizeof *flags);
+    for (i = 0; i < nmsgs; i++) {
+	bvector_init (&flags[i]);
+	bvector_copy (&flags[i], msgstat (mp, mlist[i]->s_msg));
+	if (mlist[i]->s_msg == mp->curmsg)
+	    curmsg = smsgs[i].s_msg;
+    }
+    for (i = 0; i < nmsgs; i++) {
+	bvector_copy (msgstat (mp, smsgs[i].s_msg), &flags[i]);
+	bvector_fini (&flags[i]);
+    }
+    free (flags);
 
-	/*
-	 *	Run the external hook to refile the temporary message number
-	 *	to the real place.
-	 */
+    seq_permute (mp, lo, hi, from);
+    free (from);
+    if (curmsg)
+	seq_setcur (mp, curmsg);
+    mp->msgflags |= SEQMOD;
+}
 
-	(void)snprintf(f1, sizeof (f1), "%s/%d", mp->foldpath, new);
-	ext_hook("ref-hook", newbuf, f1);
+/*
+ * Print the renames that sorting would take, for -dryrun.
+ */
 
-	if (rename (tmpfil, m_name(new)) == NOTOK)
-	    adios (m_name(new), "unable to rename %s to", tmpfil);
+static void
+print_moves (struct msgs *mp, struct sortm_move *plan, int nmoves,
+	     int ncycles)
+{
+    struct sortm_move *mv;
 
-	set_msg_flags (mp, tmpset, new);
-	mp->msgflags |= SEQMOD;
+    for (mv = plan; mv < plan + nmoves; mv++) {
+	if (mv->new == mp->hghmsg + 1)
+	    printf ("message %d would be parked at %d\n", mv->old, mv->new);
+	else
+	    printf ("message %d would become message %d\n", mv->old, mv->new);
     }
-
-    bvector_free (tmpset);
+    printf ("%d message%s would move, in %d cycle%s of %d rename%s\n",
+	    nmoves - ncycles, PLURALS(nmoves - ncycles),
+	    ncycles, PLURALS(ncycles), nmoves, PLURALS(nmoves));
 }
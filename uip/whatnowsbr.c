@@ -950,6 +950,7 @@ buildfile (char **argp, char *file)
     X("watch", 0, WATCSW) \
     X("nowatch", 0, NWATCSW) \
     X("width columns", 0, WIDTHSW) \
+    X("jobs number", 0, JOBSSW) \
     X("version", 0, SVERSIONSW) \
     X("help", 0, SHELPSW) \
     X("dashstuffing", -12, BITSTUFFSW) \
@@ -1165,6 +1166,7 @@ sendit (char *sp, char **arg, char *file, int pushed)
 		case ALIASW:
 		case FILTSW:
 		case WIDTHSW:
+		case JOBSSW:
 		case CLIESW:
 		case SERVSW:
 		case USERSW: